@@ -0,0 +1,307 @@
+#include <math.h>
+#include <algorithm>
+#include "clip_compressor.hpp"
+
+#define SQRT_2 1.41421356f
+#define SQRT_1_2 0.70710678f
+#define PACKED_COMPONENT_MAX 32767.0f	// 15 bits per rotation component
+
+namespace
+{
+	float keyFactor(double FirstTime, double LastTime, double Time)
+	{
+		double Span = LastTime - FirstTime;
+		return Span > 0.0 ? (float)((Time - FirstTime) / Span) : 0.0f;
+	}
+
+	Quaternion toQuaternion(const aiQuaternion& q)
+	{
+		return Quaternion(q.x, q.y, q.z, q.w);
+	}
+
+	// Distance from key Key to the line between keys First and Last
+	float vectorError(const aiVectorKey* pKeys, unsigned int First, unsigned int Last, unsigned int Key)
+	{
+		float Factor = keyFactor(pKeys[First].mTime, pKeys[Last].mTime, pKeys[Key].mTime);
+		const aiVector3D& a = pKeys[First].mValue;
+		const aiVector3D& b = pKeys[Last].mValue;
+		const aiVector3D& v = pKeys[Key].mValue;
+		float x = a.x + (b.x - a.x) * Factor - v.x;
+		float y = a.y + (b.y - a.y) * Factor - v.y;
+		float z = a.z + (b.z - a.z) * Factor - v.z;
+		return sqrtf(x * x + y * y + z * z);
+	}
+
+	// Angle between key Key and the nlerp of keys First and Last, the way
+	// samplePackedRotation will reconstruct it. Worked out from the chord
+	// between the two quaternions, the arc cosine of their dot product is
+	// too imprecise for angles this small.
+	float rotationError(const aiQuatKey* pKeys, unsigned int First, unsigned int Last, unsigned int Key)
+	{
+		float Factor = keyFactor(pKeys[First].mTime, pKeys[Last].mTime, pKeys[Key].mTime);
+		Quaternion Interpolated = Nlerp(toQuaternion(pKeys[First].mValue), toQuaternion(pKeys[Last].mValue), Factor);
+		Quaternion v = toQuaternion(pKeys[Key].mValue);
+		v.Normalize();
+
+		float Dot = Interpolated.x * v.x + Interpolated.y * v.y + Interpolated.z * v.z + Interpolated.w * v.w;
+		float Sign = Dot < 0.0f ? -1.0f : 1.0f;
+		float x = Interpolated.x - v.x * Sign;
+		float y = Interpolated.y - v.y * Sign;
+		float z = Interpolated.z - v.z * Sign;
+		float w = Interpolated.w - v.w * Sign;
+		float Chord = sqrtf(x * x + y * y + z * z + w * w);
+		return 4.0f * asinf(std::min(Chord * 0.5f, 1.0f));
+	}
+
+	// Greedy: each segment is stretched over as many keys as it can cover
+	// before one of the keys it skips is off by more than Tolerance
+	template <typename T>
+	void reduceKeys(const T* pKeys, unsigned int NumKeys, float Tolerance,
+					float (*Error)(const T*, unsigned int, unsigned int, unsigned int),
+					std::vector<unsigned int>& Kept)
+	{
+		Kept.clear();
+		if(NumKeys == 0)
+		{
+			return;
+		}
+
+		Kept.push_back(0);
+
+		// Exported clips have a key on every frame of every track, even the
+		// ones that never move
+		bool Constant = true;
+		for(unsigned int i = 1; i < NumKeys && Constant; i++)
+		{
+			Constant = Error(pKeys, 0, 0, i) <= Tolerance;
+		}
+		if(Constant)
+		{
+			return;
+		}
+
+		unsigned int First = 0;
+		for(unsigned int Last = 2; Last < NumKeys; Last++)
+		{
+			for(unsigned int i = First + 1; i < Last; i++)
+			{
+				if(Error(pKeys, First, Last, i) > Tolerance)
+				{
+					First = Last - 1;
+					Kept.push_back(First);
+					break;
+				}
+			}
+		}
+		Kept.push_back(NumKeys - 1);
+	}
+
+	unsigned short packTime(double Time, float TimeScale)
+	{
+		float Packed = (float)Time * TimeScale;
+		Packed = std::max(0.0f, std::min(Packed, PACKED_TIME_MAX));
+		return (unsigned short)(Packed + 0.5f);
+	}
+
+	unsigned short packComponent(float Value, float Min, float Extent)
+	{
+		if(Extent <= 0.0f)
+		{
+			return 0;
+		}
+		float Packed = (Value - Min) / Extent * 65535.0f;
+		return (unsigned short)(std::max(0.0f, std::min(Packed, 65535.0f)) + 0.5f);
+	}
+
+	// The dropped component is made positive, q and -q are the same rotation
+	void packRotation(const aiQuaternion& q, unsigned short Value[3])
+	{
+		float c[4] = { q.x, q.y, q.z, q.w };
+		unsigned int Largest = 0;
+		float SquaredLength = 0.0f;
+		for(unsigned int i = 0; i < 4; i++)
+		{
+			SquaredLength += c[i] * c[i];
+			Largest = fabs(c[i]) > fabs(c[Largest]) ? i : Largest;
+		}
+		float Scale = SquaredLength > 0.0f ? 1.0f / sqrtf(SquaredLength) : 1.0f;
+		Scale = c[Largest] < 0.0f ? -Scale : Scale;
+
+		for(unsigned int i = 0, j = 0; i < 4; i++)
+		{
+			if(i == Largest)
+			{
+				continue;
+			}
+			float Packed = (c[i] * Scale * SQRT_2 * 0.5f + 0.5f) * PACKED_COMPONENT_MAX;
+			Value[j++] = (unsigned short)(std::max(0.0f, std::min(Packed, PACKED_COMPONENT_MAX)) + 0.5f);
+		}
+		Value[0] |= (Largest & 1) << 15;
+		Value[1] |= (Largest >> 1) << 15;
+	}
+
+	Quaternion unpackRotation(const unsigned short Value[3])
+	{
+		unsigned int Largest = (Value[0] >> 15) | ((Value[1] >> 15) << 1);
+		float c[4];
+		float SquaredSum = 0.0f;
+		for(unsigned int i = 0, j = 0; i < 4; i++)
+		{
+			if(i == Largest)
+			{
+				continue;
+			}
+			c[i] = ((Value[j++] & 0x7FFF) / PACKED_COMPONENT_MAX * 2.0f - 1.0f) * SQRT_1_2;
+			SquaredSum += c[i] * c[i];
+		}
+		c[Largest] = sqrtf(std::max(0.0f, 1.0f - SquaredSum));
+		return Quaternion(c[0], c[1], c[2], c[3]);
+	}
+
+	Vector3f unpackVector(const PackedTrack& Track, const PackedKey& Key)
+	{
+		return Vector3f(Track.Min[0] + Key.Value[0] * (Track.Extent[0] / 65535.0f),
+						Track.Min[1] + Key.Value[1] * (Track.Extent[1] / 65535.0f),
+						Track.Min[2] + Key.Value[2] * (Track.Extent[2] / 65535.0f));
+	}
+
+	// Index of the key the time falls after, found by binary search. Times
+	// past the last key use the last pair of keys. Needs two keys or more.
+	unsigned int findPackedKey(const PackedKey* pKeys, unsigned int NumKeys, float Time)
+	{
+		unsigned int Low = 1;
+		unsigned int High = NumKeys - 1;
+		while(Low < High)
+		{
+			unsigned int Mid = (Low + High) / 2;
+			if(Time < pKeys[Mid].Time)
+			{
+				High = Mid;
+			}
+			else
+			{
+				Low = Mid + 1;
+			}
+		}
+		return Low - 1;
+	}
+
+	float packedFactor(const PackedKey* pKeys, unsigned int Index, float Time)
+	{
+		float DeltaTime = (float)(pKeys[Index + 1].Time - pKeys[Index].Time);
+		float Factor = DeltaTime > 0.0f ? (Time - pKeys[Index].Time) / DeltaTime : 0.0f;
+		return Factor < 0.0f ? 0.0f : (Factor > 1.0f ? 1.0f : Factor);
+	}
+}
+
+void reduceVectorKeys(const aiVectorKey* pKeys, unsigned int NumKeys, float Tolerance,
+					  std::vector<unsigned int>& Kept)
+{
+	reduceKeys(pKeys, NumKeys, Tolerance, vectorError, Kept);
+}
+
+void reduceRotationKeys(const aiQuatKey* pKeys, unsigned int NumKeys, float Tolerance,
+						std::vector<unsigned int>& Kept)
+{
+	reduceKeys(pKeys, NumKeys, Tolerance, rotationError, Kept);
+}
+
+void packVectorTrack(const aiVectorKey* pKeys, const std::vector<unsigned int>& Kept,
+					 float TimeScale, PackedTrack& Track, std::vector<PackedKey>& Stream)
+{
+	Track.FirstKey = Stream.size();
+	Track.NumKeys = Kept.size();
+
+	float Max[3];
+	for(unsigned int c = 0; c < 3; c++)
+	{
+		Track.Min[c] = Kept.empty() ? 0.0f : (&pKeys[Kept[0]].mValue.x)[c];
+		Max[c] = Track.Min[c];
+	}
+	for(unsigned int i = 1; i < Kept.size(); i++)
+	{
+		const float* pValue = &pKeys[Kept[i]].mValue.x;
+		for(unsigned int c = 0; c < 3; c++)
+		{
+			Track.Min[c] = std::min(Track.Min[c], pValue[c]);
+			Max[c] = std::max(Max[c], pValue[c]);
+		}
+	}
+	for(unsigned int c = 0; c < 3; c++)
+	{
+		Track.Extent[c] = Max[c] - Track.Min[c];
+	}
+
+	for(unsigned int i = 0; i < Kept.size(); i++)
+	{
+		const aiVectorKey& Key = pKeys[Kept[i]];
+		PackedKey Packed;
+		Packed.Time = packTime(Key.mTime, TimeScale);
+		for(unsigned int c = 0; c < 3; c++)
+		{
+			Packed.Value[c] = packComponent((&Key.mValue.x)[c], Track.Min[c], Track.Extent[c]);
+		}
+		Stream.push_back(Packed);
+	}
+}
+
+void packRotationTrack(const aiQuatKey* pKeys, const std::vector<unsigned int>& Kept,
+					   float TimeScale, PackedTrack& Track, std::vector<PackedKey>& Stream)
+{
+	Track.FirstKey = Stream.size();
+	Track.NumKeys = Kept.size();
+	for(unsigned int c = 0; c < 3; c++)
+	{
+		Track.Min[c] = 0.0f;
+		Track.Extent[c] = 0.0f;
+	}
+
+	for(unsigned int i = 0; i < Kept.size(); i++)
+	{
+		const aiQuatKey& Key = pKeys[Kept[i]];
+		PackedKey Packed;
+		Packed.Time = packTime(Key.mTime, TimeScale);
+		packRotation(Key.mValue, Packed.Value);
+		Stream.push_back(Packed);
+	}
+}
+
+Vector3f samplePackedVector(const PackedTrack& Track, const PackedKey* pStream, float Time,
+							const Vector3f& Default)
+{
+	if(Track.NumKeys == 0)
+	{
+		return Default;
+	}
+
+	const PackedKey* pKeys = pStream + Track.FirstKey;
+	if(Track.NumKeys == 1)
+	{
+		return unpackVector(Track, pKeys[0]);
+	}
+
+	unsigned int Index = findPackedKey(pKeys, Track.NumKeys, Time);
+	float Factor = packedFactor(pKeys, Index, Time);
+	Vector3f a = unpackVector(Track, pKeys[Index]);
+	Vector3f b = unpackVector(Track, pKeys[Index + 1]);
+	return Vector3f(a.x + (b.x - a.x) * Factor, a.y + (b.y - a.y) * Factor, a.z + (b.z - a.z) * Factor);
+}
+
+Quaternion samplePackedRotation(const PackedTrack& Track, const PackedKey* pStream, float Time,
+								const Quaternion& Default)
+{
+	if(Track.NumKeys == 0)
+	{
+		return Default;
+	}
+
+	const PackedKey* pKeys = pStream + Track.FirstKey;
+	if(Track.NumKeys == 1)
+	{
+		return unpackRotation(pKeys[0].Value);
+	}
+
+	unsigned int Index = findPackedKey(pKeys, Track.NumKeys, Time);
+	return Nlerp(unpackRotation(pKeys[Index].Value), unpackRotation(pKeys[Index + 1].Value),
+				 packedFactor(pKeys, Index, Time));
+}
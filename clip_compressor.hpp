@@ -0,0 +1,69 @@
+#ifndef CLIP_COMPRESSOR_HPP
+#define CLIP_COMPRESSOR_HPP
+
+#include <vector>
+#include <assimp/scene.h>
+#include "math_3d.h"
+
+/* Compression run on every imported animation clip, one track at a time:
+
+	reduce*Keys   drop the keys that interpolating between the keys kept
+	              around them reproduces within a tolerance
+	pack*Track    quantize the kept keys and append them to a stream
+	              shared by the whole clip
+
+Times are quantized to 16 bits over the length of the clip. Positions and
+scales get 16 bits per component over the range of their track. Rotations
+use the smallest three encoding: the largest component follows from the
+other three and is dropped, which leaves three components within
+[-1/sqrt(2), 1/sqrt(2)] that get 15 bits each plus 2 bits saying which one
+was dropped. Every key keeps its time next to its value, so a search of the
+times lands on the values it needs. */
+
+// The largest error the key reduction may introduce on each kind of track,
+// before quantization
+struct ClipTolerance
+{
+	float Position;	// in the units of the node's parent
+	float Rotation;	// in radians
+	float Scaling;
+};
+
+struct PackedKey
+{
+	unsigned short Time;
+	unsigned short Value[3];
+};
+
+struct PackedTrack
+{
+	unsigned int FirstKey;	// into the clip's stream
+	unsigned int NumKeys;
+	// The range values are quantized over, unused for rotations
+	float Min[3];
+	float Extent[3];
+};
+
+#define PACKED_TIME_MAX 65535.0f
+
+// Fill Kept with the indices of the keys to keep. The first and last keys
+// are always kept, unless the whole track is one constant value.
+void reduceVectorKeys(const aiVectorKey* pKeys, unsigned int NumKeys, float Tolerance,
+					  std::vector<unsigned int>& Kept);
+void reduceRotationKeys(const aiQuatKey* pKeys, unsigned int NumKeys, float Tolerance,
+						std::vector<unsigned int>& Kept);
+
+// TimeScale turns key times into packed times, PACKED_TIME_MAX / Duration
+void packVectorTrack(const aiVectorKey* pKeys, const std::vector<unsigned int>& Kept,
+					 float TimeScale, PackedTrack& Track, std::vector<PackedKey>& Stream);
+void packRotationTrack(const aiQuatKey* pKeys, const std::vector<unsigned int>& Kept,
+					   float TimeScale, PackedTrack& Track, std::vector<PackedKey>& Stream);
+
+// Time is a packed time, from 0 to PACKED_TIME_MAX. A track without keys
+// samples as Default, the node's bind value.
+Vector3f samplePackedVector(const PackedTrack& Track, const PackedKey* pStream, float Time,
+							const Vector3f& Default);
+Quaternion samplePackedRotation(const PackedTrack& Track, const PackedKey* pStream, float Time,
+								const Quaternion& Default);
+
+#endif
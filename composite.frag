@@ -0,0 +1,16 @@
+#version 330 core
+
+in vec2 UV;
+
+layout(location = 0) out vec4 color;
+
+uniform sampler2D colorTexture;
+uniform sampler2D depthTexture;
+
+void main()
+{
+	// Copy the offscreen scene to the screen along with its depth, so that
+	// the outline and particle passes that follow still depth test correctly
+	color = vec4(texture(colorTexture, UV).rgb, 1.0);
+	gl_FragDepth = texture(depthTexture, UV).r;
+}
@@ -0,0 +1,220 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "crowd.hpp"
+#include "trace.hpp"
+
+Crowd::Crowd(Mesh* pMesh)
+	: m_mesh(pMesh),
+	  m_num_instances(0),
+	  m_num_frames(0),
+	  m_bone_texture(0),
+	  m_instance_buffer(0)
+{
+	for(unsigned int i = 0; i < MAX_MESH_LODS; i++)
+	{
+		m_lod_first_bone[i] = 0;
+		m_lod_first_instance[i] = 0;
+		m_lod_instances[i] = 0;
+	}
+}
+
+Crowd::~Crowd()
+{
+	if(m_bone_texture != 0)
+	{
+		glDeleteTextures(1, &m_bone_texture);
+	}
+	if(m_instance_buffer != 0)
+	{
+		glDeleteBuffers(1, &m_instance_buffer);
+	}
+}
+
+bool Crowd::bake(float FramesPerSecond)
+{
+	TraceScope scope("crowd", "bake");
+
+	// Every LOD's palette follows the one before it
+	unsigned int NumBones = 0;
+	for(unsigned int i = 0; i < m_mesh->getNumLods(); i++)
+	{
+		m_lod_first_bone[i] = NumBones;
+		NumBones += m_mesh->getLodBones(i).size();
+	}
+
+	unsigned int NumClips = m_mesh->getNumClips();
+	GLint MaxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &MaxSize);
+	if(m_mesh->getNumBones() == 0 || NumClips == 0 || 3 * NumBones > (unsigned int)MaxSize ||
+	   NumClips >= (unsigned int)MaxSize)
+	{
+		printf("Cannot bake a crowd from a mesh with %u bones and %u clips\n", NumBones, NumClips);
+		return false;
+	}
+
+	// Rounding each clip up adds less than a frame per clip
+	float TotalDuration = 0.0f;
+	for(unsigned int i = 0; i < NumClips; i++)
+	{
+		TotalDuration += m_mesh->getClipDuration(i);
+	}
+	if(TotalDuration * FramesPerSecond > MaxSize - NumClips)
+	{
+		FramesPerSecond = (MaxSize - NumClips) / TotalDuration;
+	}
+
+	m_clips.resize(NumClips);
+	m_num_frames = 0;
+	for(unsigned int i = 0; i < NumClips; i++)
+	{
+		m_clips[i].FirstFrame = m_num_frames;
+		m_clips[i].Duration = m_mesh->getClipDuration(i);
+		m_clips[i].NumFrames = std::max(1u, (unsigned int)ceilf(m_clips[i].Duration * FramesPerSecond));
+		m_num_frames += m_clips[i].NumFrames;
+	}
+
+	// The frames of a clip are spread evenly over it, so the last one
+	// interpolates back into the first
+	unsigned int Width = 3 * NumBones;
+	std::vector<float> Texels(Width * m_num_frames * 4);
+	std::vector<Matrix4f> Transforms;
+	for(unsigned int i = 0; i < NumClips; i++)
+	{
+		const BakedClip& Clip = m_clips[i];
+		for(unsigned int f = 0; f < Clip.NumFrames; f++)
+		{
+			m_mesh->boneTransform(f * Clip.Duration / Clip.NumFrames, Transforms, i);
+			float* pRow = &Texels[(Clip.FirstFrame + f) * Width * 4];
+			for(unsigned int l = 0; l < m_mesh->getNumLods(); l++)
+			{
+				const std::vector<unsigned int>& Bones = m_mesh->getLodBones(l);
+				for(unsigned int b = 0; b < Bones.size(); b++)
+				{
+					memcpy(pRow + (m_lod_first_bone[l] + b) * 12, Transforms[Bones[b]].m, 12 * sizeof(float));
+				}
+			}
+		}
+	}
+
+	glGenTextures(1, &m_bone_texture);
+	glBindTexture(GL_TEXTURE_2D, m_bone_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, Width, m_num_frames, 0, GL_RGBA, GL_FLOAT, &Texels[0]);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	Trace::addBytesUploaded(Texels.size() * sizeof(float));
+
+	return GLCheckError();
+}
+
+void Crowd::addInstance(const glm::mat4& ModelMatrix, unsigned int ClipIndex, float Phase)
+{
+	assert(ClipIndex < m_clips.size());
+	const BakedClip& Clip = m_clips[ClipIndex];
+
+	Mesh::CrowdInstance Instance;
+	for(unsigned int Row = 0; Row < 3; Row++)
+	{
+		for(unsigned int Column = 0; Column < 4; Column++)
+		{
+			Instance.ModelRows[Row][Column] = ModelMatrix[Column][Row];
+		}
+	}
+	Instance.FirstFrame = Clip.FirstFrame;
+	Instance.NumFrames = Clip.NumFrames;
+	Instance.FramesPerSecond = Clip.Duration > 0.0f ? Clip.NumFrames / Clip.Duration : 0.0f;
+	Instance.Phase = Phase;
+	m_instances.push_back(Instance);
+
+	// Crowds are scaled uniformly, see crowd.vert
+	const Vector3f& Center = m_mesh->getClipBoundsCenter(ClipIndex);
+	glm::vec4 Bounds = ModelMatrix * glm::vec4(Center.x, Center.y, Center.z, 1.0f);
+	Bounds.w = m_mesh->getClipBoundsRadius(ClipIndex) * glm::length(glm::vec3(ModelMatrix[0]));
+	m_bounds.push_back(Bounds);
+}
+
+bool Crowd::upload()
+{
+	m_num_instances = m_instances.size();
+	if(m_num_instances == 0)
+	{
+		return true;
+	}
+
+	// Until the first update every instance is drawn at full detail
+	glGenBuffers(1, &m_instance_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, m_instance_buffer);
+	glBufferData(GL_ARRAY_BUFFER, m_num_instances * sizeof(Mesh::CrowdInstance), &m_instances[0],
+				 GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	Trace::addBytesUploaded(m_num_instances * sizeof(Mesh::CrowdInstance));
+
+	m_sorted.resize(m_num_instances);
+	m_instance_lods.resize(m_num_instances);
+	m_lod_first_instance[0] = 0;
+	m_lod_instances[0] = m_num_instances;
+
+	return GLCheckError();
+}
+
+// The same test as Game::selectMeshLod, then a counting sort by LOD
+void Crowd::update(const glm::vec3& CameraPos, float ProjectionScale)
+{
+	if(m_num_instances == 0)
+	{
+		return;
+	}
+
+	for(unsigned int i = 0; i < MAX_MESH_LODS; i++)
+	{
+		m_lod_instances[i] = 0;
+	}
+	for(unsigned int i = 0; i < m_num_instances; i++)
+	{
+		float Radius = m_bounds[i].w;
+		float Distance = glm::length(glm::vec3(m_bounds[i]) - CameraPos);
+		float ScreenSize = Distance > Radius ? Radius * ProjectionScale / Distance : 1.0f;
+		m_instance_lods[i] = m_mesh->selectLod(ScreenSize);
+		m_lod_instances[m_instance_lods[i]]++;
+	}
+
+	unsigned int Next[MAX_MESH_LODS];
+	unsigned int First = 0;
+	for(unsigned int i = 0; i < MAX_MESH_LODS; i++)
+	{
+		m_lod_first_instance[i] = First;
+		Next[i] = First;
+		First += m_lod_instances[i];
+	}
+	for(unsigned int i = 0; i < m_num_instances; i++)
+	{
+		m_sorted[Next[m_instance_lods[i]]++] = m_instances[i];
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_instance_buffer);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, m_num_instances * sizeof(Mesh::CrowdInstance), &m_sorted[0]);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Crowd::render(GLint LodFirstBoneUnif)
+{
+	if(m_num_instances == 0 || m_bone_texture == 0)
+	{
+		return;
+	}
+
+	glActiveTexture(GL_TEXTURE0 + CROWD_BONE_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, m_bone_texture);
+	for(unsigned int i = 0; i < m_mesh->getNumLods(); i++)
+	{
+		if(m_lod_instances[i] == 0)
+		{
+			continue;
+		}
+		glUniform1i(LodFirstBoneUnif, m_lod_first_bone[i]);
+		m_mesh->renderInstances(m_instance_buffer, m_lod_instances[i], i, m_lod_first_instance[i]);
+	}
+}
@@ -0,0 +1,81 @@
+#ifndef CROWD_HPP
+#define CROWD_HPP
+
+#include <vector>
+#include "mesh.hpp"
+#include "glm/glm.hpp"
+
+/* Background characters drawn in bulk. Every clip of the mesh is sampled once
+at load into a texture of bone matrices, a row per frame and three texels per
+bone, and crowd.vert skins each instance straight from it at the frame its own
+clip and phase give. An instance is then nothing but a model matrix and a clip
+in a vertex buffer, and costs no animation work at all.
+
+Each frame update sorts the instances into one range per mesh LOD, by the
+screen size test the characters use, and the whole crowd is one instanced
+draw per mesh entry of each LOD in use. The bone texture holds every LOD's
+palette side by side, since LOD vertices index their LOD's palette slots.
+
+Crowds do not move, collide or react to anything, the enemies the player
+actually fights are still DynamicRenderables. */
+
+// The texture unit crowd.vert reads the baked bones from
+#define CROWD_BONE_TEXTURE_UNIT 2
+
+class Crowd
+{
+public:
+	Crowd(Mesh* pMesh);
+	~Crowd();
+
+	// Samples every clip of the mesh FramesPerSecond times a second into the
+	// bone texture, or less often if the clips would not fit otherwise. Runs
+	// on the GL thread once the mesh has been uploaded.
+	bool bake(float FramesPerSecond);
+	// Phase is the time into the clip the instance is at when the game
+	// starts. Only valid between bake and upload.
+	void addInstance(const glm::mat4& ModelMatrix, unsigned int ClipIndex, float Phase);
+	// Makes the instance buffer, the instances stay on the CPU for update
+	bool upload();
+	// Picks every instance's LOD for a camera at CameraPos, ProjectionScale
+	// being element [1][1] of the projection matrix, and uploads the
+	// instances sorted by it
+	void update(const glm::vec3& CameraPos, float ProjectionScale);
+	// Draws every instance, with a program built from crowd.vert bound.
+	// LodFirstBoneUnif is its lodFirstBone uniform.
+	void render(GLint LodFirstBoneUnif);
+
+	Mesh* getMesh() { return m_mesh; }
+	unsigned int getNumInstances() const { return m_num_instances; }
+	// Of the last update
+	unsigned int getNumInstances(unsigned int Lod) const { return m_lod_instances[Lod]; }
+	unsigned int getNumFrames() const { return m_num_frames; }
+
+private:
+	struct BakedClip
+	{
+		unsigned int FirstFrame;	// row of the bone texture
+		unsigned int NumFrames;
+		float Duration;	// in seconds
+	};
+
+	Mesh* m_mesh;
+	std::vector<BakedClip> m_clips;
+	std::vector<Mesh::CrowdInstance> m_instances;
+	// World space bounding sphere of every pose of each instance's clip
+	std::vector<glm::vec4> m_bounds;
+	// The instances as update last uploaded them, and the LOD of each
+	std::vector<Mesh::CrowdInstance> m_sorted;
+	std::vector<unsigned char> m_instance_lods;
+	unsigned int m_num_instances;
+	// Where each LOD's palette starts in the bone texture, in bones
+	unsigned int m_lod_first_bone[MAX_MESH_LODS];
+	// The range of m_sorted each LOD draws
+	unsigned int m_lod_first_instance[MAX_MESH_LODS];
+	unsigned int m_lod_instances[MAX_MESH_LODS];
+	unsigned int m_num_frames;
+	GLuint m_bone_texture;
+	GLuint m_instance_buffer;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#version 400
+
+// Crowds, see crowd.hpp. Every instance is skinned here from the bone
+// matrices Crowd::bake sampled, blended between the two baked frames either
+// side of the instance's time, and lit like toon.vert so it pairs with
+// toon.frag. Built with SHADOW_PASS defined it only outputs the position,
+// for shadows.frag. Dual quaternion meshes are skinned linearly here.
+
+layout (location = 0) in vec3 VertexPosition;
+layout (location = 1) in vec2 VertexUVCoords;
+layout (location = 2) in vec3 VertexNormal;
+layout (location = 3) in ivec4 BoneIDs;
+layout (location = 4) in vec4 BoneWeights;
+// Per instance: the rows of the model matrix, then the first frame of the
+// clip, its number of frames, frames per second and the phase in seconds
+layout (location = 5) in vec4 ModelRow0;
+layout (location = 6) in vec4 ModelRow1;
+layout (location = 7) in vec4 ModelRow2;
+layout (location = 8) in vec4 ClipInfo;
+
+// One row per frame, three texels per bone holding the first three rows of
+// its matrix. Each mesh LOD has its palette there, BoneIDs index the one of
+// the LOD drawn, which starts at lodFirstBone.
+uniform sampler2D bakedBones;
+uniform int lodFirstBone;
+uniform float time;
+
+#ifdef SHADOW_PASS
+
+uniform mat4 lightVP;
+
+#else
+
+out vec3 LightIntensity;
+out vec2 UV;
+out vec4 ShadowCoord;
+
+uniform vec4 LightPosition;
+uniform vec3 Ka;
+uniform vec3 Kd;
+uniform vec3 Ks;
+uniform float shininess;
+uniform vec3 La;
+uniform vec3 Ld;
+uniform vec3 Ls;
+uniform mat4 ViewMatrix;
+uniform mat4 ProjectionMatrix;
+uniform mat4 depthBiasVP;
+
+#endif
+
+mat4 bakedBone(int bone, int frame)
+{
+	vec4 row0 = texelFetch(bakedBones, ivec2(3 * bone, frame), 0);
+	vec4 row1 = texelFetch(bakedBones, ivec2(3 * bone + 1, frame), 0);
+	vec4 row2 = texelFetch(bakedBones, ivec2(3 * bone + 2, frame), 0);
+	// GLSL matrices are built from columns
+	return mat4(row0.x, row1.x, row2.x, 0.0,
+				row0.y, row1.y, row2.y, 0.0,
+				row0.z, row1.z, row2.z, 0.0,
+				row0.w, row1.w, row2.w, 1.0);
+}
+
+void main()
+{
+	int numFrames = int(ClipInfo.y);
+	float frame = mod((time + ClipInfo.w) * ClipInfo.z, ClipInfo.y);
+	int frame0 = min(int(frame), numFrames - 1);
+	int frame1 = frame0 + 1 == numFrames ? 0 : frame0 + 1;
+	float factor = fract(frame);
+	frame0 += int(ClipInfo.x);
+	frame1 += int(ClipInfo.x);
+
+	mat4 boneMatrix = mat4(0.0);
+	for(int i = 0; i < 4; i++)
+	{
+		mat4 bone0 = bakedBone(lodFirstBone + BoneIDs[i], frame0);
+		mat4 bone1 = bakedBone(lodFirstBone + BoneIDs[i], frame1);
+		boneMatrix += (bone0 + (bone1 - bone0) * factor) * BoneWeights[i];
+	}
+
+	mat4 modelMatrix = transpose(mat4(ModelRow0, ModelRow1, ModelRow2, vec4(0.0, 0.0, 0.0, 1.0)));
+	vec4 worldPosition = modelMatrix * (boneMatrix * vec4(VertexPosition, 1.0));
+
+#ifdef SHADOW_PASS
+	gl_Position = lightVP * worldPosition;
+#else
+	// Crowds are scaled uniformly, so the model view matrix can stand in for
+	// the normal matrix once the result is normalized
+	mat4 modelViewMatrix = ViewMatrix * modelMatrix;
+	vec3 tnorm = normalize(mat3(modelViewMatrix) * (mat3(boneMatrix) * VertexNormal));
+	vec4 eyeCoords = ViewMatrix * worldPosition;
+	vec3 s = normalize(vec3(LightPosition - eyeCoords));
+	vec3 v = normalize(-eyeCoords.xyz);
+	vec3 r = reflect(-s, tnorm);
+	vec3 ambient = La * Ka;
+	float sDotN = max(dot(s, tnorm), 0.0);
+	vec3 diffuse = Ld * Kd * sDotN;
+	vec3 spec = vec3(0.0);
+
+	if(sDotN > 0.0)
+	{
+		spec = Ls * Ks * pow(max(dot(r, v), 0.0), shininess);
+	}
+
+	LightIntensity = ambient + diffuse + spec;
+	UV = VertexUVCoords;
+	ShadowCoord = depthBiasVP * worldPosition;
+	gl_Position = ProjectionMatrix * eyeCoords;
+#endif
+}
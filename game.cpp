@@ -1,15 +1,64 @@
 #include <iostream>
+#include <algorithm>
 #include "game.hpp"
 #include "shader.hpp"
 #include "mesh.hpp"
 #include "mesh_list.hpp"
+#include "trace.hpp"
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
 #include "glm/gtc/matrix_inverse.hpp"
 
+static void loadingProgress(unsigned int done, unsigned int total, void* pUserData)
+{
+	((Game*)pUserData)->drawLoadingScreen(done, total);
+}
+
+// Tests a sphere swept from start to end against the six planes of a view
+// projection matrix. It is only rejected when both ends are behind the same
+// plane, which lets a few spheres through near the frustum's corners.
+static bool isSweptSphereInFrustum(const glm::mat4& viewProjMatrix, const glm::vec3& start,
+								   const glm::vec3& end, float radius)
+{
+	glm::vec4 rows[4];
+	for(unsigned int i = 0; i < 4; i++)
+	{
+		rows[i] = glm::vec4(viewProjMatrix[0][i], viewProjMatrix[1][i],
+							viewProjMatrix[2][i], viewProjMatrix[3][i]);
+	}
+
+	for(unsigned int i = 0; i < 3; i++)
+	{
+		glm::vec4 planes[2] = { rows[3] + rows[i], rows[3] - rows[i] };
+		for(unsigned int j = 0; j < 2; j++)
+		{
+			glm::vec3 normal(planes[j]);
+			float limit = -radius * glm::length(normal);
+			if(glm::dot(normal, start) + planes[j].w < limit && glm::dot(normal, end) + planes[j].w < limit)
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static bool isSphereInFrustum(const glm::mat4& viewProjMatrix, const glm::vec3& center, float radius)
+{
+	return isSweptSphereInFrustum(viewProjMatrix, center, center, radius);
+}
+
 Game::Game()
-	: m_skybox("interstellar_up.tga", "interstellar_dn.tga", "interstellar_rt.tga", 
+	: m_animation_pool(WorkerPool::getCoreCount() - 1),	// the render thread helps out
+	  m_animation_lod_distance(400.0f),
+	  m_shadow_cull_length(500.0f),
+	  m_num_culled(0),
+	  m_num_shadow_only(0),
+	  m_animation_fade_time(0.25f),
+	  m_animation_time(0.0f),
+	  m_skybox("interstellar_up.tga", "interstellar_dn.tga", "interstellar_rt.tga", 
 			   "interstellar_lf.tga", "interstellar_bk.tga", "interstellar_ft.tga"),
 	  m_gravity(9.81),
 	  m_particle_system("explosion.png"),
@@ -46,12 +95,18 @@ Game::Game()
 	  m_enemy_attack_particles_time(0.0),
 	  m_enemy_heal_particles_time(0.0),
 
+	  m_single_pass(true),
+
 	  cameraAngleHorizontal(0.0f),
 	  cameraAngleVertical(30.0f),
 	  cameraDistance(80.0f),
 	  cameraHeight(80.0f),
 	  cameraRotationSpeed(1.8f)
 {
+	for(unsigned int i = 0; i < MAX_MESH_LODS; i++)
+	{
+		m_num_mesh_lods[i] = 0;
+	}
 }
 
 Game::~Game()
@@ -60,6 +115,8 @@ Game::~Game()
 
 void Game::initializeProgram()
 {
+	TraceScope scope("init", "initializeProgram");
+
 	//std::vector<GLuint> shaderList;
 
 	//std::string vertexShaderCode = parseShader("vertexshader.glsl");
@@ -71,12 +128,22 @@ void Game::initializeProgram()
 	//programID = createProgram(shaderList);
 
 	//programID = LoadShaders("diffuse.vert", "diffuse.frag");
+	initBonePalette();
+	char boneDefines[64];
+	SNPRINTF(boneDefines, sizeof(boneDefines), "#define MAX_BONES %u\n", maxBones);
+	const char* skinningVaryings[] = { "SkinnedPosition", "SkinnedNormal", "SkinnedUVCoords" };
+	skinningProgramID = LoadTransformFeedbackShader("skinning.vert", skinningVaryings, 3, boneDefines);
+	skinningDualQuatProgramID = LoadTransformFeedbackShader("skinning.vert", skinningVaryings, 3,
+															std::string(boneDefines) + "#define DUAL_QUATERNION_SKINNING\n");
 	programID = LoadShaders("toon.vert", "toon.frag");
+	crowdProgramID = LoadShaders("crowd.vert", "toon.frag");
+	crowdShadowProgramID = LoadShaders("crowd.vert", "shadows.frag", "#define SHADOW_PASS\n");
 	skyboxProgramID = LoadShaders("skybox.vert", "skybox.frag");
 	frameBufferProgramID = LoadShaders("sobel_outline.vert", "sobel_outline.frag");
 	particlesProgramID = LoadShaders("particles.vert", "particles.frag");
 	shadowsProgramID = LoadShaders("shadows.vert", "shadows.frag");
 	quadProgramID = LoadShaders("quadshader.vert", "quadshader.frag");
+	compositeProgramID = LoadShaders("sobel_outline.vert", "composite.frag");
 	quadTextureUnif = glGetUniformLocation(quadProgramID, "texture");
 	glUniform1i(quadTextureUnif, 0);
 
@@ -98,27 +165,22 @@ void Game::initializeProgram()
 
 	skyboxMVPUnif = glGetUniformLocation(skyboxProgramID, "MVP");
 	skyboxSamplerUnif = glGetUniformLocation(skyboxProgramID, "CubeMap");
-	for(int i = 0; i < MAX_BONES; i++)
+	GLuint skinningPrograms[] = { skinningProgramID, skinningDualQuatProgramID };
+	for(unsigned int i = 0; i < 2; i++)
 	{
-		char Name[128];
-		memset(Name, 0, sizeof(Name));
-		SNPRINTF(Name, sizeof(Name), "boneMatrices[%d]", i);
-		boneMatricesUnif[i] = glGetUniformLocation(programID, Name);
-		//std::cerr << boneMatricesUnif[i] << std::endl;
-		/*std::string boneMatricesPosition = "boneMatrices[";
-		ss << i;
-		boneMatricesPosition += ss.str();
-		boneMatricesPosition += "]";
-		ss.str(std::string());
-		ss.clear();
-		std::cerr << boneMatricesPosition << std::endl;
-		boneMatricesUnif[i] = glGetUniformLocation(programID, boneMatricesPosition.c_str());*/
+		GLuint bonePaletteIndex = glGetUniformBlockIndex(skinningPrograms[i], "BonePalette");
+		if(bonePaletteIndex != GL_INVALID_INDEX)
+		{
+			glUniformBlockBinding(skinningPrograms[i], bonePaletteIndex, BONE_PALETTE_BINDING);
+		}
 	}
-	isDynamicUnif = glGetUniformLocation(programID, "isDynamic");
 
 	fbTextureUnif = glGetUniformLocation(frameBufferProgramID, "renderedTexture");
 	fbTimeUnif = glGetUniformLocation(frameBufferProgramID, "time");
 
+	compositeColorUnif = glGetUniformLocation(compositeProgramID, "colorTexture");
+	compositeDepthUnif = glGetUniformLocation(compositeProgramID, "depthTexture");
+
 	particlesViewProjMatrixUnif = glGetUniformLocation(particlesProgramID, "viewProjMatrix");
 	particlesPositionUnif = glGetUniformLocation(particlesProgramID, "position");
 	particlesCurTimeUnif = glGetUniformLocation(particlesProgramID, "curTime");
@@ -126,6 +188,14 @@ void Game::initializeProgram()
 	particlesTextureUnif = glGetUniformLocation(particlesProgramID, "texture");
 
 	shadowsMVPUnif = glGetUniformLocation(shadowsProgramID, "MVP");
+
+	crowdViewMatrixUnif = glGetUniformLocation(crowdProgramID, "ViewMatrix");
+	crowdDepthBiasVPUnif = glGetUniformLocation(crowdProgramID, "depthBiasVP");
+	crowdTimeUnif = glGetUniformLocation(crowdProgramID, "time");
+	crowdLodFirstBoneUnif = glGetUniformLocation(crowdProgramID, "lodFirstBone");
+	crowdShadowLightVPUnif = glGetUniformLocation(crowdShadowProgramID, "lightVP");
+	crowdShadowTimeUnif = glGetUniformLocation(crowdShadowProgramID, "time");
+	crowdShadowLodFirstBoneUnif = glGetUniformLocation(crowdShadowProgramID, "lodFirstBone");
 	
 	glm::vec4 lightPosition(0.0f, 4.0f, 5.0f, 1.0f);
 	glm::vec3 ka(0.6f, 0.8f, 0.8f);
@@ -152,12 +222,35 @@ void Game::initializeProgram()
 	glUniform1i(shadowMapUnif, 1);
 	glUseProgram(0);
 
+	// Crowds are lit the same way
+	glUseProgram(crowdProgramID);
+	glUniform1i(glGetUniformLocation(crowdProgramID, "sampler"), 0);
+	glUniform1i(glGetUniformLocation(crowdProgramID, "shadowMap"), 1);
+	glUniform1i(glGetUniformLocation(crowdProgramID, "bakedBones"), CROWD_BONE_TEXTURE_UNIT);
+	glUniform4fv(glGetUniformLocation(crowdProgramID, "LightPosition"), 1, glm::value_ptr(lightPosition));
+	glUniform3fv(glGetUniformLocation(crowdProgramID, "Ka"), 1, glm::value_ptr(ka));
+	glUniform3fv(glGetUniformLocation(crowdProgramID, "Kd"), 1, glm::value_ptr(kd));
+	glUniform3fv(glGetUniformLocation(crowdProgramID, "Ks"), 1, glm::value_ptr(ks));
+	glUniform1f(glGetUniformLocation(crowdProgramID, "shininess"), shininess);
+	glUniform3fv(glGetUniformLocation(crowdProgramID, "La"), 1, glm::value_ptr(la));
+	glUniform3fv(glGetUniformLocation(crowdProgramID, "Ld"), 1, glm::value_ptr(ld));
+	glUniform3fv(glGetUniformLocation(crowdProgramID, "Ls"), 1, glm::value_ptr(ls));
+	glUniformMatrix4fv(glGetUniformLocation(crowdProgramID, "ProjectionMatrix"), 1, GL_FALSE,
+					   glm::value_ptr(projectionMatrix));
+
+	glUseProgram(crowdShadowProgramID);
+	glUniform1i(glGetUniformLocation(crowdShadowProgramID, "bakedBones"), CROWD_BONE_TEXTURE_UNIT);
+
 	glUseProgram(skyboxProgramID);
 	glUniform1i(skyboxSamplerUnif, 1);
 	
 	glUseProgram(frameBufferProgramID);
 	glUniform1i(fbTextureUnif, 0);
 
+	glUseProgram(compositeProgramID);
+	glUniform1i(compositeColorUnif, 0);
+	glUniform1i(compositeDepthUnif, 1);
+
 	glUseProgram(particlesProgramID);
 	glUniform1f(particlesStartTimeUnif, 0.0);
 	glUniform1i(particlesTextureUnif, 0);
@@ -166,6 +259,37 @@ void Game::initializeProgram()
 	//std::for_each(shaderList.begin(), shaderList.end(), glDeleteShader);
 }
 
+// Sizes the bone palettes for the skinned meshes that were loaded, as far as
+// the uniform block size limit allows, and creates the buffer they go in
+void Game::initBonePalette()
+{
+	maxBones = m_player->getMesh()->getNumBones();
+	for(std::vector<DynamicRenderable*>::iterator it = m_dynamic_renderables.begin();
+		it != m_dynamic_renderables.end();
+		it++)
+	{
+		maxBones = std::max(maxBones, (*it)->getMesh()->getNumBones());
+	}
+	maxBones = std::max(maxBones, 1u);
+
+	GLint maxBlockSize = 0;
+	GLint alignment = 1;
+	glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxBlockSize);
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	unsigned int maxBlockBones = maxBlockSize / sizeof(Matrix4f);
+	if(maxBones > maxBlockBones)
+	{
+		std::cerr << "Skeletons have " << maxBones << " bones but a uniform block only fits "
+				  << maxBlockBones << ", the rest will not animate" << std::endl;
+		maxBones = maxBlockBones;
+	}
+
+	bonePaletteAlignment = alignment;
+
+	glGenBuffers(1, &bonePaletteBuffer);
+	glGenBuffers(1, &skinnedVertexBuffer);
+}
+
 void Game::display()
 {
 	// clear the screen
@@ -189,10 +313,7 @@ void Game::display()
 	glm::mat4 dViewMatrix = glm::lookAt(lightPosition, glm::vec3(0.0f, 0.0f, 0.0f), 
 										glm::vec3(0, 1, 0));
 
-	viewMatrix = glm::lookAt(cameraPos, // world space pos of camera
-						     m_player->getTransform() + glm::vec3(0.0f, 30.0f, 0.0f),// where to look at
-							 glm::vec3(0.0, 1.0f, 0.0f));   // up direction
-	glUniform1i(isDynamicUnif, 0);
+	viewMatrix = getViewMatrix();
 
 	// Render all our static meshes
 	for(std::vector<StaticRenderable*>::iterator it = m_static_renderables.begin();
@@ -214,14 +335,13 @@ void Game::display()
 	}
 
 	//dProjMatrix = glm::ortho<float>(-2000, 2000, -2000, 2000, -1, 2300);
-	glUniform1i(isDynamicUnif, 1);
 
-	// Render all our dynamic meshes
+	// Render all our dynamic meshes, already skinned by updateAnimation
 	for(std::vector<DynamicRenderable*>::iterator it = m_dynamic_renderables.begin();
 		it != m_dynamic_renderables.end();
 		it++)
 	{
-		if((*it)->m_isVisible == false)
+		if((*it)->m_isVisible == false || !(*it)->isInView())
 		{
 			continue;
 		}
@@ -236,14 +356,7 @@ void Game::display()
 		glUniformMatrix4fv( MVPUnif, 1, GL_FALSE, glm::value_ptr(MVP));
 		glUniformMatrix4fv( depthBiasMVPUnif, 1, GL_FALSE, glm::value_ptr(dMVP));
 		
-		(*it)->UpdateTransforms(m_clock.getElapsedTime().asSeconds());
-		for(unsigned int i = 0; i < (*it)->getTransforms().size(); i++)
-		{
-			glUniformMatrix4fv(boneMatricesUnif[i], 1, GL_TRUE,
-							   (const GLfloat*)(*it)->getTransforms()[i].m);
-		}
-
-		(*it)->render();
+		(*it)->renderSkinned(skinnedVertexBuffer);
 	}
 
 	// render the player
@@ -258,15 +371,22 @@ void Game::display()
 	glUniformMatrix4fv( MVPUnif, 1, GL_FALSE, glm::value_ptr(MVP));
 	glUniformMatrix4fv( depthBiasMVPUnif, 1, GL_FALSE, glm::value_ptr(dMVP));
 		
-	m_player->UpdateTransforms(m_clock.getElapsedTime().asSeconds());
-	for(unsigned int i = 0; i < m_player->getTransforms().size(); i++)
+	m_player->renderSkinned(skinnedVertexBuffer);
+
+	// Crowds, every instance of a mesh in one draw per entry of each LOD
+	if(!m_crowds.empty())
 	{
-		glUniformMatrix4fv(boneMatricesUnif[i], 1, GL_TRUE,
-						   (const GLfloat*)m_player->getTransforms()[i].m);
+		glm::mat4 depthBiasVP = biasMatrix * dProjMatrix * dViewMatrix;
+		glUseProgram(crowdProgramID);
+		glUniformMatrix4fv(crowdViewMatrixUnif, 1, GL_FALSE, glm::value_ptr(viewMatrix));
+		glUniformMatrix4fv(crowdDepthBiasVPUnif, 1, GL_FALSE, glm::value_ptr(depthBiasVP));
+		glUniform1f(crowdTimeUnif, m_animation_time);
+		for(std::vector<Crowd*>::iterator it = m_crowds.begin(); it != m_crowds.end(); it++)
+		{
+			(*it)->render(crowdLodFirstBoneUnif);
+		}
 	}
 
-	m_player->render();
-
 	// render the skybox
 	glUseProgram(skyboxProgramID);
 	glm::mat4 skyboxMVP = projectionMatrix * 
@@ -279,72 +399,218 @@ void Game::display()
 	glUseProgram(0);
 }
 
-int Game::startGame()
+bool Game::createWindow(bool visible)
 {
     // create the window
     m_window.create(sf::VideoMode(600, 600), "OpenGL", sf::Style::Default, sf::ContextSettings(32));
-    m_window.setVerticalSyncEnabled(true);
+    m_window.setVerticalSyncEnabled(visible);
+	m_window.setVisible(visible);
 
 	glewExperimental = true;
 	if(glewInit() != GLEW_OK)
 	{
 		std::cerr << "Failed to initialize GLEW" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+int Game::startGame()
+{
+	if(!createWindow(true))
+	{
 		return -1;
 	}
 
     // load resources, initialize the OpenGL states, ...
-	init();
+	if(!init())
+	{
+		return -1;
+	}
 
 	gameLoop();
 
+	Trace::writeChromeTrace("startup_trace.json");
+	Trace::printSummary();
+
 	return 0;
 }
 
-void Game::init()
+// Renders the same scene through both the old two pass path and the single
+// pass path with the window hidden and vsync off, and prints the average
+// frame time of each. glFinish is called every frame so we time the GPU work
+// and not just the command submission.
+int Game::benchmarkRenderPaths(unsigned int frames)
 {
+	if(!createWindow(false))
+	{
+		return -1;
+	}
+
+	if(!init())
+	{
+		return -1;
+	}
+	m_clock.restart();
+
+	bool paths[2] = { false, true };
+	float frameTimes[2];
+	unsigned long lodRequests[PoseCache::NUM_LODS] = { 0 };
+	unsigned long posesEvaluated = 0;
+	unsigned long posesBlended = 0;
+	unsigned long posesLayered = 0;
+	unsigned long charactersCulled = 0;
+	unsigned long charactersShadowOnly = 0;
+	unsigned long meshLods[MAX_MESH_LODS] = { 0 };
+	unsigned long crowdLods[MAX_MESH_LODS] = { 0 };
+
+	for(unsigned int p = 0; p < 2; p++)
+	{
+		m_single_pass = paths[p];
+
+		// Warm up so shader compilation and first touch uploads are not timed
+		for(unsigned int i = 0; i < 10; i++)
+		{
+			updateAnimation();
+			renderDepthMap();
+			m_single_pass ? renderSceneSinglePass() : renderSceneTwoPass();
+			glFinish();
+		}
+
+		sf::Clock timer;
+		for(unsigned int i = 0; i < frames; i++)
+		{
+			updateAnimation();
+			for(unsigned int l = 0; l < PoseCache::NUM_LODS; l++)
+			{
+				lodRequests[l] += m_pose_cache.getNumRequests((PoseCache::AnimationLod)l);
+			}
+			posesEvaluated += m_pose_cache.getNumEvaluated();
+			posesBlended += m_pose_cache.getNumBlended();
+			posesLayered += m_pose_cache.getNumLayered();
+			charactersCulled += m_num_culled;
+			charactersShadowOnly += m_num_shadow_only;
+			for(unsigned int l = 0; l < MAX_MESH_LODS; l++)
+			{
+				meshLods[l] += m_num_mesh_lods[l];
+				for(std::vector<Crowd*>::iterator it = m_crowds.begin(); it != m_crowds.end(); it++)
+				{
+					crowdLods[l] += (*it)->getNumInstances(l);
+				}
+			}
+			renderDepthMap();
+			m_single_pass ? renderSceneSinglePass() : renderSceneTwoPass();
+			glFinish();
+		}
+		frameTimes[p] = timer.getElapsedTime().asSeconds() * 1000.0f / frames;
+	}
+
+	printf("Render path benchmark (%u frames, %ux%u)\n", frames, 
+		   m_window.getSize().x, m_window.getSize().y);
+	printf("  two pass:    %.3f ms/frame\n", frameTimes[0]);
+	printf("  single pass: %.3f ms/frame\n", frameTimes[1]);
+	printf("  speedup:     %.2fx\n", frameTimes[0] / frameTimes[1]);
+
+	float totalFrames = 2.0f * frames;
+	printf("Animation per frame: %.1f full, %.1f reduced and %.1f frozen characters, "
+		   "%.1f poses evaluated, %.1f blended, %.1f layered\n",
+		   lodRequests[PoseCache::LOD_FULL] / totalFrames,
+		   lodRequests[PoseCache::LOD_REDUCED] / totalFrames,
+		   lodRequests[PoseCache::LOD_FROZEN] / totalFrames,
+		   posesEvaluated / totalFrames, posesBlended / totalFrames, posesLayered / totalFrames);
+	printf("Culling per frame: %.1f characters skipped entirely, %.1f posed only for the shadow map\n",
+		   charactersCulled / totalFrames, charactersShadowOnly / totalFrames);
+	printf("Mesh LODs per frame:");
+	for(unsigned int l = 0; l < MAX_MESH_LODS; l++)
+	{
+		printf(" %.1f at LOD %u%s", meshLods[l] / totalFrames, l, l + 1 < MAX_MESH_LODS ? "," : "\n");
+	}
+
+	unsigned int crowdInstances = 0;
+	unsigned int crowdFrames = 0;
+	for(std::vector<Crowd*>::iterator it = m_crowds.begin(); it != m_crowds.end(); it++)
+	{
+		crowdInstances += (*it)->getNumInstances();
+		crowdFrames += (*it)->getNumFrames();
+	}
+	printf("Crowds: %u instances of %u meshes, %u baked frames, no animation work per instance\n",
+		   crowdInstances, (unsigned int)m_crowds.size(), crowdFrames);
+	printf("Crowd LODs per frame:");
+	for(unsigned int l = 0; l < MAX_MESH_LODS; l++)
+	{
+		printf(" %.1f at LOD %u%s", crowdLods[l] / totalFrames, l, l + 1 < MAX_MESH_LODS ? "," : "\n");
+	}
+
+	m_window.close();
+
+	return 0;
+}
+
+bool Game::init()
+{
+	TraceScope scope("init", "Game::init");
+
 	m_particle_system.init();
 	m_particle_system2.init2();
 	m_particle_system_enemy.init();
 	m_particle_system_enemy2.init2();
 	m_skybox.init();
 	skyboxScale = glm::scale(glm::mat4(1.0f), glm::vec3(50.0f, 50.0f, 50.0f));
-	if(!m_battle_theme.openFromFile("battle_theme.ogg"))
-	{
-		std::cerr << "Could not load music" << std::endl;
-	}
-	else
-	{
-		m_battle_theme.setLoop(true);
-	}
-	if(!m_forest_theme.openFromFile("forest_theme.ogg"))
+
 	{
-		std::cerr << "Could not load music" << std::endl;
+		// Music is streamed, so opening it only reads the header
+		TraceScope audioScope("audio", "music and sounds");
+		if(!m_battle_theme.openFromFile("battle_theme.ogg"))
+		{
+			std::cerr << "Could not load music" << std::endl;
+		}
+		else
+		{
+			m_battle_theme.setLoop(true);
+		}
+		if(!m_forest_theme.openFromFile("forest_theme.ogg"))
+		{
+			std::cerr << "Could not load music" << std::endl;
+		}
+		else
+		{
+			m_forest_theme.setLoop(true);
+		}
+		m_sword_attack.loadFromFile("Sword2.ogg");
+		m_defend.loadFromFile("sword-unsheathe2.wav");
+		m_heal.loadFromFile("spell.wav");
+		m_bite.loadFromFile("bite-small.wav");
+		Trace::addFileRead("Sword2.ogg");
+		Trace::addFileRead("sword-unsheathe2.wav");
+		Trace::addFileRead("spell.wav");
+		Trace::addFileRead("bite-small.wav");
 	}
-	else
+
 	{
-		m_forest_theme.setLoop(true);
+		TraceScope guiScope("texture", "buttons2.png");
+		Trace::addFileRead("buttons2.png");
+		m_gui_texture.loadFromFile("buttons2.png");
 	}
-	m_sword_attack.loadFromFile("Sword2.ogg");
-	m_defend.loadFromFile("sword-unsheathe2.wav");
-	m_heal.loadFromFile("spell.wav");
-	m_bite.loadFromFile("bite-small.wav");
-
-	m_gui_texture.loadFromFile("buttons2.png");
 	m_gui_sprite.setTexture(m_gui_texture);
 	cameraPos = glm::vec3(0.0f, 30.0f, 80.0f);
 	
-	loadAllMeshes();
+	// Importers only live while their mesh is imported, so the peak shows
+	// what they cost and the difference to it is what was given back
+	size_t residentBefore = Trace::getResidentBytes();
+	if(!loadAllMeshes("forest.txt", loadingProgress, this))
+	{
+		return false;
+	}
+	TextureCache::PrintStats();
+	printf("Resident memory: %.1f MB before loading the scene, %.1f MB after, %.1f MB at the peak\n",
+		   residentBefore / (1024.0 * 1024.0), Trace::getResidentBytes() / (1024.0 * 1024.0),
+		   Trace::getPeakResidentBytes() / (1024.0 * 1024.0));
 	
 	m_player = player_renderable;
 	m_static_renderables = static_renderables;
 	m_dynamic_renderables = dynamic_renderables;
-
-	for(std::vector<btRigidBody*>::iterator it = static_rigidbodies.begin();
-	    it != static_rigidbodies.end();
-	    it++)
-	{
-		dynamicsWorld->addRigidBody( (*it) );
-	}
+	m_crowds = crowds;
 
 	btTransform startTransform;
 	startTransform.setIdentity();
@@ -377,6 +643,42 @@ void Game::init()
 
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glEnable(GL_BLEND);
+
+	return true;
+}
+
+// Draws a progress bar with scissored clears, since this runs before any of
+// our shaders have been compiled
+void Game::drawLoadingScreen(unsigned int done, unsigned int total)
+{
+	// Keep the window responsive while we load
+	sf::Event event;
+	while(m_window.pollEvent(event))
+	{
+	}
+
+	unsigned int width = m_window.getSize().x;
+	unsigned int height = m_window.getSize().y;
+	unsigned int barWidth = width * 3 / 4;
+	unsigned int barHeight = 20;
+	unsigned int barX = (width - barWidth) / 2;
+	unsigned int barY = (height - barHeight) / 2;
+
+	glViewport(0, 0, width, height);
+	glClearColor(0.0, 0.0, 0.0, 0.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(barX, barY, barWidth, barHeight);
+	glClearColor(0.2, 0.2, 0.2, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glScissor(barX, barY, barWidth * done / total, barHeight);
+	glClearColor(0.6, 0.8, 0.8, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDisable(GL_SCISSOR_TEST);
+	glClearColor(0.0, 0.0, 0.0, 0.0);
+
+	m_window.display();
 }
 
 void Game::gameLoop()
@@ -573,7 +875,7 @@ void Game::gameLoop()
 			if(m_clock.getElapsedTime().asSeconds() > m_enemy_attack_anim_end_time)
 			{
 				if(m_encountered_enemy != NULL)
-					m_encountered_enemy->setAnimation(0);
+					m_encountered_enemy->setAnimation(0, m_animation_fade_time);
 				m_is_enemy_attacking = false;
 			}
 		}
@@ -671,31 +973,31 @@ void Game::gameLoop()
 		}*/
 		if(m_is_encounter_initiated)
 		{
-			m_player->setAnimation(2);
+			m_player->setAnimation(2, m_animation_fade_time);
 		}
 		else if(movement_direction.isZero())
 		{
-			m_player->setAnimation(0);
+			m_player->setAnimation(0, m_animation_fade_time);
 			character->setGravity(btScalar(0));
 		}
 		else
 		{
-			m_player->setAnimation(1);
+			m_player->setAnimation(1, m_animation_fade_time);
 			character->setGravity(m_gravity);
 		}
 
 		if(m_is_player_attacking)
 		{
-			m_player->setAnimation(3);
+			m_player->setAnimation(3, m_animation_fade_time);
 		}
 		if(m_is_enemy_attacking)
 		{
 			if(m_encountered_enemy != NULL)
-				m_encountered_enemy->setAnimation(2);
+				m_encountered_enemy->setAnimation(2, m_animation_fade_time);
 		}
 		if(m_is_enemy_dying)
 		{
-			m_encountered_enemy->setAnimation(3);
+			m_encountered_enemy->setAnimation(3, m_animation_fade_time);
 			if(m_clock.getElapsedTime().asSeconds() > m_enemy_dying_end_time)
 			{
 				m_is_enemy_dying = false;
@@ -705,11 +1007,11 @@ void Game::gameLoop()
 		}
 		if(m_is_player_defeated)
 		{
-			m_player->setAnimation(4);
+			m_player->setAnimation(4, m_animation_fade_time);
 			if(m_clock.getElapsedTime().asSeconds() > m_player_defeated_end_time)
 			{
 				m_is_player_defeated = false;
-				m_encountered_enemy->setAnimation(0);
+				m_encountered_enemy->setAnimation(0, m_animation_fade_time);
 				m_encountered_enemy = NULL;
 				btTransform original_position;
 				original_position.setIdentity();
@@ -771,13 +1073,7 @@ void Game::gameLoop()
 				glUniformMatrix4fv( projectionMatrixUnif, 1, GL_FALSE, glm::value_ptr(projectionMatrix));
 				glUseProgram(0);
 
-				glBindTexture(GL_TEXTURE_2D, frameBufferTexture);
-				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, event.size.width, event.size.height,
-				 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
-				glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
-				glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, 
-									  m_window.getSize().x, m_window.getSize().y);
-				glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+				resizeFramebuffer(event.size.width, event.size.height);
 
                 glViewport(0, 0, event.size.width, event.size.height);
 				//initFramebuffer();
@@ -785,27 +1081,17 @@ void Game::gameLoop()
 
         }
 
+		updateAnimation();
 		renderDepthMap();
         // display our image
-		display();
-	
-		// write and display framebuffer contents
-		glDisable(GL_BLEND);
-		glBindFramebuffer(GL_FRAMEBUFFER, frameBufferObject);
-		display();
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-		glUseProgram(frameBufferProgramID);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, frameBufferTexture);
-
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, frameBufferQuadVBO);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glDisableVertexAttribArray(0);
-		glUseProgram(0);
-		glEnable(GL_BLEND);
+		if(m_single_pass)
+		{
+			renderSceneSinglePass();
+		}
+		else
+		{
+			renderSceneTwoPass();
+		}
 
 		glUseProgram(quadProgramID);
 		glActiveTexture(GL_TEXTURE0);
@@ -910,8 +1196,190 @@ void Game::renderEnemyHealParticles()
 	glUseProgram(0);
 }
 
+// The camera follows the player, looking a little above it
+glm::mat4 Game::getViewMatrix()
+{
+	return glm::lookAt(cameraPos, // world space pos of camera
+					   m_player->getTransform() + glm::vec3(0.0f, 30.0f, 0.0f),// where to look at
+					   glm::vec3(0.0, 1.0f, 0.0f));   // up direction
+}
+
+// Full rate near the camera, blended from key poses further away and frozen
+// outside the view. Frozen characters still cast shadows, in their frozen pose.
+PoseCache::AnimationLod Game::selectAnimationLod(const glm::vec3& center, bool inView)
+{
+	if(!inView)
+	{
+		return PoseCache::LOD_FROZEN;
+	}
+	return glm::length(center - cameraPos) < m_animation_lod_distance ?
+		   PoseCache::LOD_FULL : PoseCache::LOD_REDUCED;
+}
+
+// By the share of the view's height the bounds cover. Characters only in
+// the shadow map get the coarsest LOD.
+unsigned int Game::selectMeshLod(Mesh* mesh, const glm::vec3& center, float radius, bool inView)
+{
+	if(!inView)
+	{
+		return mesh->getNumLods() - 1;
+	}
+	float distance = glm::length(center - cameraPos);
+	float screenSize = distance > radius ? radius * projectionMatrix[1][1] / distance : 1.0f;
+	return mesh->selectLod(screenSize);
+}
+
+// The light renderDepthMap draws the shadow map from
+glm::mat4 Game::getLightViewProjMatrix()
+{
+	glm::vec3 lightPosition(0.0f, 2000.0f, 5.0f);
+	glm::mat4 dProjMatrix = glm::ortho<float>(-2000, 2000, -2000, 2000, -1, 2100);
+	glm::mat4 dViewMatrix = glm::lookAt(lightPosition, glm::vec3(0.0f, 0.0f, 0.0f), 
+										glm::vec3(0, 1, 0));
+	return dProjMatrix * dViewMatrix;
+}
+
+// The animation stage of a frame, run before anything is drawn. Every
+// visible character requests its pose, then the distinct poses are evaluated
+// across m_animation_pool, uploaded and skinned. The render passes only
+// read the skinned vertices.
+void Game::updateAnimation()
+{
+	float time = m_clock.getElapsedTime().asSeconds();
+	glm::mat4 viewProjMatrix = projectionMatrix * getViewMatrix();
+	glm::mat4 lightViewProjMatrix = getLightViewProjMatrix();
+	// The light is directional, so a shadow falls straight along this
+	glm::vec3 lightDirection = glm::normalize(glm::vec3(0.0f, -2000.0f, -5.0f));
+	m_animation_time = time;
+
+	// A character out of view still needs a pose for the shadow map if its
+	// shadow can land in view, so its bounds are also swept along the light
+	m_num_culled = 0;
+	m_num_shadow_only = 0;
+	for(unsigned int i = 0; i < MAX_MESH_LODS; i++)
+	{
+		m_num_mesh_lods[i] = 0;
+	}
+	m_pose_cache.beginFrame();
+	for(std::vector<DynamicRenderable*>::iterator it = m_dynamic_renderables.begin();
+		it != m_dynamic_renderables.end();
+		it++)
+	{
+		if(!(*it)->m_isVisible)
+		{
+			continue;
+		}
+
+		glm::vec3 center;
+		float radius;
+		(*it)->getAnimationBounds(center, radius);
+		bool inView = isSphereInFrustum(viewProjMatrix, center, radius);
+		bool castsShadow = inView ||
+			(isSphereInFrustum(lightViewProjMatrix, center, radius) &&
+			 isSweptSphereInFrustum(viewProjMatrix, center, center + lightDirection * m_shadow_cull_length, radius));
+		(*it)->setCulling(inView, castsShadow);
+
+		if(!castsShadow)
+		{
+			m_num_culled++;
+			continue;
+		}
+		if(!inView)
+		{
+			m_num_shadow_only++;
+		}
+		unsigned int meshLod = selectMeshLod((*it)->getMesh(), center, radius, inView);
+		m_num_mesh_lods[meshLod]++;
+		(*it)->UpdateTransforms(time, m_pose_cache, selectAnimationLod(center, inView), meshLod);
+	}
+	m_player->UpdateTransforms(time, m_pose_cache);
+	m_num_mesh_lods[0]++;
+
+	// Crowd instances pick their LODs the same way, the shadow map draws
+	// them at the LOD the view does
+	for(std::vector<Crowd*>::iterator it = m_crowds.begin(); it != m_crowds.end(); it++)
+	{
+		(*it)->update(cameraPos, projectionMatrix[1][1]);
+	}
+
+	m_pose_cache.evaluate(&m_animation_pool);
+	m_pose_cache.upload(bonePaletteBuffer, maxBones, bonePaletteAlignment);
+	m_pose_cache.skin(skinnedVertexBuffer, bonePaletteBuffer, skinningProgramID, skinningDualQuatProgramID);
+}
+
+// The original path: the scene is drawn to the screen, then drawn again into
+// frameBufferObject so the outline pass has a texture to run the Sobel
+// filter over.
+void Game::renderSceneTwoPass()
+{
+	display();
+
+	// write and display framebuffer contents
+	glDisable(GL_BLEND);
+	glBindFramebuffer(GL_FRAMEBUFFER, frameBufferObject);
+	display();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	renderOutline();
+	glEnable(GL_BLEND);
+}
+
+// The scene is drawn once into frameBufferObject. Its color and depth are
+// then composited to the screen and the outline pass reads from the same
+// color texture, so every draw call and bone upload only happens once.
+void Game::renderSceneSinglePass()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, frameBufferObject);
+	display();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glDisable(GL_BLEND);
+	glDepthFunc(GL_ALWAYS);
+	glUseProgram(compositeProgramID);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, frameBufferTexture);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, frameBufferDepthTexture);
+
+	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, frameBufferQuadVBO);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+	glDisableVertexAttribArray(0);
+	glDepthFunc(GL_LEQUAL);
+
+	renderOutline();
+	glEnable(GL_BLEND);
+}
+
+void Game::renderOutline()
+{
+	glUseProgram(frameBufferProgramID);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, frameBufferTexture);
+
+	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, frameBufferQuadVBO);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+	glDisableVertexAttribArray(0);
+	glUseProgram(0);
+}
+
+void Game::resizeFramebuffer(unsigned int width, unsigned int height)
+{
+	glBindTexture(GL_TEXTURE_2D, frameBufferTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+	glBindTexture(GL_TEXTURE_2D, frameBufferDepthTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT,
+				 GL_FLOAT, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 void Game::initFramebuffer()
 {
+	TraceScope scope("upload", "framebuffers");
+
 	// Setting up frame buffer
 	glGenFramebuffers(1, &frameBufferObject);
 	glBindFramebuffer(GL_FRAMEBUFFER, frameBufferObject);
@@ -926,12 +1394,17 @@ void Game::initFramebuffer()
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, m_window.getSize().x, m_window.getSize().y,
 				 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
 
-	// Setting up the depth buffer
-	glGenRenderbuffers(1, &depthBuffer);
-	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, 
-						  m_window.getSize().x, m_window.getSize().y);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	// Setting up the depth buffer. This is a texture rather than a renderbuffer
+	// so the single pass path can composite the scene depth to the screen
+	glGenTextures(1, &frameBufferDepthTexture);
+	glBindTexture(GL_TEXTURE_2D, frameBufferDepthTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, m_window.getSize().x, m_window.getSize().y,
+				 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, frameBufferDepthTexture, 0);
 	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, frameBufferTexture, 0);
 
 	// Setting up the draw buffer
@@ -1124,54 +1597,40 @@ void Game::renderDepthMap()
 		(*it)->render();
 	}
 
-	//glUniform1i(isDynamicUnif, 1);
-
-	//dProjMatrix = glm::ortho<float>(-2000, 2000, -2000, 2000, -1, 2300);
-	// Render all our dynamic meshes
-	//for(std::vector<DynamicRenderable*>::iterator it = m_dynamic_renderables.begin();
-	//	it != m_dynamic_renderables.end();
-	//	it++)
-	//{
-		//glm::mat4 modelMatrix = (*it)->getTranslation() * (*it)->getRotation() * (*it)->getScale();
-		//glm::mat4 MVP = dProjMatrix * dViewMatrix * modelMatrix;
-		//glm::mat4 modelViewMatrix = viewMatrix * modelMatrix;
-		//glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(modelViewMatrix));
-		//glm::mat4 MVP = projectionMatrix * modelViewMatrix;
-
-		//glUniformMatrix4fv( modelViewMatrixUnif, 1, GL_FALSE, glm::value_ptr(modelViewMatrix));
-		//glUniformMatrix3fv( normalMatrixUnif, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-		//glUniformMatrix4fv( MVPUnif, 1, GL_FALSE, glm::value_ptr(MVP));
-		//glUniformMatrix4fv(shadowsMVPUnif, 1, GL_FALSE, glm::value_ptr(MVP));
-		
-		/*(*it)->UpdateTransforms(m_clock.getElapsedTime().asSeconds());
-		for(unsigned int i = 0; i < (*it)->getTransforms().size(); i++)
+	// Characters are drawn from the vertices updateAnimation skinned, so
+	// casting shadows costs them no more than it costs a static mesh
+	for(std::vector<DynamicRenderable*>::iterator it = m_dynamic_renderables.begin();
+		it != m_dynamic_renderables.end();
+		it++)
+	{
+		if((*it)->m_isVisible == false || !(*it)->castsShadow())
 		{
-			glUniformMatrix4fv(boneMatricesUnif[i], 1, GL_TRUE,
-							   (const GLfloat*)(*it)->getTransforms()[i].m);
-		}*/
+			continue;
+		}
+		glm::mat4 modelMatrix = (*it)->getTranslation() * (*it)->getRotation() * (*it)->getScale();
+		glm::mat4 MVP = dProjMatrix * dViewMatrix * modelMatrix;
+		glUniformMatrix4fv(shadowsMVPUnif, 1, GL_FALSE, glm::value_ptr(MVP));
 
-		//(*it)->render();
-	//}
+		(*it)->renderSkinned(skinnedVertexBuffer);
+	}
 
-	//glm::mat4 modelMatrix = m_player->getTranslation() * m_player->getRotation() * m_player->getScale();
-	//glm::mat4 MVP = dProjMatrix * dViewMatrix * modelMatrix;
-	//glm::mat4 modelViewMatrix = viewMatrix * modelMatrix;
-	//glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(modelViewMatrix));
-	//glm::mat4 MVP = projectionMatrix * modelViewMatrix;
+	glm::mat4 modelMatrix = m_player->getTranslation() * m_player->getRotation() * m_player->getScale();
+	glm::mat4 MVP = dProjMatrix * dViewMatrix * modelMatrix;
+	glUniformMatrix4fv(shadowsMVPUnif, 1, GL_FALSE, glm::value_ptr(MVP));
 
-	//glUniformMatrix4fv( modelViewMatrixUnif, 1, GL_FALSE, glm::value_ptr(modelViewMatrix));
-	//glUniformMatrix3fv( normalMatrixUnif, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-	//glUniformMatrix4fv( MVPUnif, 1, GL_FALSE, glm::value_ptr(MVP));
-	//glUniformMatrix4fv(shadowsMVPUnif, 1, GL_FALSE, glm::value_ptr(MVP));
-		
-	/*m_player->UpdateTransforms(m_clock.getElapsedTime().asSeconds());
-	for(unsigned int i = 0; i < m_player->getTransforms().size(); i++)
-	{
-		glUniformMatrix4fv(boneMatricesUnif[i], 1, GL_TRUE,
-						   (const GLfloat*)m_player->getTransforms()[i].m);
-	}*/
+	m_player->renderSkinned(skinnedVertexBuffer);
 
-	//m_player->render();
+	if(!m_crowds.empty())
+	{
+		glm::mat4 lightVP = dProjMatrix * dViewMatrix;
+		glUseProgram(crowdShadowProgramID);
+		glUniformMatrix4fv(crowdShadowLightVPUnif, 1, GL_FALSE, glm::value_ptr(lightVP));
+		glUniform1f(crowdShadowTimeUnif, m_animation_time);
+		for(std::vector<Crowd*>::iterator it = m_crowds.begin(); it != m_crowds.end(); it++)
+		{
+			(*it)->render(crowdShadowLodFirstBoneUnif);
+		}
+	}
 
 	/*glm::mat4 skyboxMVP = projectionMatrix * 
 						  viewMatrix * 
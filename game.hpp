@@ -10,42 +10,73 @@
 #include <string>
 #include <fstream>
 #include "renderable.hpp"
+#include "crowd.hpp"
 #include "skybox.hpp"
 #include "particlesystem.hpp"
 #include "btBulletDynamicsCommon.h"
 #include "BulletCollision/CollisionDispatch/btGhostObject.h"
 #include "BulletDynamics/Character/btKinematicCharacterController.h"
 
-#define MAX_BONES 64
-
 class Game
 {
 public:
 	Game();
 	~Game();
 	int startGame();
+	int benchmarkRenderPaths(unsigned int frames);
 	void initializeProgram();
 	void initializeVertexBuffer();
 	void display();
-	void init();
+	// False if the scene could not be loaded
+	bool init();
 	void initFramebuffer();
+	void drawLoadingScreen(unsigned int done, unsigned int total);
 	void renderPlayerAttackParticles(/*glm::vec3 position, int index*/);
 	void renderPlayerHealParticles(/*glm::vec3 position, int index*/);
 	void renderEnemyAttackParticles(/*glm::vec3 position, int index*/);
 	void renderEnemyHealParticles(/*glm::vec3 position, int index*/);
+	void initBonePalette();
+	void updateAnimation();
 	void renderDepthMap();
+	void renderSceneTwoPass();
+	void renderSceneSinglePass();
+	void renderOutline();
+	void resizeFramebuffer(unsigned int width, unsigned int height);
 	GLuint createShader(GLenum eShaderType, const std::string &strShaderFile);
 	GLuint createProgram(const std::vector<GLuint> &shaderList);
 	std::string parseShader(const char* filename);
 
 private:
+	bool createWindow(bool visible);
+	glm::mat4 getViewMatrix();
+	PoseCache::AnimationLod selectAnimationLod(const glm::vec3& center, bool inView);
+	unsigned int selectMeshLod(Mesh* mesh, const glm::vec3& center, float radius, bool inView);
+	glm::mat4 getLightViewProjMatrix();
 	void gameLoop();
 	sf::Clock m_clock;
+	PoseCache m_pose_cache;
+	WorkerPool m_animation_pool;
+	// Characters further than this from the camera get LOD_REDUCED
+	float m_animation_lod_distance;
+	// How far along the light a character's shadow is assumed to reach when
+	// deciding whether it can fall into view
+	float m_shadow_cull_length;
+	// Characters updateAnimation skipped this frame, and those it only
+	// posed for the shadow map
+	unsigned int m_num_culled;
+	unsigned int m_num_shadow_only;
+	// Characters drawn with each mesh LOD this frame
+	unsigned int m_num_mesh_lods[MAX_MESH_LODS];
+	// Seconds characters take to crossfade from one animation to the next
+	float m_animation_fade_time;
+	// The time updateAnimation posed the frame at, crowds are drawn at it
+	float m_animation_time;
 	sf::Clock m_battle_clock;
 	sf::RenderWindow m_window;
 	//std::vector<Renderable*> m_renderables;
 	std::vector<StaticRenderable*> m_static_renderables;
 	std::vector<DynamicRenderable*> m_dynamic_renderables;
+	std::vector<Crowd*> m_crowds;
 	DynamicRenderable* m_player;
 	Skybox m_skybox;
 	float m_gravity;
@@ -112,10 +143,18 @@ private:
 	GLuint frameBufferTexture;
 	GLuint frameBufferQuadVAO;
 	GLuint frameBufferQuadVBO;
-	GLuint depthBuffer;
+	GLuint frameBufferDepthTexture;
 	GLuint fbTextureUnif;
 	GLuint fbTimeUnif;
 
+	// When set, the scene is drawn once into frameBufferObject and then
+	// composited to the screen, instead of being drawn a second time just
+	// to give the outline pass something to read from
+	bool m_single_pass;
+	GLuint compositeProgramID;
+	GLuint compositeColorUnif;
+	GLuint compositeDepthUnif;
+
 	GLuint shadowFrameBuffer;
 	GLuint fbDepthTexture;
 
@@ -138,11 +177,29 @@ private:
 	GLuint normalMatrixUnif;
 	GLuint projectionMatrixUnif;
 	GLuint MVPUnif;
-	GLuint boneMatricesUnif[MAX_BONES];
-	GLuint isDynamicUnif;
+	// Every pose of the frame in one uniform buffer, skinned once into
+	// skinnedVertexBuffer which every pass then draws characters from.
+	// maxBones is the palette size skinning.vert is compiled with.
+	GLuint skinningProgramID;
+	GLuint skinningDualQuatProgramID;
+	GLuint bonePaletteBuffer;
+	GLuint skinnedVertexBuffer;
+	unsigned int maxBones;
+	unsigned int bonePaletteAlignment;
 	GLuint depthBiasMVPUnif;
 	GLuint shadowMapUnif;
 
+	// crowd.vert with toon.frag, and its SHADOW_PASS build with shadows.frag
+	GLuint crowdProgramID;
+	GLuint crowdViewMatrixUnif;
+	GLuint crowdDepthBiasVPUnif;
+	GLuint crowdTimeUnif;
+	GLuint crowdLodFirstBoneUnif;
+	GLuint crowdShadowProgramID;
+	GLuint crowdShadowLightVPUnif;
+	GLuint crowdShadowTimeUnif;
+	GLuint crowdShadowLodFirstBoneUnif;
+
 	GLuint skyboxProgramID;
 	GLuint skyboxMVPUnif;
 	GLuint skyboxSamplerUnif;
@@ -0,0 +1,48 @@
+#ifndef KTX_HPP
+#define KTX_HPP
+
+#include <string.h>
+#include <string>
+
+// Header of a KTX 1.1 file, as written by texcook and read by Texture. Only
+// the subset we produce is supported: one 2D face, no arrays, no key/value
+// data, block compressed levels in native byte order. Each level follows as
+// a 32 bit image size and then the blocks.
+struct KtxHeader
+{
+	unsigned char Identifier[12];
+	unsigned int Endianness;
+	unsigned int GlType;
+	unsigned int GlTypeSize;
+	unsigned int GlFormat;
+	unsigned int GlInternalFormat;
+	unsigned int GlBaseInternalFormat;
+	unsigned int PixelWidth;
+	unsigned int PixelHeight;
+	unsigned int PixelDepth;
+	unsigned int NumberOfArrayElements;
+	unsigned int NumberOfFaces;
+	unsigned int NumberOfMipmapLevels;
+	unsigned int BytesOfKeyValueData;
+};
+
+#define KTX_ENDIANNESS 0x04030201
+
+static const unsigned char KtxIdentifier[12] =
+{
+	0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+
+// Cooked textures sit next to their source with the extension swapped
+inline std::string getCookedTextureFilename(const std::string& Filename)
+{
+	std::string::size_type DotIndex = Filename.find_last_of(".");
+	if(DotIndex == std::string::npos)
+	{
+		return Filename + ".ktx";
+	}
+
+	return Filename.substr(0, DotIndex) + ".ktx";
+}
+
+#endif
@@ -1,8 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <SFML/System.hpp>
 #include "game.hpp"
+#include "math_3d.h"
+#include "scene.hpp"
+
+namespace
+{
+	float randomFloat()
+	{
+		return rand() / (float)RAND_MAX * 2.0f - 1.0f;
+	}
+
+	Quaternion randomQuaternion()
+	{
+		Quaternion q(randomFloat(), randomFloat(), randomFloat(), randomFloat());
+		q.Normalize();
+		return q;
+	}
+
+	void printKernel(const char* Name, float ScalarTime, float SimdTime, unsigned int Count, bool IsEqual)
+	{
+		printf("%-18s %12.2f %12.2f %9.2fx %10s\n", Name, ScalarTime * 1e9f / Count,
+			   SimdTime * 1e9f / Count, SimdTime > 0.0f ? ScalarTime / SimdTime : 0.0f,
+			   IsEqual ? "yes" : "NO");
+	}
+}
+
+// Times the scalar and SSE kernels of math_3d against each other and checks
+// that they agree bit for bit
+static int benchmarkMathKernels(unsigned int Iterations)
+{
+#ifndef MATH_3D_SSE
+	printf("Built without SSE, only the scalar kernels are available\n");
+	return 0;
+#else
+	// A batch about the size of a few skeletons, so it stays in cache and we
+	// time the arithmetic rather than memory
+	const unsigned int BatchSize = 256;
+	std::vector<Matrix4f> Left(BatchSize), Right(BatchSize), ScalarOut(BatchSize), SimdOut(BatchSize);
+	std::vector<Quaternion> From, To, ScalarQuats, SimdQuats;
+	std::vector<Vector3f> Translations, Scalings;
+	std::vector<float> Factors;
+
+	srand(1);
+	for(unsigned int i = 0; i < BatchSize; i++)
+	{
+		for(unsigned int j = 0; j < 16; j++)
+		{
+			(&Left[i].m[0][0])[j] = randomFloat();
+			(&Right[i].m[0][0])[j] = randomFloat();
+		}
+		From.push_back(randomQuaternion());
+		To.push_back(randomQuaternion());
+		Translations.push_back(Vector3f(randomFloat(), randomFloat(), randomFloat()));
+		Scalings.push_back(Vector3f(randomFloat(), randomFloat(), randomFloat()));
+		Factors.push_back(randomFloat() * 0.5f + 0.5f);
+	}
+	ScalarQuats = From;
+	SimdQuats = From;
+
+	unsigned int Count = Iterations * BatchSize;
+	printf("Math kernels (%u calls each, ns per call)\n", Count);
+	printf("%-18s %12s %12s %10s %10s\n", "kernel", "scalar", "sse", "speedup", "identical");
+
+	// Matrix products, one at a time and batched
+	sf::Clock Timer;
+	for(unsigned int n = 0; n < Iterations; n++)
+	{
+		for(unsigned int i = 0; i < BatchSize; i++)
+		{
+			MultiplyMatrixScalar(Left[i], Right[i], ScalarOut[i]);
+		}
+	}
+	float ScalarTime = Timer.getElapsedTime().asSeconds();
+	Timer.restart();
+	for(unsigned int n = 0; n < Iterations; n++)
+	{
+		for(unsigned int i = 0; i < BatchSize; i++)
+		{
+			MultiplyMatrixSSE(Left[i], Right[i], SimdOut[i]);
+		}
+	}
+	float SimdTime = Timer.getElapsedTime().asSeconds();
+	printKernel("multiply", ScalarTime, SimdTime, Count,
+				memcmp(&ScalarOut[0], &SimdOut[0], BatchSize * sizeof(Matrix4f)) == 0);
+
+	Timer.restart();
+	for(unsigned int n = 0; n < Iterations; n++)
+	{
+		MultiplyMatricesScalar(&Left[0], &Right[0], &ScalarOut[0], BatchSize);
+	}
+	ScalarTime = Timer.getElapsedTime().asSeconds();
+	Timer.restart();
+	for(unsigned int n = 0; n < Iterations; n++)
+	{
+		MultiplyMatricesSSE(&Left[0], &Right[0], &SimdOut[0], BatchSize);
+	}
+	SimdTime = Timer.getElapsedTime().asSeconds();
+	printKernel("multiply batch", ScalarTime, SimdTime, Count,
+				memcmp(&ScalarOut[0], &SimdOut[0], BatchSize * sizeof(Matrix4f)) == 0);
+
+	Timer.restart();
+	for(unsigned int n = 0; n < Iterations; n++)
+	{
+		for(unsigned int i = 0; i < BatchSize; i++)
+		{
+			ComposeTransformScalar(Translations[i], From[i], Scalings[i], ScalarOut[i]);
+		}
+	}
+	ScalarTime = Timer.getElapsedTime().asSeconds();
+	Timer.restart();
+	for(unsigned int n = 0; n < Iterations; n++)
+	{
+		for(unsigned int i = 0; i < BatchSize; i++)
+		{
+			ComposeTransformSSE(Translations[i], From[i], Scalings[i], SimdOut[i]);
+		}
+	}
+	SimdTime = Timer.getElapsedTime().asSeconds();
+	printKernel("compose TRS", ScalarTime, SimdTime, Count,
+				memcmp(&ScalarOut[0], &SimdOut[0], BatchSize * sizeof(Matrix4f)) == 0);
+
+	Timer.restart();
+	for(unsigned int n = 0; n < Iterations; n++)
+	{
+		for(unsigned int i = 0; i < BatchSize; i++)
+		{
+			ScalarQuats[i] = NlerpScalar(From[i], To[i], Factors[i]);
+		}
+	}
+	ScalarTime = Timer.getElapsedTime().asSeconds();
+	Timer.restart();
+	for(unsigned int n = 0; n < Iterations; n++)
+	{
+		for(unsigned int i = 0; i < BatchSize; i++)
+		{
+			SimdQuats[i] = NlerpSSE(From[i], To[i], Factors[i]);
+		}
+	}
+	SimdTime = Timer.getElapsedTime().asSeconds();
+	printKernel("nlerp", ScalarTime, SimdTime, Count,
+				memcmp(&ScalarQuats[0], &SimdQuats[0], BatchSize * sizeof(Quaternion)) == 0);
+
+	return 0;
+#endif
+}
 
 int main(int argc, char** argv)
 {
 	Game game;
+
+	// --bench-render [frames] times the two pass and single pass render paths
+	// in a hidden window instead of starting the game
+	if(argc > 1 && strcmp(argv[1], "--bench-render") == 0)
+	{
+		int frames = argc > 2 ? atoi(argv[2]) : 300;
+		if(frames < 1)
+		{
+			printf("--bench-render needs at least one frame\n");
+			return 1;
+		}
+		return game.benchmarkRenderPaths(frames);
+	}
+
+	// --bench-bvh [scene] compares building the collision BVHs of the
+	// scene's static meshes with loading them from the cache
+	if(argc > 1 && strcmp(argv[1], "--bench-bvh") == 0)
+	{
+		Scene scene;
+		if(!scene.load(argc > 2 ? argv[2] : "forest.txt"))
+		{
+			return 1;
+		}
+
+		std::vector<std::string> filenames;
+		for(unsigned int i = 0; i < scene.m_Meshes.size(); i++)
+		{
+			if(scene.m_Meshes[i].Type == Scene::STATIC_MESH)
+			{
+				filenames.push_back(scene.m_Meshes[i].Filename);
+			}
+		}
+		return TerrainMesh::benchmarkBvhCache(filenames);
+	}
+
+	// --bench-anim [mesh] [poses] times posing a skeleton with the compiled
+	// runtime against the original recursive evaluator
+	if(argc > 1 && strcmp(argv[1], "--bench-anim") == 0)
+	{
+		unsigned int poses = argc > 3 ? atoi(argv[3]) : 10000;
+		return Mesh::benchmarkPose(argc > 2 ? argv[2] : "frog_walk.dae", poses);
+	}
+
+	// --bench-math [iterations] times the scalar and SSE matrix and
+	// quaternion kernels the pose evaluation uses
+	if(argc > 1 && strcmp(argv[1], "--bench-math") == 0)
+	{
+		unsigned int iterations = argc > 2 ? atoi(argv[2]) : 100000;
+		return benchmarkMathKernels(iterations);
+	}
+
 	game.startGame();
 
 	return 0;
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "mapped_file.hpp"
+
+MappedFile::MappedFile()
+	: m_data(NULL),
+	  m_size(0),
+	  m_is_mapped(false)
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const std::string& Filename)
+{
+	close();
+
+#ifndef WIN32
+	int fd = ::open(Filename.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		return false;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference to the file
+	::close(fd);
+
+	if(data == MAP_FAILED)
+	{
+		return false;
+	}
+
+	m_data = (const char*)data;
+	m_size = st.st_size;
+	m_is_mapped = true;
+#else
+	FILE* file = fopen(Filename.c_str(), "rb");
+	if(!file)
+	{
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if(size <= 0)
+	{
+		fclose(file);
+		return false;
+	}
+
+	m_buffer.resize(size);
+	size_t read = fread(&m_buffer[0], 1, size, file);
+	fclose(file);
+	if(read != (size_t)size)
+	{
+		m_buffer.clear();
+		return false;
+	}
+
+	m_data = &m_buffer[0];
+	m_size = size;
+#endif
+
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifndef WIN32
+	if(m_is_mapped)
+	{
+		munmap((void*)m_data, m_size);
+	}
+#endif
+	std::vector<char>().swap(m_buffer);
+	m_data = NULL;
+	m_size = 0;
+	m_is_mapped = false;
+}
+
+bool isFileNewer(const std::string& Filename, const std::string& Than)
+{
+	struct stat a, b;
+	if(stat(Filename.c_str(), &a) != 0 || stat(Than.c_str(), &b) != 0)
+	{
+		return false;
+	}
+	return a.st_mtime > b.st_mtime;
+}
@@ -0,0 +1,34 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <string>
+#include <vector>
+
+// Read only view of a whole file. On POSIX systems the file is mapped with
+// mmap so nothing is copied until the pages are touched, elsewhere it falls
+// back to reading the file into memory.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	bool open(const std::string& Filename);
+	void close();
+	const char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const char* m_data;
+	size_t m_size;
+	bool m_is_mapped;
+	std::vector<char> m_buffer;
+};
+
+// True if Filename was modified after Than, false if either is missing.
+// Used to tell whether a cooked file is stale.
+bool isFileNewer(const std::string& Filename, const std::string& Than);
+
+#endif
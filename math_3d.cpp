@@ -230,3 +230,182 @@ Quaternion operator*(const Quaternion& q, const Vector3f& v)
 
     return ret;
 }
+
+void DualQuaternion::InitFromMatrix(const Matrix4f& m)
+{
+    // Rotation, picking the largest diagonal term to divide by for precision
+    float x, y, z, w;
+    const float Trace = m.m[0][0] + m.m[1][1] + m.m[2][2];
+    if (Trace > 0.0f) {
+        const float s = 0.5f / sqrtf(Trace + 1.0f);
+        w = 0.25f / s;
+        x = (m.m[2][1] - m.m[1][2]) * s;
+        y = (m.m[0][2] - m.m[2][0]) * s;
+        z = (m.m[1][0] - m.m[0][1]) * s;
+    }
+    else if (m.m[0][0] > m.m[1][1] && m.m[0][0] > m.m[2][2]) {
+        const float s = 2.0f * sqrtf(1.0f + m.m[0][0] - m.m[1][1] - m.m[2][2]);
+        w = (m.m[2][1] - m.m[1][2]) / s;
+        x = 0.25f * s;
+        y = (m.m[0][1] + m.m[1][0]) / s;
+        z = (m.m[0][2] + m.m[2][0]) / s;
+    }
+    else if (m.m[1][1] > m.m[2][2]) {
+        const float s = 2.0f * sqrtf(1.0f + m.m[1][1] - m.m[0][0] - m.m[2][2]);
+        w = (m.m[0][2] - m.m[2][0]) / s;
+        x = (m.m[0][1] + m.m[1][0]) / s;
+        y = 0.25f * s;
+        z = (m.m[1][2] + m.m[2][1]) / s;
+    }
+    else {
+        const float s = 2.0f * sqrtf(1.0f + m.m[2][2] - m.m[0][0] - m.m[1][1]);
+        w = (m.m[1][0] - m.m[0][1]) / s;
+        x = (m.m[0][2] + m.m[2][0]) / s;
+        y = (m.m[1][2] + m.m[2][1]) / s;
+        z = 0.25f * s;
+    }
+
+    const float Length = sqrtf(x * x + y * y + z * z + w * w);
+    Real[0] = x / Length;
+    Real[1] = y / Length;
+    Real[2] = z / Length;
+    Real[3] = w / Length;
+
+    // Dual part is half the translation times the rotation
+    const float tx = m.m[0][3];
+    const float ty = m.m[1][3];
+    const float tz = m.m[2][3];
+    Dual[0] =  0.5f * ( tx * Real[3] + ty * Real[2] - tz * Real[1]);
+    Dual[1] =  0.5f * (-tx * Real[2] + ty * Real[3] + tz * Real[0]);
+    Dual[2] =  0.5f * ( tx * Real[1] - ty * Real[0] + tz * Real[3]);
+    Dual[3] = -0.5f * ( tx * Real[0] + ty * Real[1] + tz * Real[2]);
+}
+
+void MultiplyMatricesScalar(const Matrix4f* pLeft, const Matrix4f* pRight, Matrix4f* pOut, unsigned int Count)
+{
+    for (unsigned int i = 0 ; i < Count ; i++) {
+        MultiplyMatrixScalar(pLeft[i], pRight[i], pOut[i]);
+    }
+}
+
+void ComposeTransformScalar(const Vector3f& Translation, const Quaternion& Rotation,
+                            const Vector3f& Scaling, Matrix4f& Out)
+{
+    const float x = Rotation.x, y = Rotation.y, z = Rotation.z, w = Rotation.w;
+
+    Out.m[0][0] = (1.0f - 2.0f * (y * y + z * z)) * Scaling.x;
+    Out.m[0][1] = (2.0f * (x * y - z * w)) * Scaling.y;
+    Out.m[0][2] = (2.0f * (x * z + y * w)) * Scaling.z;
+    Out.m[0][3] = Translation.x;
+
+    Out.m[1][0] = (2.0f * (x * y + z * w)) * Scaling.x;
+    Out.m[1][1] = (1.0f - 2.0f * (x * x + z * z)) * Scaling.y;
+    Out.m[1][2] = (2.0f * (y * z - x * w)) * Scaling.z;
+    Out.m[1][3] = Translation.y;
+
+    Out.m[2][0] = (2.0f * (x * z - y * w)) * Scaling.x;
+    Out.m[2][1] = (2.0f * (y * z + x * w)) * Scaling.y;
+    Out.m[2][2] = (1.0f - 2.0f * (x * x + y * y)) * Scaling.z;
+    Out.m[2][3] = Translation.z;
+
+    Out.m[3][0] = 0.0f; Out.m[3][1] = 0.0f; Out.m[3][2] = 0.0f; Out.m[3][3] = 1.0f;
+}
+
+Quaternion NlerpScalar(const Quaternion& a, const Quaternion& b, float Factor)
+{
+    // Sums are paired the way the SSE version adds its lanes
+    const float Dot = (a.x * b.x + a.z * b.z) + (a.y * b.y + a.w * b.w);
+    const float Sign = Dot < 0.0f ? -1.0f : 1.0f;
+
+    const float x = a.x + Factor * (b.x * Sign - a.x);
+    const float y = a.y + Factor * (b.y * Sign - a.y);
+    const float z = a.z + Factor * (b.z * Sign - a.z);
+    const float w = a.w + Factor * (b.w * Sign - a.w);
+
+    const float Length = sqrtf((x * x + z * z) + (y * y + w * w));
+    return Quaternion(x / Length, y / Length, z / Length, w / Length);
+}
+
+#ifdef MATH_3D_SSE
+void MultiplyMatricesSSE(const Matrix4f* pLeft, const Matrix4f* pRight, Matrix4f* pOut, unsigned int Count)
+{
+    for (unsigned int i = 0 ; i < Count ; i++) {
+        MultiplyMatrixSSE(pLeft[i], pRight[i], pOut[i]);
+    }
+}
+
+void ComposeTransformSSE(const Vector3f& Translation, const Quaternion& Rotation,
+                         const Vector3f& Scaling, Matrix4f& Out)
+{
+    const float x = Rotation.x, y = Rotation.y, z = Rotation.z, w = Rotation.w;
+
+    // The rotation terms, then all three rows scaled in one multiply each.
+    // The translation lane is multiplied by 1, which is exact.
+    const __m128 Scale = _mm_set_ps(1.0f, Scaling.z, Scaling.y, Scaling.x);
+    const __m128 Row0 = _mm_set_ps(Translation.x, 2.0f * (x * z + y * w), 2.0f * (x * y - z * w),
+                                   1.0f - 2.0f * (y * y + z * z));
+    const __m128 Row1 = _mm_set_ps(Translation.y, 2.0f * (y * z - x * w), 1.0f - 2.0f * (x * x + z * z),
+                                   2.0f * (x * y + z * w));
+    const __m128 Row2 = _mm_set_ps(Translation.z, 1.0f - 2.0f * (x * x + y * y), 2.0f * (y * z + x * w),
+                                   2.0f * (x * z - y * w));
+
+    _mm_storeu_ps(Out.m[0], _mm_mul_ps(Row0, Scale));
+    _mm_storeu_ps(Out.m[1], _mm_mul_ps(Row1, Scale));
+    _mm_storeu_ps(Out.m[2], _mm_mul_ps(Row2, Scale));
+    _mm_storeu_ps(Out.m[3], _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+}
+
+// (v0 + v2) + (v1 + v3) in every lane
+static inline __m128 horizontalSum(__m128 v)
+{
+    const __m128 Pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    const __m128 Sum = _mm_add_ss(Pairs, _mm_shuffle_ps(Pairs, Pairs, 1));
+    return _mm_shuffle_ps(Sum, Sum, 0);
+}
+
+Quaternion NlerpSSE(const Quaternion& a, const Quaternion& b, float Factor)
+{
+    const __m128 va = _mm_loadu_ps(&a.x);
+    __m128 vb = _mm_loadu_ps(&b.x);
+
+    const __m128 Dot = horizontalSum(_mm_mul_ps(va, vb));
+    if (_mm_cvtss_f32(Dot) < 0.0f) {
+        vb = _mm_mul_ps(vb, _mm_set1_ps(-1.0f));
+    }
+
+    const __m128 Lerp = _mm_add_ps(va, _mm_mul_ps(_mm_set1_ps(Factor), _mm_sub_ps(vb, va)));
+    const __m128 Length = _mm_sqrt_ps(horizontalSum(_mm_mul_ps(Lerp, Lerp)));
+
+    Quaternion Ret(0.0f, 0.0f, 0.0f, 0.0f);
+    _mm_storeu_ps(&Ret.x, _mm_div_ps(Lerp, Length));
+    return Ret;
+}
+#endif
+
+void MultiplyMatrices(const Matrix4f* pLeft, const Matrix4f* pRight, Matrix4f* pOut, unsigned int Count)
+{
+#ifdef MATH_3D_SSE
+    MultiplyMatricesSSE(pLeft, pRight, pOut, Count);
+#else
+    MultiplyMatricesScalar(pLeft, pRight, pOut, Count);
+#endif
+}
+
+void ComposeTransform(const Vector3f& Translation, const Quaternion& Rotation,
+                      const Vector3f& Scaling, Matrix4f& Out)
+{
+#ifdef MATH_3D_SSE
+    ComposeTransformSSE(Translation, Rotation, Scaling, Out);
+#else
+    ComposeTransformScalar(Translation, Rotation, Scaling, Out);
+#endif
+}
+
+Quaternion Nlerp(const Quaternion& a, const Quaternion& b, float Factor)
+{
+#ifdef MATH_3D_SSE
+    return NlerpSSE(a, b, Factor);
+#else
+    return NlerpScalar(a, b, Factor);
+#endif
+}
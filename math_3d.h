@@ -34,6 +34,16 @@
 
 #include "util.h"
 
+// The matrix and quaternion kernels below come in a scalar and an SSE
+// version. The SSE one is used wherever SSE is available, unless
+// MATH_3D_NO_SIMD is defined. Both do the same IEEE operations in the same
+// order, so they give bit identical results as long as the compiler does not
+// fuse multiplies and adds (-ffp-contract=off on targets with FMA).
+#if !defined(MATH_3D_NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define MATH_3D_SSE
+#include <xmmintrin.h>
+#endif
+
 #define ToRadian(x) (float)(((x) * M_PI / 180.0f))
 #define ToDegree(x) (float)(((x) * 180.0f / M_PI))
 
@@ -108,6 +118,11 @@ struct Vector3f
 
     Vector3f& Normalize();
 
+    float Length() const
+    {
+        return sqrtf(x * x + y * y + z * z);
+    }
+
     void Rotate(float Angle, const Vector3f& Axis);
 
     void Print() const
@@ -145,6 +160,9 @@ inline Vector3f operator*(const Vector3f& l, float f)
 }
 
 
+class Matrix4f;
+inline void MultiplyMatrix(const Matrix4f& Left, const Matrix4f& Right, Matrix4f& Out);
+
 class Matrix4f
 {
 public:
@@ -196,16 +214,7 @@ public:
     inline Matrix4f operator*(const Matrix4f& Right) const
     {
         Matrix4f Ret;
-
-        for (unsigned int i = 0 ; i < 4 ; i++) {
-            for (unsigned int j = 0 ; j < 4 ; j++) {
-                Ret.m[i][j] = m[i][0] * Right.m[0][j] +
-                              m[i][1] * Right.m[1][j] +
-                              m[i][2] * Right.m[2][j] +
-                              m[i][3] * Right.m[3][j];
-            }
-        }
-
+        MultiplyMatrix(*this, Right, Ret);
         return Ret;
     }
     void Print() const
@@ -239,5 +248,91 @@ Quaternion operator*(const Quaternion& l, const Quaternion& r);
 
 Quaternion operator*(const Quaternion& q, const Vector3f& v);
 
+// Out = Left * Right, Out may be either of the inputs
+inline void MultiplyMatrixScalar(const Matrix4f& Left, const Matrix4f& Right, Matrix4f& Out)
+{
+    Matrix4f Ret;
+
+    for (unsigned int i = 0 ; i < 4 ; i++) {
+        for (unsigned int j = 0 ; j < 4 ; j++) {
+            Ret.m[i][j] = Left.m[i][0] * Right.m[0][j] +
+                          Left.m[i][1] * Right.m[1][j] +
+                          Left.m[i][2] * Right.m[2][j] +
+                          Left.m[i][3] * Right.m[3][j];
+        }
+    }
+
+    Out = Ret;
+}
+
+#ifdef MATH_3D_SSE
+// Each row of the result is the rows of Right weighted by a row of Left.
+// Loads are unaligned, nothing guarantees a Matrix4f in a std::vector is
+// aligned to 16 bytes, and they cost the same as aligned ones when it is.
+inline void MultiplyMatrixSSE(const Matrix4f& Left, const Matrix4f& Right, Matrix4f& Out)
+{
+    const __m128 r0 = _mm_loadu_ps(Right.m[0]);
+    const __m128 r1 = _mm_loadu_ps(Right.m[1]);
+    const __m128 r2 = _mm_loadu_ps(Right.m[2]);
+    const __m128 r3 = _mm_loadu_ps(Right.m[3]);
+
+    __m128 Rows[4];
+    for (unsigned int i = 0 ; i < 4 ; i++) {
+        const __m128 l = _mm_loadu_ps(Left.m[i]);
+        __m128 Row = _mm_mul_ps(_mm_shuffle_ps(l, l, 0x00), r0);
+        Row = _mm_add_ps(Row, _mm_mul_ps(_mm_shuffle_ps(l, l, 0x55), r1));
+        Row = _mm_add_ps(Row, _mm_mul_ps(_mm_shuffle_ps(l, l, 0xAA), r2));
+        Rows[i] = _mm_add_ps(Row, _mm_mul_ps(_mm_shuffle_ps(l, l, 0xFF), r3));
+    }
+
+    for (unsigned int i = 0 ; i < 4 ; i++) {
+        _mm_storeu_ps(Out.m[i], Rows[i]);
+    }
+}
+#endif
+
+inline void MultiplyMatrix(const Matrix4f& Left, const Matrix4f& Right, Matrix4f& Out)
+{
+#ifdef MATH_3D_SSE
+    MultiplyMatrixSSE(Left, Right, Out);
+#else
+    MultiplyMatrixScalar(Left, Right, Out);
+#endif
+}
+
+// pOut[i] = pLeft[i] * pRight[i] for Count matrices
+void MultiplyMatrices(const Matrix4f* pLeft, const Matrix4f* pRight, Matrix4f* pOut, unsigned int Count);
+void MultiplyMatricesScalar(const Matrix4f* pLeft, const Matrix4f* pRight, Matrix4f* pOut, unsigned int Count);
+
+// Translation * Rotation * Scaling built straight from the unit quaternion,
+// without the three matrix products
+void ComposeTransform(const Vector3f& Translation, const Quaternion& Rotation,
+                      const Vector3f& Scaling, Matrix4f& Out);
+void ComposeTransformScalar(const Vector3f& Translation, const Quaternion& Rotation,
+                            const Vector3f& Scaling, Matrix4f& Out);
+
+// Normalized linear interpolation along the shorter arc. Much cheaper than a
+// slerp and, between animation keys a frame or so apart, indistinguishable.
+Quaternion Nlerp(const Quaternion& a, const Quaternion& b, float Factor);
+Quaternion NlerpScalar(const Quaternion& a, const Quaternion& b, float Factor);
+
+#ifdef MATH_3D_SSE
+void MultiplyMatricesSSE(const Matrix4f* pLeft, const Matrix4f* pRight, Matrix4f* pOut, unsigned int Count);
+void ComposeTransformSSE(const Vector3f& Translation, const Quaternion& Rotation,
+                         const Vector3f& Scaling, Matrix4f& Out);
+Quaternion NlerpSSE(const Quaternion& a, const Quaternion& b, float Factor);
+#endif
+
+// A rigid transform as a unit rotation quaternion and a dual part that holds
+// the translation, half the size of a Matrix4f. Both are stored x y z w.
+struct DualQuaternion
+{
+    float Real[4];
+    float Dual[4];
+
+    // Any scale in the matrix is lost
+    void InitFromMatrix(const Matrix4f& m);
+};
+
 #endif	/* MATH_3D_H */
 
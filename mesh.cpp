@@ -1,240 +1,1703 @@
 #include <assert.h>
+#include <math.h>
 #include <iostream>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <algorithm>
+#ifdef WIN32
+#include <direct.h>
+#endif
+#include <SFML/System.hpp>
 #include "mesh.hpp"
+#include "mapped_file.hpp"
+#include "mesh_optimizer.hpp"
+#include "trace.hpp"
+
+// Bump this whenever the layout of a cached BVH changes, or Bullet is updated
+#define BVH_CACHE_VERSION 1
+
+// Bump this whenever the layout of anything written by saveCooked changes,
+// stale cooked files are then ignored and the source asset is imported again
+#define COOKED_MESH_VERSION 5
+
+// Clip bounds are taken from poses this far apart, the rate the pose cache
+// samples clips at
+#define CLIP_BOUNDS_SAMPLE_RATE 60.0f
+
+// Each LOD of a skinned mesh keeps about this share of the triangles of the
+// one before it
+#define LOD_TRIANGLE_RATIO 0.5f
+
+namespace
+{
+	struct CookedMeshHeader
+	{
+		char Magic[4];
+		unsigned int Version;
+		unsigned int VertexFormat;
+		unsigned int IndexSize;
+		unsigned int NumVertices;
+		unsigned int NumIndices;
+		unsigned int NumEntries;
+		unsigned int NumMaterials;
+		unsigned int NumBones;
+		unsigned int NumNodes;
+		unsigned int NumNodeChildren;
+		unsigned int NumChannels;
+		unsigned int NumPositionKeys;
+		unsigned int NumRotationKeys;
+		unsigned int NumScalingKeys;
+		unsigned int NumTracks;
+		unsigned int NumPackedKeys;
+		unsigned int NumLods;
+		unsigned int NumLodVertices;
+		unsigned int NumLodIndices;
+		unsigned int NumLodEntries;
+		unsigned int NumLodBones;
+		float Duration;
+		float TicksPerSecond;
+		Matrix4f GlobalInverseTransform;
+	};
+
+	struct CookedMaterial
+	{
+		char Path[MESH_PATH_LENGTH];
+	};
+
+	struct CookedBone
+	{
+		char Name[MESH_NAME_LENGTH];
+		Matrix4f BoneOffset;
+	};
+
+	// A MeshLod, its entries and bones are in sections of their own
+	struct CookedLod
+	{
+		unsigned int FirstVertex;
+		unsigned int NumVertices;
+		unsigned int FirstEntry;
+		unsigned int NumEntries;
+		unsigned int FirstBone;
+		unsigned int NumBones;
+		float MinScreenSize;
+	};
+
+	struct BvhCacheHeader
+	{
+		char Magic[4];
+		unsigned int Version;
+		unsigned int PointerSize;
+		unsigned int Size;
+		unsigned long long TriangleHash;
+	};
+
+	// 64 bit FNV-1a, used to key cached BVHs on the triangles they contain
+	#define FNV_OFFSET_BASIS 14695981039346656037ULL
+
+	unsigned long long hashBytes(unsigned long long Hash, const void* pData, size_t Size)
+	{
+		const unsigned char* pBytes = (const unsigned char*)pData;
+		for(size_t i = 0; i < Size; i++)
+		{
+			Hash ^= pBytes[i];
+			Hash *= 1099511628211ULL;
+		}
+		return Hash;
+	}
+
+	// Every section starts on a 16 byte boundary so the arrays can be used
+	// straight out of the mapping
+	size_t alignSection(size_t Offset)
+	{
+		return (Offset + 15) & ~(size_t)15;
+	}
+
+	template <typename T>
+	void writeSection(FILE* File, const T* pData, size_t Count)
+	{
+		long Position = ftell(File);
+		size_t Padding = alignSection(Position) - Position;
+		const char Zero[16] = { 0 };
+		fwrite(Zero, 1, Padding, File);
+		if(Count > 0)
+		{
+			fwrite(pData, sizeof(T), Count, File);
+		}
+	}
+
+	// Count elements of Size bytes. A section that does not fit in the file
+	// moves Offset past its end, without ever multiplying the count out, so
+	// the truncation check after the last section catches any bad count.
+	template <typename T>
+	const T* readSection(const char* pBase, size_t FileSize, size_t& Offset, size_t Count, size_t Size = sizeof(T))
+	{
+		Offset = alignSection(Offset);
+		const T* pData = (const T*)(pBase + Offset);
+		if(Offset > FileSize || (Size > 0 && Count > (FileSize - Offset) / Size))
+		{
+			Offset = FileSize + 1;
+			return pData;
+		}
+		Offset += Count * Size;
+		return pData;
+	}
+
+	void copyName(char* Dest, const char* Src, size_t Size)
+	{
+		strncpy(Dest, Src, Size - 1);
+		Dest[Size - 1] = '\0';
+	}
+
+	// Rounds to nearest. Values too large for a half become infinity, too
+	// small ones flush to a denormal or zero.
+	unsigned short floatToHalf(float Value)
+	{
+		unsigned int Bits;
+		memcpy(&Bits, &Value, sizeof(Bits));
+
+		unsigned int Sign = (Bits >> 16) & 0x8000;
+		int Exponent = (int)((Bits >> 23) & 0xFF) - 127 + 15;
+		unsigned int Mantissa = Bits & 0x7FFFFF;
+
+		if(Exponent >= 31)
+		{
+			return Sign | 0x7C00;
+		}
+		if(Exponent <= 0)
+		{
+			if(Exponent < -10)
+			{
+				return Sign;
+			}
+			Mantissa |= 0x800000;
+			return Sign | ((Mantissa >> (14 - Exponent)) + ((Mantissa >> (13 - Exponent)) & 1));
+		}
+
+		// A carry out of the mantissa correctly bumps the exponent
+		return Sign | (((Exponent << 10) | (Mantissa >> 13)) + ((Mantissa >> 12) & 1));
+	}
+
+	// Signed normalized GL_INT_2_10_10_10_REV, x in the low bits
+	unsigned int packNormal(const Vector3f& Normal)
+	{
+		const float Components[3] = { Normal.x, Normal.y, Normal.z };
+		unsigned int Packed = 0;
+		for(unsigned int i = 0; i < 3; i++)
+		{
+			float Value = Components[i] < -1.0f ? -1.0f : (Components[i] > 1.0f ? 1.0f : Components[i]);
+			int Quantized = (int)floorf(Value * 511.0f + 0.5f);
+			Packed |= (Quantized & 0x3FF) << (i * 10);
+		}
+		return Packed;
+	}
+
+	template <typename T>
+	void packCommon(const Mesh::Vertex& Src, T& Dst)
+	{
+		Dst.Position = Src.Position;
+		Dst.Normal = packNormal(Src.Normal);
+		Dst.TexCoord[0] = floatToHalf(Src.TexCoord.x);
+		Dst.TexCoord[1] = floatToHalf(Src.TexCoord.y);
+	}
+
+	// The rounding error of the weights goes to the largest one, so they add
+	// up to the same total as before quantizing and a vertex does not drift
+	void packBones(const Mesh::VertexBoneData& Src, Mesh::SkinnedVertex& Dst)
+	{
+		float Total = 0.0f;
+		int Sum = 0;
+		unsigned int Largest = 0;
+		for(unsigned int i = 0; i < 4; i++)
+		{
+			float Weight = Src.Weights[i] < 0.0f ? 0.0f : (Src.Weights[i] > 1.0f ? 1.0f : Src.Weights[i]);
+			Dst.BoneIDs[i] = Src.IDs[i] < 256 ? Src.IDs[i] : 0;
+			Dst.BoneWeights[i] = (unsigned char)(Weight * 255.0f + 0.5f);
+			Total += Weight;
+			Sum += Dst.BoneWeights[i];
+			if(Dst.BoneWeights[i] > Dst.BoneWeights[Largest])
+			{
+				Largest = i;
+			}
+		}
+
+		int Target = (int)(Total * 255.0f + 0.5f);
+		int Adjusted = Dst.BoneWeights[Largest] + Target - Sum;
+		Dst.BoneWeights[Largest] = Adjusted < 0 ? 0 : (Adjusted > 255 ? 255 : Adjusted);
+	}
+
+	// The screen size, in viewport heights, below which the next LOD takes
+	// over from each one
+	const float LodScreenSizes[MAX_MESH_LODS] = { 0.25f, 0.1f, 0.0f };
+
+	// Points the vertex at the palette slots of a LOD. Bones merged into the
+	// same slot add their weights together.
+	void remapBones(Mesh::SkinnedVertex& Vertex, const std::vector<unsigned int>& Slots)
+	{
+		unsigned int IDs[4];
+		unsigned int Weights[4];
+		unsigned int Count = 0;
+		for(unsigned int i = 0; i < 4; i++)
+		{
+			if(Vertex.BoneWeights[i] == 0)
+			{
+				continue;
+			}
+			unsigned int Slot = Vertex.BoneIDs[i] < Slots.size() ? Slots[Vertex.BoneIDs[i]] : 0;
+			unsigned int j = 0;
+			while(j < Count && IDs[j] != Slot)
+			{
+				j++;
+			}
+			if(j == Count)
+			{
+				IDs[Count] = Slot;
+				Weights[Count++] = 0;
+			}
+			Weights[j] += Vertex.BoneWeights[i];
+		}
+
+		for(unsigned int i = 0; i < 4; i++)
+		{
+			Vertex.BoneIDs[i] = i < Count ? IDs[i] : 0;
+			Vertex.BoneWeights[i] = i < Count ? std::min(Weights[i], 255u) : 0;
+		}
+	}
+
+	Vector3f transformPoint(const Matrix4f& m, const Vector3f& p)
+	{
+		return Vector3f(m.m[0][0] * p.x + m.m[0][1] * p.y + m.m[0][2] * p.z + m.m[0][3],
+						m.m[1][0] * p.x + m.m[1][1] * p.y + m.m[1][2] * p.z + m.m[1][3],
+						m.m[2][0] * p.x + m.m[2][1] * p.y + m.m[2][2] * p.z + m.m[2][3]);
+	}
+
+	// What dual quaternion skinning keeps of a bone transform: the rotation
+	// and translation, without the scale
+	Matrix4f rigidPart(const Matrix4f& m)
+	{
+		Matrix4f Rigid = m;
+		for(unsigned int Column = 0; Column < 3; Column++)
+		{
+			float Length = Vector3f(m.m[0][Column], m.m[1][Column], m.m[2][Column]).Length();
+			if(Length > 0.0f)
+			{
+				Rigid.m[0][Column] /= Length;
+				Rigid.m[1][Column] /= Length;
+				Rigid.m[2][Column] /= Length;
+			}
+		}
+		return Rigid;
+	}
+
+	// Linear blend skinning of one position, as skinning.vert does it
+	Vector3f skinPosition(const Mesh::SkinnedVertex& Vertex, const std::vector<Matrix4f>& Transforms)
+	{
+		Vector3f Position(0.0f, 0.0f, 0.0f);
+		for(unsigned int i = 0; i < 4; i++)
+		{
+			if(Vertex.BoneWeights[i] == 0 || Vertex.BoneIDs[i] >= Transforms.size())
+			{
+				continue;
+			}
+			Vector3f Skinned = transformPoint(Transforms[Vertex.BoneIDs[i]], Vertex.Position);
+			Skinned *= Vertex.BoneWeights[i] / 255.0f;
+			Position += Skinned;
+		}
+		return Position;
+	}
+}
+
+// Tight enough that the reduction is invisible on the characters we have
+ClipTolerance Mesh::s_clip_tolerance = { 0.001f, 0.0005f, 0.0001f };
+bool Mesh::s_keep_source_keys = false;
 
 Mesh::Mesh()
 	: m_VAO(0),
+	  m_SkinnedVAO(0),
+	  m_SkinnedBuffer(0),
+	  m_InstancedVAO(0),
+	  m_InstanceBuffer(0),
+	  m_FirstInstance(0),
+	  m_NumVertices(0),
+	  m_BoundsCenter(0.0f, 0.0f, 0.0f),
+	  m_BoundsRadius(0.0f),
 	  m_NumBones(0),
-	  m_pScene(NULL)
+	  m_SkinningMode(LINEAR_SKINNING),
+	  m_VertexFormat(STATIC_VERTEX),
+	  m_VertexSize(sizeof(StaticVertex)),
+	  m_IndexSize(sizeof(unsigned int)),
+	  m_pVertexData(NULL),
+	  m_NumVertexData(0),
+	  m_pIndexData(NULL),
+	  m_NumIndexData(0),
+	  m_pLodVertexData(NULL),
+	  m_NumLodVertexData(0),
+	  m_pLodIndexData(NULL),
+	  m_NumLodIndexData(0)
 {
 	ZERO_MEM(m_Buffers);
 }
 
-Mesh::~Mesh()
-{
-	clear();
-}
+Mesh::~Mesh()
+{
+	clear();
+}
+
+void Mesh::clear()
+{
+	for(unsigned int i = 0; i < m_Textures.size(); i++)
+	{	
+		TextureCache::Release(m_Textures[i]);
+		m_Textures[i] = NULL;
+	}
+
+	if(m_Buffers[0] != 0)
+	{
+		glDeleteBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
+		ZERO_MEM(m_Buffers);
+	}
+
+	if(m_VAO != 0)
+	{
+		glDeleteVertexArrays(1, &m_VAO);
+		m_VAO = 0;
+	}
+
+	if(m_SkinnedVAO != 0)
+	{
+		glDeleteVertexArrays(1, &m_SkinnedVAO);
+		m_SkinnedVAO = 0;
+		m_SkinnedBuffer = 0;
+	}
+
+	if(m_InstancedVAO != 0)
+	{
+		glDeleteVertexArrays(1, &m_InstancedVAO);
+		m_InstancedVAO = 0;
+		m_InstanceBuffer = 0;
+		m_FirstInstance = 0;
+	}
+
+	m_Nodes.clear();
+	m_NodeChildren.clear();
+	m_Clips.clear();
+	m_Lods.clear();
+}
+
+std::string Mesh::getCookedFilename(const std::string& Filename)
+{
+	std::string::size_type DotIndex = Filename.find_last_of(".");
+	std::string::size_type SlashIndex = Filename.find_last_of("/");
+
+	if(DotIndex == std::string::npos || 
+	   (SlashIndex != std::string::npos && DotIndex < SlashIndex))
+	{
+		return Filename + ".cmesh";
+	}
+
+	return Filename.substr(0, DotIndex) + ".cmesh";
+}
+
+bool Mesh::loadMesh(const std::string& Filename)
+{
+	clear();
+
+	return prepareMesh(Filename) && uploadMesh();
+}
+
+bool Mesh::prepareMesh(const std::string& Filename)
+{
+	// Prefer the cooked version of the mesh, unless the source asset has
+	// been edited since it was cooked
+	std::string CookedFilename = getCookedFilename(Filename);
+	if(isFileNewer(Filename, CookedFilename) || !loadCooked(CookedFilename))
+	{
+		if(!importMesh(Filename))
+		{
+			return false;
+		}
+	}
+
+	for(unsigned int i = 0; i < m_Entries.size(); i++)
+	{
+		initMesh(i);
+	}
+
+	computeBounds();
+	prepareMaterials();
+	bindSkeleton();
+
+	return true;
+}
+
+bool Mesh::uploadMesh()
+{
+	bool Ret = initBuffers();
+	Ret = initMaterials() && Ret;
+
+	if(!s_keep_source_keys)
+	{
+		releaseSourceKeys();
+	}
+
+	// The vertex data lives on the GPU now
+	m_pVertexData = NULL;
+	m_NumVertexData = 0;
+	m_pIndexData = NULL;
+	m_NumIndexData = 0;
+	m_pLodVertexData = NULL;
+	m_NumLodVertexData = 0;
+	m_pLodIndexData = NULL;
+	m_NumLodIndexData = 0;
+	m_CookedFile.close();
+	std::vector<unsigned char>().swap(m_PackedVertices);
+	std::vector<unsigned char>().swap(m_PackedIndices);
+	std::vector<unsigned char>().swap(m_LodVertices);
+	std::vector<unsigned char>().swap(m_LodIndices);
+
+	return Ret;
+}
+
+bool Mesh::importMesh(const std::string& Filename)
+{
+	// The importer owns the scene, so everything we need from it is copied
+	// out before it goes out of scope
+	Assimp::Importer Importer;
+	Trace::addFileRead(Filename);
+	const aiScene* pScene = Importer.ReadFile(Filename.c_str(),
+			aiProcess_Triangulate | aiProcess_GenSmoothNormals | 
+			aiProcess_FlipUVs);
+
+	if(!pScene)
+	{
+		printf("Error parsing '%s': '%s'\n", Filename.c_str(),
+			   Importer.GetErrorString());
+		return false;
+	}
+
+	m_GlobalInverseTransform = pScene->mRootNode->mTransformation;
+	m_GlobalInverseTransform.Inverse();
+
+	if(!initScene(pScene, Filename))
+	{
+		return false;
+	}
+
+	packVertices(Filename);
+
+	m_pVertexData = &m_PackedVertices[0];
+	m_NumVertexData = m_PackedVertices.size() / m_VertexSize;
+	m_pIndexData = &m_PackedIndices[0];
+	m_NumIndexData = m_PackedIndices.size() / m_IndexSize;
+
+	// Built here rather than at load, so they are cooked along with the mesh
+	buildLods();
+
+	return true;
+}
+
+bool Mesh::initScene(const aiScene* pScene, const std::string& Filename)
+{
+	m_Entries.resize(pScene->mNumMeshes);
+
+	unsigned int NumVertices = 0;
+	unsigned int NumIndices = 0;
+
+	for(unsigned int i = 0; i < m_Entries.size(); i++)
+	{
+		m_Entries[i].MaterialIndex = pScene->mMeshes[i]->mMaterialIndex;
+		m_Entries[i].NumIndices = pScene->mMeshes[i]->mNumFaces * 3;
+		m_Entries[i].BaseVertex = NumVertices;
+		m_Entries[i].BaseIndex = NumIndices;
+
+		NumVertices += pScene->mMeshes[i]->mNumVertices;
+		NumIndices += m_Entries[i].NumIndices;
+	}
+
+	m_Vertices.resize(NumVertices);
+	m_Indices.reserve(NumIndices);
+
+	for(unsigned int i = 0; i < m_Entries.size(); i++)
+	{
+		const aiMesh* paiMesh = pScene->mMeshes[i];
+		importVertices(i, paiMesh);
+	}
+
+	optimizeVertices(Filename);
+
+	importMaterials(pScene, Filename);
+
+	if(pScene->mNumAnimations > 0)
+	{
+		m_Clips.push_back(AnimationClip());
+		importAnimation(pScene, m_Clips.back());
+		importNode(pScene->mRootNode);
+	}
+
+	return !m_Vertices.empty() && !m_Indices.empty();
+}
+
+void Mesh::importVertices(unsigned int MeshIndex, const aiMesh* paiMesh)
+{
+	const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
+	Vertex* pVertices = &m_Vertices[m_Entries[MeshIndex].BaseVertex];
+
+	for(unsigned int i = 0; i < paiMesh->mNumVertices; i++)
+	{
+		const aiVector3D* pPos = &(paiMesh->mVertices[i]);
+		const aiVector3D* pNormal = &(paiMesh->mNormals[i]);
+		const aiVector3D* pTexCoord = paiMesh->HasTextureCoords(0) ?
+			&(paiMesh->mTextureCoords[0][i]) : &Zero3D;
+
+		pVertices[i].Position = Vector3f(pPos->x, pPos->y, pPos->z);
+		pVertices[i].Normal = Vector3f(pNormal->x, pNormal->y, pNormal->z);
+		pVertices[i].TexCoord = Vector2f(pTexCoord->x, pTexCoord->y);
+	}
+
+	loadBones(MeshIndex, paiMesh);
+
+	for(unsigned int i = 0; i < paiMesh->mNumFaces; i++)
+	{
+		const aiFace& Face = paiMesh->mFaces[i];
+		assert(Face.mNumIndices == 3);
+		m_Indices.push_back(Face.mIndices[0]);
+		m_Indices.push_back(Face.mIndices[1]);
+		m_Indices.push_back(Face.mIndices[2]);
+	}
+}
+
+// Runs the mesh optimizer on every entry. This has to happen after the bone
+// weights are in, vertices only weld when their weights match too.
+void Mesh::optimizeVertices(const std::string& Filename)
+{
+	std::vector<Vertex> Vertices;
+	std::vector<unsigned int> Indices;
+	Vertices.reserve(m_Vertices.size());
+	Indices.reserve(m_Indices.size());
+
+	unsigned int MissesBefore = 0;
+	unsigned int MissesAfter = 0;
+
+	for(unsigned int i = 0; i < m_Entries.size(); i++)
+	{
+		MeshEntry& Entry = m_Entries[i];
+		unsigned int NumVertices = (i + 1 < m_Entries.size() ? m_Entries[i + 1].BaseVertex : m_Vertices.size()) -
+								   Entry.BaseVertex;
+		const Vertex* pVertices = &m_Vertices[Entry.BaseVertex];
+		std::vector<unsigned int> EntryIndices(m_Indices.begin() + Entry.BaseIndex,
+											   m_Indices.begin() + Entry.BaseIndex + Entry.NumIndices);
+		MissesBefore += countCacheMisses(EntryIndices, NumVertices);
+
+		std::vector<unsigned int> Remap;
+		unsigned int NumWelded = weldVertices(EntryIndices, pVertices, NumVertices, sizeof(Vertex), Remap);
+		std::vector<Vertex> Welded(NumWelded);
+		remapVertices(pVertices, NumVertices, Remap, Welded.empty() ? NULL : &Welded[0]);
+
+		optimizeVertexCache(EntryIndices, NumWelded);
+		if(!Welded.empty())
+		{
+			optimizeOverdraw(EntryIndices, &Welded[0].Position.x, sizeof(Vertex), NumWelded);
+		}
+		unsigned int NumUsed = optimizeVertexFetch(EntryIndices, NumWelded, Remap);
+		MissesAfter += countCacheMisses(EntryIndices, NumUsed);
+
+		Entry.BaseVertex = Vertices.size();
+		Entry.BaseIndex = Indices.size();
+		Vertices.resize(Vertices.size() + NumUsed);
+		remapVertices(Welded.empty() ? NULL : &Welded[0], NumWelded, Remap, &Vertices[Entry.BaseVertex]);
+		Indices.insert(Indices.end(), EntryIndices.begin(), EntryIndices.end());
+	}
+
+	float NumTriangles = m_Indices.size() > 0 ? m_Indices.size() / 3.0f : 1.0f;
+	printf("%-28s %6u -> %6u vertices, ACMR %.3f -> %.3f\n", Filename.c_str(),
+		   (unsigned int)m_Vertices.size(), (unsigned int)Vertices.size(),
+		   MissesBefore / NumTriangles, MissesAfter / NumTriangles);
+
+	m_Vertices.swap(Vertices);
+	m_Indices.swap(Indices);
+}
+
+void Mesh::packVertices(const std::string& Filename)
+{
+	// Meshes without bones never need a bone stream
+	m_VertexFormat = m_NumBones > 0 ? SKINNED_VERTEX : STATIC_VERTEX;
+	m_VertexSize = m_VertexFormat == SKINNED_VERTEX ? sizeof(SkinnedVertex) : sizeof(StaticVertex);
+	if(m_NumBones > 256)
+	{
+		printf("'%s' has %u bones, only the first 256 can be skinned\n", Filename.c_str(), m_NumBones);
+	}
+
+	m_PackedVertices.resize(m_Vertices.size() * m_VertexSize);
+	for(unsigned int i = 0; i < m_Vertices.size(); i++)
+	{
+		if(m_VertexFormat == SKINNED_VERTEX)
+		{
+			SkinnedVertex& Dst = ((SkinnedVertex*)&m_PackedVertices[0])[i];
+			packCommon(m_Vertices[i], Dst);
+			packBones(m_Vertices[i].Bones, Dst);
+		}
+		else
+		{
+			packCommon(m_Vertices[i], ((StaticVertex*)&m_PackedVertices[0])[i]);
+		}
+	}
+
+	unsigned int MaxIndex = 0;
+	for(unsigned int i = 0; i < m_Indices.size(); i++)
+	{
+		MaxIndex = m_Indices[i] > MaxIndex ? m_Indices[i] : MaxIndex;
+	}
+
+	m_IndexSize = MaxIndex <= 0xFFFF ? sizeof(unsigned short) : sizeof(unsigned int);
+	m_PackedIndices.resize(m_Indices.size() * m_IndexSize);
+	for(unsigned int i = 0; i < m_Indices.size(); i++)
+	{
+		if(m_IndexSize == sizeof(unsigned short))
+		{
+			((unsigned short*)&m_PackedIndices[0])[i] = m_Indices[i];
+		}
+		else
+		{
+			((unsigned int*)&m_PackedIndices[0])[i] = m_Indices[i];
+		}
+	}
+
+	std::vector<Vertex>().swap(m_Vertices);
+	std::vector<unsigned int>().swap(m_Indices);
+}
+
+void Mesh::initMesh(unsigned int MeshIndex)
+{
+}
+
+// Centered on the bounding box, which is close enough to the smallest sphere
+// for culling
+void Mesh::computeBounds()
+{
+	if(m_NumVertexData == 0)
+	{
+		return;
+	}
+
+	Vector3f Min = getPosition(0);
+	Vector3f Max = Min;
+	for(unsigned int i = 1; i < m_NumVertexData; i++)
+	{
+		const Vector3f& Position = getPosition(i);
+		Min.x = std::min(Min.x, Position.x); Max.x = std::max(Max.x, Position.x);
+		Min.y = std::min(Min.y, Position.y); Max.y = std::max(Max.y, Position.y);
+		Min.z = std::min(Min.z, Position.z); Max.z = std::max(Max.z, Position.z);
+	}
+	m_BoundsCenter = Vector3f((Min.x + Max.x) * 0.5f, (Min.y + Max.y) * 0.5f, (Min.z + Max.z) * 0.5f);
+
+	float RadiusSquared = 0.0f;
+	for(unsigned int i = 0; i < m_NumVertexData; i++)
+	{
+		const Vector3f& Position = getPosition(i);
+		float x = Position.x - m_BoundsCenter.x;
+		float y = Position.y - m_BoundsCenter.y;
+		float z = Position.z - m_BoundsCenter.z;
+		RadiusSquared = std::max(RadiusSquared, x * x + y * y + z * z);
+	}
+	m_BoundsRadius = sqrtf(RadiusSquared);
+
+	if(m_VertexFormat != SKINNED_VERTEX || m_NumBones == 0)
+	{
+		return;
+	}
+
+	// A box around each bone's vertices first, then the sphere around its
+	// center. Bones that move no vertices get a negative radius.
+	std::vector<Vector3f> BoneMin(m_NumBones);
+	std::vector<Vector3f> BoneMax(m_NumBones);
+	std::vector<unsigned char> HasVertices(m_NumBones, 0);
+	for(unsigned int i = 0; i < m_NumVertexData; i++)
+	{
+		const SkinnedVertex& Vertex = *(const SkinnedVertex*)(m_pVertexData + i * m_VertexSize);
+		for(unsigned int j = 0; j < 4; j++)
+		{
+			unsigned int Bone = Vertex.BoneIDs[j];
+			if(Vertex.BoneWeights[j] == 0 || Bone >= m_NumBones)
+			{
+				continue;
+			}
+			const Vector3f& Position = Vertex.Position;
+			Vector3f& Min = BoneMin[Bone];
+			Vector3f& Max = BoneMax[Bone];
+			if(!HasVertices[Bone])
+			{
+				Min = Max = Position;
+				HasVertices[Bone] = 1;
+			}
+			Min.x = std::min(Min.x, Position.x); Max.x = std::max(Max.x, Position.x);
+			Min.y = std::min(Min.y, Position.y); Max.y = std::max(Max.y, Position.y);
+			Min.z = std::min(Min.z, Position.z); Max.z = std::max(Max.z, Position.z);
+		}
+	}
+
+	m_BoneBounds.resize(m_NumBones);
+	for(unsigned int i = 0; i < m_NumBones; i++)
+	{
+		m_BoneBounds[i].Center = Vector3f((BoneMin[i].x + BoneMax[i].x) * 0.5f, (BoneMin[i].y + BoneMax[i].y) * 0.5f,
+										  (BoneMin[i].z + BoneMax[i].z) * 0.5f);
+		m_BoneBounds[i].Radius = HasVertices[i] ? 0.0f : -1.0f;
+	}
+	for(unsigned int i = 0; i < m_NumVertexData; i++)
+	{
+		const SkinnedVertex& Vertex = *(const SkinnedVertex*)(m_pVertexData + i * m_VertexSize);
+		for(unsigned int j = 0; j < 4; j++)
+		{
+			unsigned int Bone = Vertex.BoneIDs[j];
+			if(Vertex.BoneWeights[j] == 0 || Bone >= m_NumBones)
+			{
+				continue;
+			}
+			Vector3f Offset = Vertex.Position - m_BoneBounds[Bone].Center;
+			m_BoneBounds[Bone].Radius = std::max(m_BoneBounds[Bone].Radius, Offset.Length());
+		}
+	}
+
+	// The same for every pair of bones a vertex is weighted to
+	std::map<std::pair<unsigned int, unsigned int>, unsigned int> LinkIndices;
+	std::vector<Vector3f> LinkMin;
+	std::vector<Vector3f> LinkMax;
+	std::vector<unsigned int> VertexLinks;
+	m_BoneLinks.clear();
+	for(unsigned int i = 0; i < m_NumVertexData; i++)
+	{
+		const SkinnedVertex& Vertex = *(const SkinnedVertex*)(m_pVertexData + i * m_VertexSize);
+		for(unsigned int j = 0; j < 4; j++)
+		{
+			for(unsigned int k = j + 1; k < 4; k++)
+			{
+				unsigned int First = std::min(Vertex.BoneIDs[j], Vertex.BoneIDs[k]);
+				unsigned int Second = std::max(Vertex.BoneIDs[j], Vertex.BoneIDs[k]);
+				if(Vertex.BoneWeights[j] == 0 || Vertex.BoneWeights[k] == 0 || First == Second || Second >= m_NumBones)
+				{
+					continue;
+				}
+
+				std::pair<unsigned int, unsigned int> Key(First, Second);
+				std::map<std::pair<unsigned int, unsigned int>, unsigned int>::iterator it = LinkIndices.find(Key);
+				const Vector3f& Position = Vertex.Position;
+				if(it == LinkIndices.end())
+				{
+					it = LinkIndices.insert(std::make_pair(Key, (unsigned int)m_BoneLinks.size())).first;
+					BoneLink Link;
+					Link.Bones[0] = First;
+					Link.Bones[1] = Second;
+					Link.Radius = 0.0f;
+					m_BoneLinks.push_back(Link);
+					LinkMin.push_back(Position);
+					LinkMax.push_back(Position);
+				}
+				Vector3f& Min = LinkMin[it->second];
+				Vector3f& Max = LinkMax[it->second];
+				Min.x = std::min(Min.x, Position.x); Max.x = std::max(Max.x, Position.x);
+				Min.y = std::min(Min.y, Position.y); Max.y = std::max(Max.y, Position.y);
+				Min.z = std::min(Min.z, Position.z); Max.z = std::max(Max.z, Position.z);
+				VertexLinks.push_back(i);
+				VertexLinks.push_back(it->second);
+			}
+		}
+	}
+
+	for(unsigned int i = 0; i < m_BoneLinks.size(); i++)
+	{
+		m_BoneLinks[i].Center = Vector3f((LinkMin[i].x + LinkMax[i].x) * 0.5f, (LinkMin[i].y + LinkMax[i].y) * 0.5f,
+										 (LinkMin[i].z + LinkMax[i].z) * 0.5f);
+	}
+	for(unsigned int i = 0; i < VertexLinks.size(); i += 2)
+	{
+		BoneLink& Link = m_BoneLinks[VertexLinks[i + 1]];
+		Vector3f Offset = getPosition(VertexLinks[i]) - Link.Center;
+		Link.Radius = std::max(Link.Radius, Offset.Length());
+	}
+}
+
+// Every LOD is simplified from the full mesh rather than from the LOD before
+// it, and vertex clustering keeps the surviving vertices where they were, so
+// they keep their bone weights and texture coordinates too
+void Mesh::buildLods()
+{
+	m_Lods.assign(1, MeshLod());
+	m_LodVertices.clear();
+	m_LodIndices.clear();
+
+	MeshLod& Full = m_Lods[0];
+	Full.FirstVertex = 0;
+	Full.NumVertices = m_NumVertexData;
+	Full.Entries = m_Entries;
+	Full.MinScreenSize = 0.0f;
+	for(unsigned int i = 0; i < m_NumBones; i++)
+	{
+		Full.Bones.push_back(i);
+	}
+
+	if(m_VertexFormat != SKINNED_VERTEX || m_NumBones == 0 || m_NumVertexData == 0)
+	{
+		return;
+	}
+
+	unsigned int NumVertices = m_NumVertexData;
+	unsigned int NumIndices = m_NumIndexData;
+	unsigned int PreviousIndices = m_NumIndexData;
+	float Ratio = 1.0f;
+	for(unsigned int Level = 1; Level < MAX_MESH_LODS; Level++)
+	{
+		Ratio *= LOD_TRIANGLE_RATIO;
+		MeshLod Lod;
+		Lod.FirstVertex = NumVertices;
+		Lod.MinScreenSize = 0.0f;
+
+		// The surviving bones fill the palette in order, the merged ones
+		// share their target's slot
+		std::vector<unsigned int> Merged;
+		mergeLeafBones(Level, Merged);
+		std::vector<unsigned int> Slots(m_NumBones, 0);
+		for(unsigned int i = 0; i < m_NumBones; i++)
+		{
+			if(Merged[i] == i)
+			{
+				Slots[i] = Lod.Bones.size();
+				Lod.Bones.push_back(i);
+			}
+		}
+		for(unsigned int i = 0; i < m_NumBones; i++)
+		{
+			Slots[i] = Slots[Merged[i]];
+		}
+
+		unsigned int LodIndices = 0;
+		for(unsigned int i = 0; i < m_Entries.size(); i++)
+		{
+			const MeshEntry& Entry = m_Entries[i];
+			unsigned int EntryVertices = (i + 1 < m_Entries.size() ? m_Entries[i + 1].BaseVertex : m_NumVertexData) -
+										 Entry.BaseVertex;
+			const SkinnedVertex* pVertices = (const SkinnedVertex*)(m_pVertexData + Entry.BaseVertex * m_VertexSize);
+			std::vector<unsigned int> Indices(Entry.NumIndices);
+			for(unsigned int j = 0; j < Entry.NumIndices; j++)
+			{
+				Indices[j] = getIndex(Entry.BaseIndex + j);
+			}
+
+			simplifyClusters(Indices, &pVertices[0].Position.x, m_VertexSize, EntryVertices,
+							 (unsigned int)(Entry.NumIndices * Ratio) / 3 * 3);
+			optimizeVertexCache(Indices, EntryVertices);
+			optimizeOverdraw(Indices, &pVertices[0].Position.x, m_VertexSize, EntryVertices);
+			std::vector<unsigned int> Remap;
+			unsigned int NumUsed = optimizeVertexFetch(Indices, EntryVertices, Remap);
+
+			MeshEntry LodEntry = Entry;
+			LodEntry.NumIndices = Indices.size();
+			LodEntry.BaseVertex = NumVertices;
+			LodEntry.BaseIndex = NumIndices;
+			Lod.Entries.push_back(LodEntry);
+
+			m_LodVertices.resize(m_LodVertices.size() + NumUsed * m_VertexSize);
+			SkinnedVertex* pLodVertices = (SkinnedVertex*)&m_LodVertices[(NumVertices - m_NumVertexData) * m_VertexSize];
+			remapVertices(pVertices, EntryVertices, Remap, pLodVertices);
+			for(unsigned int j = 0; j < NumUsed; j++)
+			{
+				remapBones(pLodVertices[j], Slots);
+			}
+
+			// Entry indices are relative to the entry, so they still fit
+			// the index size of the full mesh
+			unsigned int IndexOffset = m_LodIndices.size();
+			m_LodIndices.resize(IndexOffset + Indices.size() * m_IndexSize);
+			for(unsigned int j = 0; j < Indices.size(); j++)
+			{
+				if(m_IndexSize == sizeof(unsigned short))
+				{
+					((unsigned short*)&m_LodIndices[IndexOffset])[j] = Indices[j];
+				}
+				else
+				{
+					((unsigned int*)&m_LodIndices[IndexOffset])[j] = Indices[j];
+				}
+			}
+
+			NumVertices += NumUsed;
+			NumIndices += Indices.size();
+			LodIndices += Indices.size();
+		}
+
+		// Stop once simplifying gains nothing, the mesh is as coarse as
+		// clustering gets it
+		Lod.NumVertices = NumVertices - Lod.FirstVertex;
+		if(Lod.NumVertices == 0 || (LodIndices >= PreviousIndices && Lod.Bones.size() == m_Lods.back().Bones.size()))
+		{
+			m_LodVertices.resize((Lod.FirstVertex - m_NumVertexData) * m_VertexSize);
+			m_LodIndices.resize((NumIndices - LodIndices - m_NumIndexData) * m_IndexSize);
+			break;
+		}
+		PreviousIndices = LodIndices;
+		m_Lods.push_back(Lod);
+	}
+
+	for(unsigned int i = 0; i < m_Lods.size(); i++)
+	{
+		m_Lods[i].MinScreenSize = i + 1 < m_Lods.size() ? LodScreenSizes[i] : 0.0f;
+	}
+
+	m_pLodVertexData = m_LodVertices.empty() ? NULL : &m_LodVertices[0];
+	m_NumLodVertexData = m_LodVertices.size() / m_VertexSize;
+	m_pLodIndexData = m_LodIndices.empty() ? NULL : &m_LodIndices[0];
+	m_NumLodIndexData = m_LodIndices.size() / m_IndexSize;
+}
+
+// A bone's parent is the nearest node above it that is a bone too. Bones
+// without one are roots and are never merged. The skeleton is read from the
+// nodes rather than m_Skeleton, so importMesh can run this before
+// bindSkeleton has.
+void Mesh::mergeLeafBones(unsigned int Rounds, std::vector<unsigned int>& Merged) const
+{
+	std::vector<int> NodeBones(m_Nodes.size(), -1);
+	std::vector<int> NodeParents(m_Nodes.size(), -1);
+	for(unsigned int i = 0; i < m_Nodes.size(); i++)
+	{
+		std::map<std::string, unsigned int>::const_iterator it = m_BoneMapping.find(m_Nodes[i].Name);
+		NodeBones[i] = it != m_BoneMapping.end() ? (int)it->second : -1;
+		for(unsigned int j = 0; j < m_Nodes[i].NumChildren; j++)
+		{
+			NodeParents[m_NodeChildren[m_Nodes[i].FirstChild + j]] = i;
+		}
+	}
+
+	std::vector<int> Parents(m_NumBones, -1);
+	for(unsigned int i = 0; i < m_Nodes.size(); i++)
+	{
+		int Bone = NodeBones[i];
+		if(Bone < 0 || Bone >= (int)m_NumBones)
+		{
+			continue;
+		}
+		int Parent = NodeParents[i];
+		while(Parent >= 0 && NodeBones[Parent] < 0)
+		{
+			Parent = NodeParents[Parent];
+		}
+		Parents[Bone] = Parent >= 0 ? NodeBones[Parent] : -1;
+	}
+
+	Merged.resize(m_NumBones);
+	for(unsigned int i = 0; i < m_NumBones; i++)
+	{
+		Merged[i] = i;
+	}
+
+	// A bone with a surviving child survives the round, so the parent of
+	// a surviving bone always survives too
+	for(unsigned int Round = 0; Round < Rounds; Round++)
+	{
+		std::vector<unsigned char> HasChild(m_NumBones, 0);
+		for(unsigned int i = 0; i < m_NumBones; i++)
+		{
+			if(Merged[i] == i && Parents[i] >= 0)
+			{
+				HasChild[Parents[i]] = 1;
+			}
+		}
+		for(unsigned int i = 0; i < m_NumBones; i++)
+		{
+			if(Merged[i] == i && Parents[i] >= 0 && !HasChild[i])
+			{
+				Merged[i] = Parents[i];
+			}
+		}
+	}
+
+	for(unsigned int i = 0; i < m_NumBones; i++)
+	{
+		unsigned int Target = Merged[i];
+		while(Merged[Target] != Target)
+		{
+			Target = Merged[Target];
+		}
+		Merged[i] = Target;
+	}
+}
+
+// LOD n merges the bones of LOD n - 1 further, so folding the LODs in order
+// carries each bone's vertices all the way to its last target
+void Mesh::foldMergedBoneBounds()
+{
+	if(m_BoneBounds.empty())
+	{
+		return;
+	}
+
+	std::vector<unsigned int> Merged;
+	for(unsigned int Level = 1; Level < MAX_MESH_LODS; Level++)
+	{
+		mergeLeafBones(Level, Merged);
+		for(unsigned int i = 0; i < m_NumBones; i++)
+		{
+			const BoneBounds& Source = m_BoneBounds[i];
+			BoneBounds& Target = m_BoneBounds[Merged[i]];
+			if(Merged[i] == i || Source.Radius < 0.0f)
+			{
+				continue;
+			}
+
+			Vector3f Offset = Source.Center - Target.Center;
+			float Distance = Offset.Length();
+			if(Target.Radius < 0.0f || Distance + Target.Radius <= Source.Radius)
+			{
+				Target = Source;
+			}
+			else if(Distance + Source.Radius > Target.Radius)
+			{
+				float Radius = (Distance + Target.Radius + Source.Radius) * 0.5f;
+				Target.Center += Offset * ((Radius - Target.Radius) / Distance);
+				Target.Radius = Radius;
+			}
+		}
+	}
+}
+
+unsigned int Mesh::selectLod(float ScreenSize) const
+{
+	unsigned int Lod = 0;
+	while(Lod + 1 < m_Lods.size() && ScreenSize < m_Lods[Lod].MinScreenSize)
+	{
+		Lod++;
+	}
+	return Lod;
+}
+
+unsigned int Mesh::getNumTriangles(unsigned int Lod) const
+{
+	unsigned int NumIndices = 0;
+	for(unsigned int i = 0; i < m_Lods[Lod].Entries.size(); i++)
+	{
+		NumIndices += m_Lods[Lod].Entries[i].NumIndices;
+	}
+	return NumIndices / 3;
+}
+
+const Vector3f& Mesh::getPosition(unsigned int VertexIndex) const
+{
+	return *(const Vector3f*)(m_pVertexData + VertexIndex * m_VertexSize);
+}
+
+unsigned int Mesh::getIndex(unsigned int Index) const
+{
+	if(m_IndexSize == sizeof(unsigned short))
+	{
+		return ((const unsigned short*)m_pIndexData)[Index];
+	}
+
+	return ((const unsigned int*)m_pIndexData)[Index];
+}
+
+void Mesh::importMaterials(const aiScene* pScene, const std::string& Filename)
+{
+	std::string::size_type SlashIndex = Filename.find_last_of("/");
+	std::string Dir;
+
+	if(SlashIndex == std::string::npos)
+	{
+		Dir = ".";
+	}
+	else if(SlashIndex == 0)
+	{
+		Dir = "/";
+	}
+	else
+	{
+		Dir = Filename.substr(0, SlashIndex);
+	}
+
+	m_TexturePaths.resize(pScene->mNumMaterials);
+
+	for(unsigned int i = 0; i < pScene->mNumMaterials; i++)
+	{
+		const aiMaterial* pMaterial = pScene->mMaterials[i];
+
+		// Materials without a diffuse map are drawn with a plain white texture
+		m_TexturePaths[i] = "./white.png";
+		//std::cerr << pMaterial->GetTextureCount(aiTextureType_EMISSIVE) << std::endl;
+		if(pMaterial->GetTextureCount(aiTextureType_DIFFUSE) > 0)
+		{
+			aiString Path;
+
+			if(pMaterial->GetTexture(aiTextureType_DIFFUSE, 0, &Path,
+			   NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS)
+			{
+				m_TexturePaths[i] = Dir + "/" + Path.data;
+			}
+		}
+	}
+}
+
+void Mesh::importAnimation(const aiScene* pScene, AnimationClip& Clip)
+{
+	const aiAnimation* pAnimation = pScene->mAnimations[0];
+
+	// In Assimp, if it cannot extract the ticks per second from the given
+	// file then it sets the animations ticks-per-second to 0, so we just
+	// check for this and set it to 25.0f. In Blender, ticksPerSecond usually
+	// gets set to 1, so this shouldn't be a problem
+	Clip.TicksPerSecond = pAnimation->mTicksPerSecond != 0 ?
+						  pAnimation->mTicksPerSecond : 25.0f;
+	Clip.Duration = pAnimation->mDuration;
+
+	Clip.Channels.resize(pAnimation->mNumChannels);
+	for(unsigned int i = 0; i < pAnimation->mNumChannels; i++)
+	{
+		const aiNodeAnim* pNodeAnim = pAnimation->mChannels[i];
+		ChannelInfo& Channel = Clip.Channels[i];
+
+		copyName(Channel.NodeName, pNodeAnim->mNodeName.data, sizeof(Channel.NodeName));
+		Channel.FirstPositionKey = Clip.PositionKeys.size();
+		Channel.NumPositionKeys = pNodeAnim->mNumPositionKeys;
+		Channel.FirstRotationKey = Clip.RotationKeys.size();
+		Channel.NumRotationKeys = pNodeAnim->mNumRotationKeys;
+		Channel.FirstScalingKey = Clip.ScalingKeys.size();
+		Channel.NumScalingKeys = pNodeAnim->mNumScalingKeys;
+
+		Clip.PositionKeys.insert(Clip.PositionKeys.end(), pNodeAnim->mPositionKeys,
+								 pNodeAnim->mPositionKeys + pNodeAnim->mNumPositionKeys);
+		Clip.RotationKeys.insert(Clip.RotationKeys.end(), pNodeAnim->mRotationKeys,
+								 pNodeAnim->mRotationKeys + pNodeAnim->mNumRotationKeys);
+		Clip.ScalingKeys.insert(Clip.ScalingKeys.end(), pNodeAnim->mScalingKeys,
+								pNodeAnim->mScalingKeys + pNodeAnim->mNumScalingKeys);
+	}
+
+	compressClip(Clip);
+}
+
+void Mesh::compressClip(AnimationClip& Clip)
+{
+	float TimeScale = Clip.Duration > 0.0f ? PACKED_TIME_MAX / Clip.Duration : 0.0f;
+
+	Clip.Tracks.resize(Clip.Channels.size() * 3);
+	Clip.PackedKeys.clear();
+
+	std::vector<unsigned int> Kept;
+	for(unsigned int i = 0; i < Clip.Channels.size(); i++)
+	{
+		const ChannelInfo& Channel = Clip.Channels[i];
+		PackedTrack* pTracks = &Clip.Tracks[i * 3];
+
+		const aiVectorKey* pPositionKeys = Channel.NumPositionKeys > 0 ? &Clip.PositionKeys[Channel.FirstPositionKey] : NULL;
+		reduceVectorKeys(pPositionKeys, Channel.NumPositionKeys, s_clip_tolerance.Position, Kept);
+		packVectorTrack(pPositionKeys, Kept, TimeScale, pTracks[0], Clip.PackedKeys);
+
+		const aiQuatKey* pRotationKeys = Channel.NumRotationKeys > 0 ? &Clip.RotationKeys[Channel.FirstRotationKey] : NULL;
+		reduceRotationKeys(pRotationKeys, Channel.NumRotationKeys, s_clip_tolerance.Rotation, Kept);
+		packRotationTrack(pRotationKeys, Kept, TimeScale, pTracks[1], Clip.PackedKeys);
+
+		const aiVectorKey* pScalingKeys = Channel.NumScalingKeys > 0 ? &Clip.ScalingKeys[Channel.FirstScalingKey] : NULL;
+		reduceVectorKeys(pScalingKeys, Channel.NumScalingKeys, s_clip_tolerance.Scaling, Kept);
+		packVectorTrack(pScalingKeys, Kept, TimeScale, pTracks[2], Clip.PackedKeys);
+	}
+}
+
+void Mesh::releaseSourceKeys()
+{
+	for(unsigned int i = 0; i < m_Clips.size(); i++)
+	{
+		std::vector<aiVectorKey>().swap(m_Clips[i].PositionKeys);
+		std::vector<aiQuatKey>().swap(m_Clips[i].RotationKeys);
+		std::vector<aiVectorKey>().swap(m_Clips[i].ScalingKeys);
+	}
+}
+
+// Copies the node and its subtree into m_Nodes in depth first order, the
+// root always ends up at index 0
+unsigned int Mesh::importNode(const aiNode* pNode)
+{
+	unsigned int NodeIndex = m_Nodes.size();
+	m_Nodes.push_back(NodeInfo());
+	copyName(m_Nodes[NodeIndex].Name, pNode->mName.data, sizeof(m_Nodes[NodeIndex].Name));
+	m_Nodes[NodeIndex].Transformation = pNode->mTransformation;
+
+	std::vector<unsigned int> Children;
+	for(unsigned int i = 0; i < pNode->mNumChildren; i++)
+	{
+		Children.push_back(importNode(pNode->mChildren[i]));
+	}
+
+	m_Nodes[NodeIndex].FirstChild = m_NodeChildren.size();
+	m_Nodes[NodeIndex].NumChildren = Children.size();
+	m_NodeChildren.insert(m_NodeChildren.end(), Children.begin(), Children.end());
+
+	return NodeIndex;
+}
+
+bool Mesh::saveCooked(const std::string& CookedFilename)
+{
+	FILE* File = fopen(CookedFilename.c_str(), "wb");
+	if(!File)
+	{
+		printf("Error opening '%s' for writing\n", CookedFilename.c_str());
+		return false;
+	}
+
+	// Only the first clip is cooked, the others come from their own files
+	AnimationClip NoClip;
+	const AnimationClip& Clip = m_Clips.empty() ? NoClip : m_Clips[0];
+
+	CookedMeshHeader Header = CookedMeshHeader();
+	memcpy(Header.Magic, "CMSH", 4);
+	Header.Version = COOKED_MESH_VERSION;
+	Header.VertexFormat = m_VertexFormat;
+	Header.IndexSize = m_IndexSize;
+	Header.NumVertices = m_PackedVertices.size() / m_VertexSize;
+	Header.NumIndices = m_PackedIndices.size() / m_IndexSize;
+	Header.NumEntries = m_Entries.size();
+	Header.NumMaterials = m_TexturePaths.size();
+	Header.NumBones = m_NumBones;
+	Header.NumNodes = m_Nodes.size();
+	Header.NumNodeChildren = m_NodeChildren.size();
+	Header.NumChannels = Clip.Channels.size();
+	Header.NumPositionKeys = Clip.PositionKeys.size();
+	Header.NumRotationKeys = Clip.RotationKeys.size();
+	Header.NumScalingKeys = Clip.ScalingKeys.size();
+	Header.NumTracks = Clip.Tracks.size();
+	Header.NumPackedKeys = Clip.PackedKeys.size();
+	Header.NumLods = m_Lods.size();
+	Header.NumLodVertices = m_LodVertices.size() / m_VertexSize;
+	Header.NumLodIndices = m_LodIndices.size() / m_IndexSize;
+	Header.Duration = Clip.Duration;
+	Header.TicksPerSecond = Clip.TicksPerSecond;
+	Header.GlobalInverseTransform = m_GlobalInverseTransform;
+
+	std::vector<CookedMaterial> Materials(m_TexturePaths.size());
+	for(unsigned int i = 0; i < m_TexturePaths.size(); i++)
+	{
+		copyName(Materials[i].Path, m_TexturePaths[i].c_str(), sizeof(Materials[i].Path));
+	}
+
+	std::vector<CookedBone> Bones(m_NumBones);
+	for(std::map<std::string, unsigned int>::iterator it = m_BoneMapping.begin();
+		it != m_BoneMapping.end();
+		it++)
+	{
+		copyName(Bones[it->second].Name, it->first.c_str(), sizeof(Bones[it->second].Name));
+		Bones[it->second].BoneOffset = m_BoneInfo[it->second].BoneOffset;
+	}
+
+	std::vector<CookedLod> Lods(m_Lods.size());
+	std::vector<MeshEntry> LodEntries;
+	std::vector<unsigned int> LodBones;
+	for(unsigned int i = 0; i < m_Lods.size(); i++)
+	{
+		const MeshLod& Lod = m_Lods[i];
+		Lods[i].FirstVertex = Lod.FirstVertex;
+		Lods[i].NumVertices = Lod.NumVertices;
+		Lods[i].FirstEntry = LodEntries.size();
+		Lods[i].NumEntries = Lod.Entries.size();
+		Lods[i].FirstBone = LodBones.size();
+		Lods[i].NumBones = Lod.Bones.size();
+		Lods[i].MinScreenSize = Lod.MinScreenSize;
+		LodEntries.insert(LodEntries.end(), Lod.Entries.begin(), Lod.Entries.end());
+		LodBones.insert(LodBones.end(), Lod.Bones.begin(), Lod.Bones.end());
+	}
+	Header.NumLodEntries = LodEntries.size();
+	Header.NumLodBones = LodBones.size();
+
+	fwrite(&Header, sizeof(Header), 1, File);
+	writeSection(File, m_PackedVertices.empty() ? NULL : &m_PackedVertices[0], m_PackedVertices.size());
+	writeSection(File, m_PackedIndices.empty() ? NULL : &m_PackedIndices[0], m_PackedIndices.size());
+	writeSection(File, m_Entries.empty() ? NULL : &m_Entries[0], m_Entries.size());
+	writeSection(File, Materials.empty() ? NULL : &Materials[0], Materials.size());
+	writeSection(File, Bones.empty() ? NULL : &Bones[0], Bones.size());
+	writeSection(File, m_Nodes.empty() ? NULL : &m_Nodes[0], m_Nodes.size());
+	writeSection(File, m_NodeChildren.empty() ? NULL : &m_NodeChildren[0], m_NodeChildren.size());
+	writeSection(File, Clip.Channels.empty() ? NULL : &Clip.Channels[0], Clip.Channels.size());
+	writeSection(File, Clip.PositionKeys.empty() ? NULL : &Clip.PositionKeys[0], Clip.PositionKeys.size());
+	writeSection(File, Clip.RotationKeys.empty() ? NULL : &Clip.RotationKeys[0], Clip.RotationKeys.size());
+	writeSection(File, Clip.ScalingKeys.empty() ? NULL : &Clip.ScalingKeys[0], Clip.ScalingKeys.size());
+	writeSection(File, Clip.Tracks.empty() ? NULL : &Clip.Tracks[0], Clip.Tracks.size());
+	writeSection(File, Clip.PackedKeys.empty() ? NULL : &Clip.PackedKeys[0], Clip.PackedKeys.size());
+	writeSection(File, m_LodVertices.empty() ? NULL : &m_LodVertices[0], m_LodVertices.size());
+	writeSection(File, m_LodIndices.empty() ? NULL : &m_LodIndices[0], m_LodIndices.size());
+	writeSection(File, Lods.empty() ? NULL : &Lods[0], Lods.size());
+	writeSection(File, LodEntries.empty() ? NULL : &LodEntries[0], LodEntries.size());
+	writeSection(File, LodBones.empty() ? NULL : &LodBones[0], LodBones.size());
+
+	bool Ret = !ferror(File);
+	fclose(File);
+
+	return Ret;
+}
+
+bool Mesh::loadCooked(const std::string& CookedFilename, bool AnimationOnly)
+{
+	// A clip only needs a few small sections, so it gets its own short lived
+	// mapping and the geometry pages are never touched
+	MappedFile ClipFile;
+	MappedFile& File = AnimationOnly ? ClipFile : m_CookedFile;
+	if(!File.open(CookedFilename))
+	{
+		return false;
+	}
+
+	Trace::addBytesRead(File.size());
+
+	const char* pBase = File.data();
+	if(File.size() < sizeof(CookedMeshHeader))
+	{
+		File.close();
+		return false;
+	}
+
+	const CookedMeshHeader* pHeader = (const CookedMeshHeader*)pBase;
+	if(memcmp(pHeader->Magic, "CMSH", 4) != 0 || pHeader->Version != COOKED_MESH_VERSION ||
+	   pHeader->VertexFormat > SKINNED_VERTEX ||
+	   (pHeader->IndexSize != sizeof(unsigned short) && pHeader->IndexSize != sizeof(unsigned int)))
+	{
+		printf("Ignoring '%s', it was cooked with a different version\n", CookedFilename.c_str());
+		File.close();
+		return false;
+	}
+
+	unsigned int VertexSize = pHeader->VertexFormat == SKINNED_VERTEX ? sizeof(SkinnedVertex) : sizeof(StaticVertex);
+	size_t FileSize = File.size();
+	size_t Offset = sizeof(CookedMeshHeader);
+	const unsigned char* pVertices = readSection<unsigned char>(pBase, FileSize, Offset, pHeader->NumVertices,
+																 VertexSize);
+	const unsigned char* pIndices = readSection<unsigned char>(pBase, FileSize, Offset, pHeader->NumIndices,
+																pHeader->IndexSize);
+	const MeshEntry* pEntries = readSection<MeshEntry>(pBase, FileSize, Offset, pHeader->NumEntries);
+	const CookedMaterial* pMaterials = readSection<CookedMaterial>(pBase, FileSize, Offset, pHeader->NumMaterials);
+	const CookedBone* pBones = readSection<CookedBone>(pBase, FileSize, Offset, pHeader->NumBones);
+	const NodeInfo* pNodes = readSection<NodeInfo>(pBase, FileSize, Offset, pHeader->NumNodes);
+	const unsigned int* pNodeChildren = readSection<unsigned int>(pBase, FileSize, Offset, pHeader->NumNodeChildren);
+	const ChannelInfo* pChannels = readSection<ChannelInfo>(pBase, FileSize, Offset, pHeader->NumChannels);
+	const aiVectorKey* pPositionKeys = readSection<aiVectorKey>(pBase, FileSize, Offset, pHeader->NumPositionKeys);
+	const aiQuatKey* pRotationKeys = readSection<aiQuatKey>(pBase, FileSize, Offset, pHeader->NumRotationKeys);
+	const aiVectorKey* pScalingKeys = readSection<aiVectorKey>(pBase, FileSize, Offset, pHeader->NumScalingKeys);
+	const PackedTrack* pTracks = readSection<PackedTrack>(pBase, FileSize, Offset, pHeader->NumTracks);
+	const PackedKey* pPackedKeys = readSection<PackedKey>(pBase, FileSize, Offset, pHeader->NumPackedKeys);
+	const unsigned char* pLodVertices = readSection<unsigned char>(pBase, FileSize, Offset, pHeader->NumLodVertices,
+																   VertexSize);
+	const unsigned char* pLodIndices = readSection<unsigned char>(pBase, FileSize, Offset, pHeader->NumLodIndices,
+																  pHeader->IndexSize);
+	const CookedLod* pLods = readSection<CookedLod>(pBase, FileSize, Offset, pHeader->NumLods);
+	const MeshEntry* pLodEntries = readSection<MeshEntry>(pBase, FileSize, Offset, pHeader->NumLodEntries);
+	const unsigned int* pLodBones = readSection<unsigned int>(pBase, FileSize, Offset, pHeader->NumLodBones);
+
+	if(Offset > FileSize)
+	{
+		printf("Cooked mesh '%s' is truncated\n", CookedFilename.c_str());
+		File.close();
+		return false;
+	}
+
+	// Every mesh has at least its full LOD, and each LOD's ranges have to
+	// stay inside the sections. The sums are taken in 64 bits so they cannot
+	// wrap.
+	bool LodsValid = pHeader->NumLods > 0;
+	for(unsigned int i = 0; LodsValid && i < pHeader->NumLods; i++)
+	{
+		const CookedLod& Lod = pLods[i];
+		LodsValid = (unsigned long long)Lod.FirstEntry + Lod.NumEntries <= pHeader->NumLodEntries &&
+					(unsigned long long)Lod.FirstBone + Lod.NumBones <= pHeader->NumLodBones &&
+					(unsigned long long)Lod.FirstVertex + Lod.NumVertices <=
+					(unsigned long long)pHeader->NumVertices + pHeader->NumLodVertices;
+	}
+	if(!LodsValid)
+	{
+		printf("Cooked mesh '%s' has corrupt LODs\n", CookedFilename.c_str());
+		File.close();
+		return false;
+	}
+
+	if(pHeader->NumChannels > 0)
+	{
+		m_Clips.push_back(AnimationClip());
+		AnimationClip& Clip = m_Clips.back();
+		Clip.Duration = pHeader->Duration;
+		Clip.TicksPerSecond = pHeader->TicksPerSecond;
+		Clip.Channels.assign(pChannels, pChannels + pHeader->NumChannels);
+		Clip.Tracks.assign(pTracks, pTracks + pHeader->NumTracks);
+		Clip.PackedKeys.assign(pPackedKeys, pPackedKeys + pHeader->NumPackedKeys);
+		// Their pages are never touched unless they are copied here
+		if(s_keep_source_keys)
+		{
+			Clip.PositionKeys.assign(pPositionKeys, pPositionKeys + pHeader->NumPositionKeys);
+			Clip.RotationKeys.assign(pRotationKeys, pRotationKeys + pHeader->NumRotationKeys);
+			Clip.ScalingKeys.assign(pScalingKeys, pScalingKeys + pHeader->NumScalingKeys);
+		}
+	}
+
+	if(AnimationOnly)
+	{
+		return pHeader->NumChannels > 0;
+	}
+
+	m_GlobalInverseTransform = pHeader->GlobalInverseTransform;
+	m_VertexFormat = pHeader->VertexFormat;
+	m_VertexSize = VertexSize;
+	m_IndexSize = pHeader->IndexSize;
+	m_Entries.assign(pEntries, pEntries + pHeader->NumEntries);
+	m_Nodes.assign(pNodes, pNodes + pHeader->NumNodes);
+	m_NodeChildren.assign(pNodeChildren, pNodeChildren + pHeader->NumNodeChildren);
 
-void Mesh::clear()
-{
-	for(unsigned int i = 0; i < m_Textures.size(); i++)
-	{	
-		SAFE_DELETE(m_Textures[i]);
+	m_TexturePaths.resize(pHeader->NumMaterials);
+	for(unsigned int i = 0; i < pHeader->NumMaterials; i++)
+	{
+		m_TexturePaths[i] = pMaterials[i].Path;
 	}
 
-	if(m_Buffers[0] != 0)
+	m_NumBones = pHeader->NumBones;
+	m_BoneInfo.resize(m_NumBones);
+	for(unsigned int i = 0; i < m_NumBones; i++)
 	{
-		glDeleteBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
+		m_BoneInfo[i].BoneOffset = pBones[i].BoneOffset;
+		m_BoneMapping[pBones[i].Name] = i;
 	}
 
-	if(m_VAO != 0)
+	// The vertex and index streams go straight from the mapping to the GPU
+	// in uploadMesh, which also unmaps the file
+	m_pVertexData = pVertices;
+	m_NumVertexData = pHeader->NumVertices;
+	m_pIndexData = pIndices;
+	m_NumIndexData = pHeader->NumIndices;
+	m_pLodVertexData = pLodVertices;
+	m_NumLodVertexData = pHeader->NumLodVertices;
+	m_pLodIndexData = pLodIndices;
+	m_NumLodIndexData = pHeader->NumLodIndices;
+
+	m_Lods.resize(pHeader->NumLods);
+	for(unsigned int i = 0; i < pHeader->NumLods; i++)
 	{
-		glDeleteVertexArrays(1, &m_VAO);
-		m_VAO = 0;
+		const CookedLod& Cooked = pLods[i];
+		MeshLod& Lod = m_Lods[i];
+		Lod.FirstVertex = Cooked.FirstVertex;
+		Lod.NumVertices = Cooked.NumVertices;
+		Lod.Entries.assign(pLodEntries + Cooked.FirstEntry, pLodEntries + Cooked.FirstEntry + Cooked.NumEntries);
+		Lod.Bones.assign(pLodBones + Cooked.FirstBone, pLodBones + Cooked.FirstBone + Cooked.NumBones);
+		Lod.MinScreenSize = Cooked.MinScreenSize;
 	}
+
+	return true;
 }
 
-bool Mesh::loadMesh(const std::string& Filename)
+bool Mesh::initBuffers()
 {
-	clear();
-
 	// Create our VAO and the generate the buffers for the vertex attributes
 	glGenVertexArrays(1, &m_VAO);
 	glBindVertexArray(m_VAO);
 	glGenBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
-
-	bool Ret = false;
-
-	m_pScene = m_Importer.ReadFile(Filename.c_str(),
-			aiProcess_Triangulate | aiProcess_GenSmoothNormals | 
-			aiProcess_FlipUVs);
-
-	if(m_pScene)
+	m_NumVertices = m_NumVertexData;
+	unsigned int VertexBytes = m_VertexSize * m_NumVertexData;
+	unsigned int IndexBytes = m_IndexSize * m_NumIndexData;
+	unsigned int LodVertexBytes = m_VertexSize * m_NumLodVertexData;
+	unsigned int LodIndexBytes = m_IndexSize * m_NumLodIndexData;
+	Trace::addBytesUploaded(VertexBytes + IndexBytes + LodVertexBytes + LodIndexBytes);
+
+	// The LODs go after the full mesh in the same buffers
+	glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[VERTEX_BUFFER]);
+	glBufferData(GL_ARRAY_BUFFER, VertexBytes + LodVertexBytes, NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, VertexBytes, m_pVertexData);
+	if(LodVertexBytes > 0)
 	{
-		m_GlobalInverseTransform = m_pScene->mRootNode->mTransformation;
-		m_GlobalInverseTransform.Inverse();
-		Ret = initScene(m_pScene, Filename);
+		glBufferSubData(GL_ARRAY_BUFFER, VertexBytes, LodVertexBytes, m_pLodVertexData);
 	}
-	else
+
+	setVertexAttributes();
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[INDEX_BUFFER]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, IndexBytes + LodIndexBytes, NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, IndexBytes, m_pIndexData);
+	if(LodIndexBytes > 0)
 	{
-		printf("Error parsing '%s': '%s'\n", Filename.c_str(),
-			   m_Importer.GetErrorString());
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, IndexBytes, LodIndexBytes, m_pLodIndexData);
 	}
 
 	// Just to be safe, unbind the VAO
 	glBindVertexArray(0);
 
-	return Ret;
+	return GLCheckError();
 }
 
-bool Mesh::initScene(const aiScene* pScene, const std::string& Filename)
+void Mesh::setVertexAttributes()
 {
-	m_Entries.resize(pScene->mNumMeshes);
-	m_Textures.resize(pScene->mNumMaterials);
-
-	// Our vertex attribute arrays
-	std::vector<Vector3f> Positions;
-	std::vector<Vector3f> Normals;
-	std::vector<Vector2f> TexCoords;
-	std::vector<unsigned int> Indices;
-	std::vector<VertexBoneData> Bones;
+	glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[VERTEX_BUFFER]);
 
-	unsigned int NumVertices = 0;
-	unsigned int NumIndices = 0;
-
-	for(unsigned int i = 0; i < m_Entries.size(); i++)
+	// The attributes both formats share sit at the same offsets
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, m_VertexSize, 
+						  (const GLvoid*)offsetof(StaticVertex, Position));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, m_VertexSize, 
+						  (const GLvoid*)offsetof(StaticVertex, TexCoord));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, m_VertexSize, 
+						  (const GLvoid*)offsetof(StaticVertex, Normal));
+	if(m_VertexFormat == SKINNED_VERTEX)
 	{
-		m_Entries[i].MaterialIndex = pScene->mMeshes[i]->mMaterialIndex;
-		m_Entries[i].NumIndices = pScene->mMeshes[i]->mNumFaces * 3;
-		m_Entries[i].BaseVertex = NumVertices;
-		m_Entries[i].BaseIndex = NumIndices;
-
-		NumVertices += m_pScene->mMeshes[i]->mNumVertices;
-		NumIndices += m_Entries[i].NumIndices;
+		// Bone IDs
+		glEnableVertexAttribArray(3);
+		glVertexAttribIPointer(3, 4, GL_UNSIGNED_BYTE, m_VertexSize, 
+							   (const GLvoid*)offsetof(SkinnedVertex, BoneIDs));
+		// Bone weights
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, m_VertexSize, 
+							  (const GLvoid*)offsetof(SkinnedVertex, BoneWeights));
 	}
+}
 
-	Positions.reserve(NumVertices);
-	Normals.reserve(NumVertices);
-	TexCoords.reserve(NumVertices);
-	Indices.reserve(NumIndices);
-	Bones.resize(NumVertices);
+void Mesh::prepareMaterials()
+{
+	m_Textures.resize(m_TexturePaths.size());
 
-	for(unsigned int i = 0; i < m_Entries.size(); i++)
+	for(unsigned int i = 0; i < m_TexturePaths.size(); i++)
 	{
-		const aiMesh* paiMesh = m_pScene->mMeshes[i];
-		initMesh(i, paiMesh, Positions, Normals, TexCoords, Bones, Indices);
-	}
+		m_Textures[i] = TextureCache::Acquire(m_TexturePaths[i]);
 
-	if(!initMaterials(m_pScene, Filename))
-	{
-		return false;
+		if(!m_Textures[i]->Decode())
+		{
+			printf("Error loading texture '%s'\n", m_TexturePaths[i].c_str());
+			TextureCache::Release(m_Textures[i]);
+			m_Textures[i] = TextureCache::Acquire("./white.png");
+			m_Textures[i]->Decode();
+		}
 	}
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[1]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Positions[0]) * Positions.size(), &Positions[0], GL_STATIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-	glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[3]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(TexCoords[0]) * TexCoords.size(), &TexCoords[0], GL_STATIC_DRAW);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-	glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[2]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Normals[0]) * Normals.size(), &Normals[0], GL_STATIC_DRAW);
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-	glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[4]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Bones[0]) * Bones.size(), &Bones[0], GL_STATIC_DRAW);
-	// Bone IDs
-	glEnableVertexAttribArray(3);
-	glVertexAttribIPointer(3, 4, GL_INT, sizeof(VertexBoneData), (const GLvoid*)0);
-	// Bone weights
-	glEnableVertexAttribArray(4);
-	glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(VertexBoneData), (const GLvoid*)16);
+bool Mesh::initMaterials()
+{
+	bool Ret = true;
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[0]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Indices[0]) * Indices.size(), 
-				 &Indices[0], GL_STATIC_DRAW);
+	for(unsigned int i = 0; i < m_Textures.size(); i++)
+	{
+		Ret = m_Textures[i]->Upload() && Ret;
+	}
 
-	return true;
+	return Ret;
 }
 
-void Mesh::initMesh(unsigned int MeshIndex, const aiMesh* paiMesh, std::vector<Vector3f>& Positions,
-					std::vector<Vector3f>& Normals, std::vector<Vector2f>& TexCoords,
-					std::vector<VertexBoneData>& Bones, std::vector<unsigned int>& Indices)
+void Mesh::render()
 {
-	const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
+	glBindVertexArray(m_VAO);
 
-	for(unsigned int i = 0; i < paiMesh->mNumVertices; i++)
+	for(unsigned int i = 0; i < m_Entries.size(); i++)
 	{
-		const aiVector3D* pPos = &(paiMesh->mVertices[i]);
-		const aiVector3D* pNormal = &(paiMesh->mNormals[i]);
-		const aiVector3D* pTexCoord = paiMesh->HasTextureCoords(0) ?
-			&(paiMesh->mTextureCoords[0][i]) : &Zero3D;
-
-		Positions.push_back(Vector3f(pPos->x, pPos->y, pPos->z));
-		Normals.push_back(Vector3f(pNormal->x, pNormal->y, pNormal->z));
-		TexCoords.push_back(Vector2f(pTexCoord->x, pTexCoord->y));
-	}
+		unsigned int MaterialIndex = m_Entries[i].MaterialIndex;
+		assert(MaterialIndex < m_Textures.size());
 
-	loadBones(MeshIndex, paiMesh, Bones);
+		if(m_Textures[MaterialIndex])
+		{
+			m_Textures[MaterialIndex]->Bind(GL_TEXTURE0);
+		}
 
-	for(unsigned int i = 0; i < paiMesh->mNumFaces; i++)
-	{
-		const aiFace& Face = paiMesh->mFaces[i];
-		assert(Face.mNumIndices == 3);
-		Indices.push_back(Face.mIndices[0]);
-		Indices.push_back(Face.mIndices[1]);
-		Indices.push_back(Face.mIndices[2]);
+		glDrawElementsBaseVertex(GL_TRIANGLES, m_Entries[i].NumIndices,
+								 m_IndexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+								 (void*)((size_t)m_IndexSize * m_Entries[i].BaseIndex), 
+								 m_Entries[i].BaseVertex);
 	}
+
+	glBindVertexArray(0);
 }
 
-bool Mesh::initMaterials(const aiScene* pScene, const std::string& Filename)
+void Mesh::skin(GLuint Buffer, unsigned int BaseVertex, unsigned int Lod)
 {
-	std::string::size_type SlashIndex = Filename.find_last_of("/");
-	std::string Dir;
+	// The entries' vertices are contiguous, so one draw covers all of them
+	const MeshLod& Skinned = m_Lods[Lod];
+	glBindVertexArray(m_VAO);
+	glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, Buffer,
+					  BaseVertex * sizeof(SkinnedOutputVertex),
+					  Skinned.NumVertices * sizeof(SkinnedOutputVertex));
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, Skinned.FirstVertex, Skinned.NumVertices);
+	glEndTransformFeedback();
+	glBindVertexArray(0);
+}
 
-	if(SlashIndex == std::string::npos)
-	{
-		Dir = ".";
-	}
-	else if(SlashIndex == 0)
+void Mesh::renderSkinned(GLuint Buffer, unsigned int BaseVertex, unsigned int Lod)
+{
+	if(m_SkinnedVAO == 0)
 	{
-		Dir = "/";
+		glGenVertexArrays(1, &m_SkinnedVAO);
 	}
-	else
+
+	glBindVertexArray(m_SkinnedVAO);
+
+	// The attribute pointers name the buffer, not its storage, so they only
+	// need setting up again if the buffer itself changes
+	if(m_SkinnedBuffer != Buffer)
 	{
-		Dir = Filename.substr(0, SlashIndex);
+		m_SkinnedBuffer = Buffer;
+		glBindBuffer(GL_ARRAY_BUFFER, Buffer);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedOutputVertex),
+							  (const GLvoid*)offsetof(SkinnedOutputVertex, Position));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(SkinnedOutputVertex),
+							  (const GLvoid*)offsetof(SkinnedOutputVertex, TexCoord));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedOutputVertex),
+							  (const GLvoid*)offsetof(SkinnedOutputVertex, Normal));
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[INDEX_BUFFER]);
 	}
 
-	bool Ret = true;
-
-	for(unsigned int i = 0; i < pScene->mNumMaterials; i++)
+	// skin wrote the LOD's vertices from BaseVertex on
+	const MeshLod& Drawn = m_Lods[Lod];
+	for(unsigned int i = 0; i < Drawn.Entries.size(); i++)
 	{
-		const aiMaterial* pMaterial = pScene->mMaterials[i];
+		const MeshEntry& Entry = Drawn.Entries[i];
+		unsigned int MaterialIndex = Entry.MaterialIndex;
+		assert(MaterialIndex < m_Textures.size());
 
-		m_Textures[i] = NULL;
-		//std::cerr << pMaterial->GetTextureCount(aiTextureType_EMISSIVE) << std::endl;
-		if(pMaterial->GetTextureCount(aiTextureType_DIFFUSE) > 0)
+		if(m_Textures[MaterialIndex])
 		{
-			aiString Path;
-
-			if(pMaterial->GetTexture(aiTextureType_DIFFUSE, 0, &Path,
-			   NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS)
-			{
-				std::string FullPath = Dir + "/" + Path.data;
-				m_Textures[i] = new Texture(GL_TEXTURE_2D, FullPath.c_str());
-
-				if(!m_Textures[i]->Load())
-				{
-					printf("Error loading texture '%s'\n", FullPath.c_str());
-					delete m_Textures[i];
-					m_Textures[i] = NULL;
-					Ret = false;
-				}
-			}
+			m_Textures[MaterialIndex]->Bind(GL_TEXTURE0);
 		}
 
-		if(!m_Textures[i])
-		{
-			m_Textures[i] = new Texture(GL_TEXTURE_2D, "./white.png");
-
-			Ret = m_Textures[i]->Load();
-		}
+		glDrawElementsBaseVertex(GL_TRIANGLES, Entry.NumIndices,
+								 m_IndexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+								 (void*)((size_t)m_IndexSize * Entry.BaseIndex), 
+								 BaseVertex + Entry.BaseVertex - Drawn.FirstVertex);
 	}
 
-	return Ret;
+	glBindVertexArray(0);
 }
 
-void Mesh::render()
+void Mesh::renderInstances(GLuint InstanceBuffer, unsigned int NumInstances, unsigned int Lod,
+						   unsigned int FirstInstance)
 {
-	glBindVertexArray(m_VAO);
+	if(m_InstancedVAO == 0)
+	{
+		glGenVertexArrays(1, &m_InstancedVAO);
+		glBindVertexArray(m_InstancedVAO);
+		setVertexAttributes();
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[INDEX_BUFFER]);
+	}
 
-	for(unsigned int i = 0; i < m_Entries.size(); i++)
+	glBindVertexArray(m_InstancedVAO);
+
+	// Without base instance draws, the attributes start at FirstInstance
+	// instead
+	if(m_InstanceBuffer != InstanceBuffer || m_FirstInstance != FirstInstance)
 	{
-		unsigned int MaterialIndex = m_Entries[i].MaterialIndex;
+		m_InstanceBuffer = InstanceBuffer;
+		m_FirstInstance = FirstInstance;
+		size_t Base = FirstInstance * sizeof(CrowdInstance);
+		glBindBuffer(GL_ARRAY_BUFFER, InstanceBuffer);
+		// Three rows of the model matrix, then the clip
+		for(unsigned int i = 0; i < 3; i++)
+		{
+			glEnableVertexAttribArray(5 + i);
+			glVertexAttribPointer(5 + i, 4, GL_FLOAT, GL_FALSE, sizeof(CrowdInstance),
+								  (const GLvoid*)(Base + offsetof(CrowdInstance, ModelRows) + i * 4 * sizeof(float)));
+			glVertexAttribDivisor(5 + i, 1);
+		}
+		glEnableVertexAttribArray(8);
+		glVertexAttribPointer(8, 4, GL_FLOAT, GL_FALSE, sizeof(CrowdInstance),
+							  (const GLvoid*)(Base + offsetof(CrowdInstance, FirstFrame)));
+		glVertexAttribDivisor(8, 1);
+	}
+
+	const std::vector<MeshEntry>& Entries = m_Lods[Lod].Entries;
+	for(unsigned int i = 0; i < Entries.size(); i++)
+	{
+		unsigned int MaterialIndex = Entries[i].MaterialIndex;
 		assert(MaterialIndex < m_Textures.size());
 
 		if(m_Textures[MaterialIndex])
@@ -242,15 +1705,16 @@ void Mesh::render()
 			m_Textures[MaterialIndex]->Bind(GL_TEXTURE0);
 		}
 
-		glDrawElementsBaseVertex(GL_TRIANGLES, m_Entries[i].NumIndices, GL_UNSIGNED_INT,
-								 (void*)(sizeof(unsigned int) * m_Entries[i].BaseIndex), 
-								 m_Entries[i].BaseVertex);
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, Entries[i].NumIndices,
+										  m_IndexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+										  (void*)((size_t)m_IndexSize * Entries[i].BaseIndex),
+										  NumInstances, Entries[i].BaseVertex);
 	}
 
 	glBindVertexArray(0);
 }
 
-void Mesh::loadBones(unsigned int MeshIndex, const aiMesh* pMesh, std::vector<VertexBoneData>& Bones)
+void Mesh::loadBones(unsigned int MeshIndex, const aiMesh* pMesh)
 {
 	for(unsigned int i = 0; i < pMesh->mNumBones; i++)
 	{
@@ -276,7 +1740,7 @@ void Mesh::loadBones(unsigned int MeshIndex, const aiMesh* pMesh, std::vector<Ve
 			unsigned int VertexID = m_Entries[MeshIndex].BaseVertex + 
 									pMesh->mBones[i]->mWeights[j].mVertexId;
 			float Weight = pMesh->mBones[i]->mWeights[j].mWeight;
-			Bones[VertexID].addBoneData(BoneIndex, Weight);
+			m_Vertices[VertexID].Bones.addBoneData(BoneIndex, Weight);
 		}
 	}
 }
@@ -296,136 +1760,399 @@ void Mesh::VertexBoneData::addBoneData(unsigned int BoneID, float Weight)
 	//assert(0);
 }
 
-void Mesh::boneTransform(float TimeInSeconds, std::vector<Matrix4f>& Transforms)
+void Mesh::bindSkeleton()
 {
-	Matrix4f Identity;
-	Identity.InitIdentity();
+	m_Skeleton.resize(m_Nodes.size());
+	m_GlobalTransforms.resize(m_Nodes.size());
+	m_BindPose.resize(m_Nodes.size());
 
-	// In Assimp, if it cannot extract the ticks per second from the given
-	// file then it sets the animations ticks-per-second to 0, so we just
-	// check for this and set it to 25.0f. In Blender, ticksPerSecond usually
-	// gets set to 1, so this shouldn't be a problem
-	float TicksPerSecond = m_pScene->mAnimations[0]->mTicksPerSecond != 0 ?
-						   m_pScene->mAnimations[0]->mTicksPerSecond : 25.0f;
-	float TimeInTicks = TimeInSeconds * TicksPerSecond;
-	float AnimationTime = fmod(TimeInTicks, m_pScene->mAnimations[0]->mDuration);
+	for(unsigned int i = 0; i < m_Nodes.size(); i++)
+	{
+		std::map<std::string, unsigned int>::const_iterator it = m_BoneMapping.find(m_Nodes[i].Name);
+		m_Skeleton[i].Bone = it != m_BoneMapping.end() ? (int)it->second : -1;
+		m_Skeleton[i].Parent = -1;
+
+		const float (*m)[4] = m_Nodes[i].Transformation.m;
+		aiMatrix4x4 Transformation(m[0][0], m[0][1], m[0][2], m[0][3], m[1][0], m[1][1], m[1][2], m[1][3],
+								   m[2][0], m[2][1], m[2][2], m[2][3], m[3][0], m[3][1], m[3][2], m[3][3]);
+		aiVector3D Scaling, Position;
+		aiQuaternion Rotation;
+		Transformation.Decompose(Scaling, Rotation, Position);
+		m_BindPose.setNode(i, Vector3f(Position.x, Position.y, Position.z),
+						   Quaternion(Rotation.x, Rotation.y, Rotation.z, Rotation.w),
+						   Vector3f(Scaling.x, Scaling.y, Scaling.z));
+	}
+
+	// importNode stores the nodes depth first, so every child comes after
+	// its parent
+	for(unsigned int i = 0; i < m_Nodes.size(); i++)
+	{
+		for(unsigned int j = 0; j < m_Nodes[i].NumChildren; j++)
+		{
+			unsigned int Child = m_NodeChildren[m_Nodes[i].FirstChild + j];
+			assert(Child > i);
+			m_Skeleton[Child].Parent = i;
+		}
+	}
+
+	foldMergedBoneBounds();
+
+	for(unsigned int i = 0; i < m_Clips.size(); i++)
+	{
+		bindClip(m_Clips[i]);
+	}
+}
+
+void Mesh::bindClip(AnimationClip& Clip)
+{
+	Clip.NodeChannels.assign(m_Nodes.size(), -1);
+	for(unsigned int i = 0; i < m_Nodes.size(); i++)
+	{
+		const ChannelInfo* pChannel = findNodeAnim(Clip, m_Nodes[i].Name);
+		if(pChannel)
+		{
+			Clip.NodeChannels[i] = pChannel - &Clip.Channels[0];
+		}
+	}
+
+	computeClipBounds(Clip);
+}
+
+void Mesh::computeClipBounds(AnimationClip& Clip)
+{
+	Clip.BoundsCenter = m_BoundsCenter;
+	Clip.BoundsRadius = m_BoundsRadius;
+	if(m_BoneBounds.empty())
+	{
+		return;
+	}
+
+	unsigned int ClipIndex = &Clip - &m_Clips[0];
+	float Duration = getClipDuration(ClipIndex);
+	unsigned int NumSamples = std::max(1u, (unsigned int)ceilf(Duration * CLIP_BOUNDS_SAMPLE_RATE));
+	unsigned int NumBones = m_BoneBounds.size();
+
+	std::vector<Vector3f> Centers(NumSamples * NumBones);
+	std::vector<float> Radii(NumSamples * NumBones);
+	std::vector<Matrix4f> Transforms;
+	std::vector<Matrix4f> Scratch;
+	bool IsDualQuaternion = m_SkinningMode == DUAL_QUATERNION_SKINNING;
+	float Bulge = 0.0f;
+
+	// The bones each link's vertices end up on at every LOD, three to a link
+	std::vector<unsigned int> LinkBones;
+	std::vector<unsigned int> Merged;
+	for(unsigned int Level = 0; IsDualQuaternion && Level < MAX_MESH_LODS; Level++)
+	{
+		mergeLeafBones(Level, Merged);
+		for(unsigned int i = 0; i < m_BoneLinks.size(); i++)
+		{
+			unsigned int First = Merged[m_BoneLinks[i].Bones[0]];
+			unsigned int Second = Merged[m_BoneLinks[i].Bones[1]];
+			if(First != Second)
+			{
+				LinkBones.push_back(First);
+				LinkBones.push_back(Second);
+				LinkBones.push_back(i);
+			}
+		}
+	}
+
+	for(unsigned int i = 0; i < NumSamples; i++)
+	{
+		boneTransform(i * Duration / NumSamples, Transforms, ClipIndex, Scratch);
+		if(IsDualQuaternion)
+		{
+			for(unsigned int j = 0; j < NumBones; j++)
+			{
+				Transforms[j] = rigidPart(Transforms[j]);
+			}
+		}
+		for(unsigned int j = 0; j < NumBones; j++)
+		{
+			const Matrix4f& m = Transforms[j];
+			float Scale = 0.0f;
+			for(unsigned int Column = 0; Column < 3; Column++)
+			{
+				Vector3f Axis(m.m[0][Column], m.m[1][Column], m.m[2][Column]);
+				Scale = std::max(Scale, Axis.Length());
+			}
+			Centers[i * NumBones + j] = transformPoint(m, m_BoneBounds[j].Center);
+			Radii[i * NumBones + j] = m_BoneBounds[j].Radius * Scale;
+		}
+
+		// Dual quaternion skinning blends the bones' rotations instead of
+		// the positions they move a vertex to. Between two bones turning
+		// about their joint the vertex follows the arc through those
+		// positions rather than the chord, which bulges out by at most half
+		// the chord's length. Vertices with more than two bones are taken a
+		// pair at a time, which is an estimate rather than a bound.
+		for(unsigned int j = 0; j < LinkBones.size(); j += 3)
+		{
+			const BoneLink& Link = m_BoneLinks[LinkBones[j + 2]];
+			Vector3f Chord = transformPoint(Transforms[LinkBones[j]], Link.Center) -
+							 transformPoint(Transforms[LinkBones[j + 1]], Link.Center);
+			Bulge = std::max(Bulge, Chord.Length() * 0.5f + Link.Radius);
+		}
+	}
+
+	// Poses between two samples are covered by growing the bounds by half
+	// the furthest any bone moves from one sample to the next. The clip
+	// loops, so the last sample leads back to the first.
+	bool Empty = true;
+	float Step = 0.0f;
+	Vector3f Min, Max;
+	for(unsigned int i = 0; i < NumSamples; i++)
+	{
+		for(unsigned int j = 0; j < NumBones; j++)
+		{
+			float Radius = Radii[i * NumBones + j];
+			if(Radius < 0.0f)
+			{
+				continue;
+			}
+			const Vector3f& Center = Centers[i * NumBones + j];
+			Step = std::max(Step, (Centers[((i + 1) % NumSamples) * NumBones + j] - Center).Length());
+			if(Empty)
+			{
+				Min = Center - Vector3f(Radius, Radius, Radius);
+				Max = Center + Vector3f(Radius, Radius, Radius);
+				Empty = false;
+			}
+			Min.x = std::min(Min.x, Center.x - Radius); Max.x = std::max(Max.x, Center.x + Radius);
+			Min.y = std::min(Min.y, Center.y - Radius); Max.y = std::max(Max.y, Center.y + Radius);
+			Min.z = std::min(Min.z, Center.z - Radius); Max.z = std::max(Max.z, Center.z + Radius);
+		}
+	}
+	if(Empty)
+	{
+		return;
+	}
+
+	Clip.BoundsCenter = Vector3f((Min.x + Max.x) * 0.5f, (Min.y + Max.y) * 0.5f, (Min.z + Max.z) * 0.5f);
+	Clip.BoundsRadius = 0.0f;
+	for(unsigned int i = 0; i < Centers.size(); i++)
+	{
+		if(Radii[i] >= 0.0f)
+		{
+			Clip.BoundsRadius = std::max(Clip.BoundsRadius, (Centers[i] - Clip.BoundsCenter).Length() + Radii[i]);
+		}
+	}
+	Clip.BoundsRadius += Step * 0.5f + Bulge;
+}
+
+const Vector3f& Mesh::getClipBoundsCenter(unsigned int ClipIndex) const
+{
+	return ClipIndex < m_Clips.size() ? m_Clips[ClipIndex].BoundsCenter : m_BoundsCenter;
+}
+
+float Mesh::getClipBoundsRadius(unsigned int ClipIndex) const
+{
+	return ClipIndex < m_Clips.size() ? m_Clips[ClipIndex].BoundsRadius : m_BoundsRadius;
+}
 
-	readNodeHierarchy(AnimationTime, m_pScene->mRootNode, Identity);
+float Mesh::getClipDuration(unsigned int ClipIndex) const
+{
+	if(ClipIndex >= m_Clips.size() || m_Clips[ClipIndex].TicksPerSecond <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	return m_Clips[ClipIndex].Duration / m_Clips[ClipIndex].TicksPerSecond;
+}
+
+void Mesh::boneTransform(float TimeInSeconds, std::vector<Matrix4f>& Transforms,
+						 unsigned int ClipIndex)
+{
+	boneTransform(TimeInSeconds, Transforms, ClipIndex, m_GlobalTransforms);
+}
 
+void Mesh::boneTransform(float TimeInSeconds, std::vector<Matrix4f>& Transforms,
+						 unsigned int ClipIndex, std::vector<Matrix4f>& Scratch) const
+{
 	Transforms.resize(m_NumBones);
+	Scratch.resize(m_Skeleton.size());
 
-	for(unsigned int i = 0; i < m_NumBones; i++)
+	if(m_Skeleton.empty() || ClipIndex >= m_Clips.size())
 	{
-		Transforms[i] = m_BoneInfo[i].FinalTransformation;
+		return;
+	}
+
+	const AnimationClip& Clip = m_Clips[ClipIndex];
+	float PackedTime = getPackedTime(Clip, TimeInSeconds);
+	const PackedKey* pStream = Clip.PackedKeys.empty() ? NULL : &Clip.PackedKeys[0];
+
+	for(unsigned int i = 0; i < m_Skeleton.size(); i++)
+	{
+		int ChannelIndex = Clip.NodeChannels[i];
+
+		Matrix4f Local;
+		if(ChannelIndex >= 0)
+		{
+			// Tracks without keys keep the bind value
+			const PackedTrack* pTracks = &Clip.Tracks[ChannelIndex * 3];
+			Vector3f Translation, Scaling;
+			Quaternion Rotation(0.0f, 0.0f, 0.0f, 1.0f);
+			m_BindPose.getNode(i, Translation, Rotation, Scaling);
+			ComposeTransform(samplePackedVector(pTracks[0], pStream, PackedTime, Translation),
+							 samplePackedRotation(pTracks[1], pStream, PackedTime, Rotation),
+							 samplePackedVector(pTracks[2], pStream, PackedTime, Scaling),
+							 Local);
+		}
+		else
+		{
+			Local = m_Nodes[i].Transformation;
+		}
+		poseNode(i, Local, Transforms, Scratch);
+	}
+}
+
+void Mesh::sampleLocalPose(float TimeInSeconds, unsigned int ClipIndex, LocalPose& Pose) const
+{
+	Pose = m_BindPose;
+	if(ClipIndex >= m_Clips.size())
+	{
+		return;
+	}
+
+	const AnimationClip& Clip = m_Clips[ClipIndex];
+	float PackedTime = getPackedTime(Clip, TimeInSeconds);
+	const PackedKey* pStream = Clip.PackedKeys.empty() ? NULL : &Clip.PackedKeys[0];
+
+	for(unsigned int i = 0; i < m_Skeleton.size(); i++)
+	{
+		int ChannelIndex = Clip.NodeChannels[i];
+		if(ChannelIndex >= 0)
+		{
+			const PackedTrack* pTracks = &Clip.Tracks[ChannelIndex * 3];
+			Vector3f Translation, Scaling;
+			Quaternion Rotation(0.0f, 0.0f, 0.0f, 1.0f);
+			m_BindPose.getNode(i, Translation, Rotation, Scaling);
+			Pose.setNode(i, samplePackedVector(pTracks[0], pStream, PackedTime, Translation),
+						 samplePackedRotation(pTracks[1], pStream, PackedTime, Rotation),
+						 samplePackedVector(pTracks[2], pStream, PackedTime, Scaling));
+			Pose.Animated[i] = 1;
+		}
 	}
 }
 
-/*void Mesh::AnimateNodes(float current_time, aiString animName)
+void Mesh::composePose(const LocalPose& Pose, std::vector<Matrix4f>& Transforms,
+					   std::vector<Matrix4f>& Scratch) const
 {
-	aiAnimation* animation = m_animations[0];
-	current_time = fmod(current_time, animation->mDuration);
+	Transforms.resize(m_NumBones);
+	Scratch.resize(m_Skeleton.size());
 
-	for(unsigned int i = 0; i < animation->mNumChannels; i++)
+	for(unsigned int i = 0; i < m_Skeleton.size(); i++)
 	{
-		aiNodeAnim* current_channel = animation->mChannels[i];
-
-		aiVector3D bone_position;
-		aiQuaternion bone_rotation;
-		aiVector3D bone_scale;
-
-		// possible bottleneck, consider looking for the affected node once and saving it
-		aiNode* affected_node = findAffectedNode(m_pScene->mRootNode, current_channel->mNodeName);
-
-		unsigned int position_index = 0, rotation_index = 0;
-		for(position_index = 0; position_index < current_channel->mNumPositionKeys - 1; position_index++)
+		// Unanimated nodes take the exact bind matrix rather than its
+		// decomposition, like boneTransform does
+		Matrix4f Local;
+		if(Pose.Animated[i])
 		{
-			if(current_channel->mPositionKeys[position_index + 1].mTime > current_time)
-				break;
+			Vector3f Translation, Scaling;
+			Quaternion Rotation(0.0f, 0.0f, 0.0f, 1.0f);
+			Pose.getNode(i, Translation, Rotation, Scaling);
+			ComposeTransform(Translation, Rotation, Scaling, Local);
 		}
-		bone_position = current_channel->mPositionKeys[position_index].mValue;
-
-		for(rotation_index = 0; rotation_index < current_channel->mNumRotationKeys - 1; rotation_index++)
+		else
 		{
-			if(current_channel->mRotationKeys[rotation_index + 1].mTime > current_time)
-				break;
-
+			Local = m_Nodes[i].Transformation;
 		}
-		bone_rotation = current_channel->mRotationKeys[rotation_index].mValue;
-		
-		aiMatrix4x4 transformation_matrix = aiMatrix4x4(bone_rotation.GetMatrix());
-		transformation_matrix.a4 = bone_position.x;
-		transformation_matrix.b4 = bone_position.y;
-		transformation_matrix.c4 = bone_position.z;
+		poseNode(i, Local, Transforms, Scratch);
+	}
+}
+
+float Mesh::getPackedTime(const AnimationClip& Clip, float TimeInSeconds) const
+{
+	float TimeInTicks = TimeInSeconds * Clip.TicksPerSecond;
+	float AnimationTime = fmod(TimeInTicks, Clip.Duration);
+	return Clip.Duration > 0.0f ? AnimationTime * (PACKED_TIME_MAX / Clip.Duration) : 0.0f;
+}
 
-		affected_node->mTransformation = transformation_matrix;
+void Mesh::poseNode(unsigned int NodeIndex, const Matrix4f& Local, std::vector<Matrix4f>& Transforms,
+					std::vector<Matrix4f>& Scratch) const
+{
+	const SkeletonNode& Node = m_Skeleton[NodeIndex];
+	if(Node.Parent >= 0)
+	{
+		MultiplyMatrix(Scratch[Node.Parent], Local, Scratch[NodeIndex]);
 	}
-	for(unsigned int i = 0; i < m_pScene->mNumMeshes; i++)
+	else
 	{
+		Scratch[NodeIndex] = Local;
+	}
 
-		loadBoneMatrices(m_pScene->mMeshes[i], m_bone_matrices);
+	// Written straight into the palette, m_BoneInfo is shared between threads
+	if(Node.Bone >= 0)
+	{
+		Matrix4f& BoneTransform = Transforms[Node.Bone];
+		MultiplyMatrix(m_GlobalInverseTransform, Scratch[NodeIndex], BoneTransform);
+		MultiplyMatrix(BoneTransform, m_BoneInfo[Node.Bone].BoneOffset, BoneTransform);
 	}
-}*/
+}
 
-const aiNodeAnim* Mesh::findNodeAnim(const aiAnimation* pAnimation, const std::string NodeName)
+void Mesh::boneTransformReference(float TimeInSeconds, std::vector<Matrix4f>& Transforms,
+								  unsigned int ClipIndex)
 {
-	for(unsigned int i = 0; i < pAnimation->mNumChannels; i++)
-	{
-		const aiNodeAnim* pNodeAnim = pAnimation->mChannels[i];
+	Matrix4f Identity;
+	Identity.InitIdentity();
 
-		if(std::string(pNodeAnim->mNodeName.data) == NodeName)
-		{
-			return pNodeAnim;
-		}
+	Transforms.resize(m_NumBones);
+
+	if(m_Nodes.empty() || ClipIndex >= m_Clips.size())
+	{
+		return;
 	}
 
-	return NULL;
-}
+	const AnimationClip& Clip = m_Clips[ClipIndex];
+	float TimeInTicks = TimeInSeconds * Clip.TicksPerSecond;
+	float AnimationTime = fmod(TimeInTicks, Clip.Duration);
 
-/*aiNode* Mesh::findAffectedNode(aiNode* root_node, const aiString& node_name)
-{
-	if(root_node->mName == node_name)
+	readNodeHierarchy(AnimationTime, Clip, 0, Identity);
+
+	for(unsigned int i = 0; i < m_NumBones; i++)
 	{
-		return root_node;
+		Transforms[i] = m_BoneInfo[i].FinalTransformation;
 	}
-	else
+}
+
+const Mesh::ChannelInfo* Mesh::findNodeAnim(const AnimationClip& Clip, const std::string NodeName)
+{
+	for(unsigned int i = 0; i < Clip.Channels.size(); i++)
 	{
-		for(unsigned int i = 0; i < root_node->mNumChildren; i++)
+		const ChannelInfo* pChannel = &Clip.Channels[i];
+
+		if(std::string(pChannel->NodeName) == NodeName)
 		{
-			aiNode* child_node = findAffectedNode(root_node->mChildren[i], node_name);
-			if(child_node)
-			{
-				return child_node;
-			}
+			return pChannel;
 		}
 	}
+
 	return NULL;
-}*/
+}
 
-void Mesh::readNodeHierarchy(float AnimationTime, const aiNode* pNode, const Matrix4f& ParentTransform)
+void Mesh::readNodeHierarchy(float AnimationTime, const AnimationClip& Clip, unsigned int NodeIndex,
+							 const Matrix4f& ParentTransform)
 {
-	std::string NodeName(pNode->mName.data);
+	const NodeInfo& Node = m_Nodes[NodeIndex];
+	std::string NodeName(Node.Name);
 
-	const aiAnimation* pAnimation = m_pScene->mAnimations[0];
-	if(m_pScene->mNumAnimations > 1)
-	{
-		std::cerr << m_pScene->mNumAnimations << std::endl;
-	}
-	Matrix4f NodeTransformation(pNode->mTransformation);
-	const aiNodeAnim* pNodeAnim = findNodeAnim(pAnimation, NodeName);
+	Matrix4f NodeTransformation(Node.Transformation);
+	const ChannelInfo* pChannel = findNodeAnim(Clip, NodeName);
 
-	if(pNodeAnim)
+	if(pChannel)
 	{
 		aiVector3D Scaling;
-		interpolateScaling(Scaling, AnimationTime, pNodeAnim);
+		interpolateScaling(Scaling, AnimationTime, Clip, *pChannel);
 		Matrix4f ScalingMatrix;
 		ScalingMatrix.InitScaleTransform(Scaling.x, Scaling.y, Scaling.z);
 
 		aiQuaternion RotationQuat;
-		interpolateRotation(RotationQuat, AnimationTime, pNodeAnim);
+		interpolateRotation(RotationQuat, AnimationTime, Clip, *pChannel);
 		Matrix4f RotationMatrix = Matrix4f(RotationQuat.GetMatrix());
 
 		aiVector3D Translation;
-		interpolatePosition(Translation, AnimationTime, pNodeAnim);
+		interpolatePosition(Translation, AnimationTime, Clip, *pChannel);
 		Matrix4f TranslationMatrix;
 		TranslationMatrix.InitTranslationTransform(Translation.x, Translation.y, Translation.z);
 
@@ -441,133 +2168,88 @@ void Mesh::readNodeHierarchy(float AnimationTime, const aiNode* pNode, const Mat
 													m_BoneInfo[BoneIndex].BoneOffset;
 	}
 
-	for(unsigned int i = 0; i < pNode->mNumChildren; i++)
+	for(unsigned int i = 0; i < Node.NumChildren; i++)
 	{
-		readNodeHierarchy(AnimationTime, pNode->mChildren[i], GlobalTransformation);
+		readNodeHierarchy(AnimationTime, Clip, m_NodeChildren[Node.FirstChild + i], GlobalTransformation);
 	}
 }
 
-/*void Mesh::loadBoneMatrices(const aiMesh* pMesh, std::vector<aiMatrix4x4>& bone_matrices)
-{
-	if(!pMesh->HasBones())
-		return;
-	bone_matrices.resize(pMesh->mNumBones);
-	for(unsigned int i = 0; i < pMesh->mNumBones; i++)
-	{
-		const aiBone* bone = pMesh->mBones[i];
-		aiNode* affected_node = findAffectedNode(m_pScene->mRootNode, bone->mName);
-
-		bone_matrices[i] = bone->mOffsetMatrix;
-		const aiNode* temp = affected_node;
-		while(temp)
-		{
-			bone_matrices[i] *= temp->mTransformation;
-			temp = temp->mParent;
-		}
-	}
-}*/
-
-/*void Mesh::loadBoneIndices(const aiMesh* pMesh, std::vector<Vertex>& vertices)
+void Mesh::interpolateRotation(aiQuaternion& Out, float AnimationTime, const AnimationClip& Clip, const ChannelInfo& Channel)
 {
-	if(!pMesh->HasBones())
-		return;
-	std::vector<aiVector3D> vertex_positions;
-	std::vector<aiVector3D> vertex_normals;
-
-	vertex_positions.resize(pMesh->mNumVertices);
-	vertex_normals.resize(pMesh->mNumVertices);
-
-	for(unsigned int i = 0; i < pMesh->mNumBones; i++)
-	{
-		const aiBone* bone = pMesh->mBones[i];
-		const aiMatrix4x4& bone_matrix = m_bone_matrices[i];
-		aiMatrix3x3 bone_normal_matrix = aiMatrix3x3(bone_matrix);
-		for(unsigned int j = 0; j < bone->mNumWeights; j++)
-		{
-			const aiVertexWeight& weight = bone->mWeights[j];
-			unsigned int vertex_ID = weight.mVertexId;
-			vertices[vertex_ID].addBone(i, weight.mWeight);
-		}
-	}
-}*/
+	const aiQuatKey* pKeys = &Clip.RotationKeys[Channel.FirstRotationKey];
 
-void Mesh::interpolateRotation(aiQuaternion& Out, float AnimationTime, const aiNodeAnim* pNodeAnim)
-{
-	if(pNodeAnim->mNumRotationKeys == 1)
+	if(Channel.NumRotationKeys == 1)
 	{
-		Out = pNodeAnim->mRotationKeys[0].mValue;
+		Out = pKeys[0].mValue;
 		return;
 	}
 
-	unsigned int RotationIndex = findRotationIndex(AnimationTime, pNodeAnim);
+	unsigned int RotationIndex = findRotationIndex(AnimationTime, Clip, Channel);
 	unsigned int NextRotationIndex = (RotationIndex + 1);
-	assert(NextRotationIndex < pNodeAnim->mNumRotationKeys);
-	float DeltaTime = (float)(pNodeAnim->mRotationKeys[NextRotationIndex].mTime -
-					  		  pNodeAnim->mRotationKeys[RotationIndex].mTime);
-	float Factor = fabs(AnimationTime - (float)pNodeAnim->mRotationKeys[RotationIndex].mTime) / DeltaTime;
+	assert(NextRotationIndex < Channel.NumRotationKeys);
+	float DeltaTime = (float)(pKeys[NextRotationIndex].mTime - pKeys[RotationIndex].mTime);
+	float Factor = fabs(AnimationTime - (float)pKeys[RotationIndex].mTime) / DeltaTime;
 	assert(Factor >= 0.0f && Factor <= 1.0f);
-	const aiQuaternion& StartRotationQuat = pNodeAnim->mRotationKeys[RotationIndex].mValue;
-	const aiQuaternion& EndRotationQuat = pNodeAnim->mRotationKeys[NextRotationIndex].mValue;
+	const aiQuaternion& StartRotationQuat = pKeys[RotationIndex].mValue;
+	const aiQuaternion& EndRotationQuat = pKeys[NextRotationIndex].mValue;
 	aiQuaternion::Interpolate(Out, StartRotationQuat, EndRotationQuat, Factor);
 	Out = Out.Normalize();
 }
 
-void Mesh::interpolatePosition(aiVector3D& Out, float AnimationTime, const aiNodeAnim* pNodeAnim)
+void Mesh::interpolatePosition(aiVector3D& Out, float AnimationTime, const AnimationClip& Clip, const ChannelInfo& Channel)
 {
-	if(pNodeAnim->mNumPositionKeys == 1)
+	const aiVectorKey* pKeys = &Clip.PositionKeys[Channel.FirstPositionKey];
+
+	if(Channel.NumPositionKeys == 1)
 	{
-		Out = pNodeAnim->mPositionKeys[0].mValue;
+		Out = pKeys[0].mValue;
 		return;
 	}
 
-	unsigned int PositionIndex = findPositionIndex(AnimationTime, pNodeAnim);
+	unsigned int PositionIndex = findPositionIndex(AnimationTime, Clip, Channel);
 	unsigned int NextPositionIndex = (PositionIndex + 1);
-	assert(NextPositionIndex < pNodeAnim->mNumPositionKeys);
-	float DeltaTime = (float)(pNodeAnim->mPositionKeys[NextPositionIndex].mTime -
-					  		  pNodeAnim->mPositionKeys[PositionIndex].mTime);
-	float Factor = fabs(AnimationTime - (float)pNodeAnim->mPositionKeys[PositionIndex].mTime) / DeltaTime;
+	assert(NextPositionIndex < Channel.NumPositionKeys);
+	float DeltaTime = (float)(pKeys[NextPositionIndex].mTime - pKeys[PositionIndex].mTime);
+	float Factor = fabs(AnimationTime - (float)pKeys[PositionIndex].mTime) / DeltaTime;
 	assert(Factor >= 0.0f && Factor <= 1.0f);
-	const aiVector3D& Start = pNodeAnim->mPositionKeys[PositionIndex].mValue;
-	const aiVector3D& End = pNodeAnim->mPositionKeys[NextPositionIndex].mValue;
+	const aiVector3D& Start = pKeys[PositionIndex].mValue;
+	const aiVector3D& End = pKeys[NextPositionIndex].mValue;
 	aiVector3D Delta = End - Start;
 	Out = Start + Factor * Delta;
 }
 
-void Mesh::interpolateScaling(aiVector3D& Out, float AnimationTime, const aiNodeAnim* pNodeAnim)
+void Mesh::interpolateScaling(aiVector3D& Out, float AnimationTime, const AnimationClip& Clip, const ChannelInfo& Channel)
 {
-	if(pNodeAnim->mNumScalingKeys == 1)
+	const aiVectorKey* pKeys = &Clip.ScalingKeys[Channel.FirstScalingKey];
+
+	if(Channel.NumScalingKeys == 1)
 	{
-		Out = pNodeAnim->mScalingKeys[0].mValue;
+		Out = pKeys[0].mValue;
 		return;
 	}
 
-	unsigned int ScalingIndex = findScalingIndex(AnimationTime, pNodeAnim);
+	unsigned int ScalingIndex = findScalingIndex(AnimationTime, Clip, Channel);
 	unsigned int NextScalingIndex = (ScalingIndex + 1);
-	assert(NextScalingIndex < pNodeAnim->mNumScalingKeys);
-	float DeltaTime = (float)(pNodeAnim->mScalingKeys[NextScalingIndex].mTime -
-							  pNodeAnim->mScalingKeys[ScalingIndex].mTime);
-	float Factor = fabs(AnimationTime - (float)pNodeAnim->mScalingKeys[ScalingIndex].mTime) / DeltaTime;
-	/*std::cerr << "Factor" << Factor << std::endl;
-	std::cerr << "AnimationTime: " << AnimationTime << std::endl;
-	std::cerr << "ScaleKey Time: " << (float)pNodeAnim->mScalingKeys[ScalingIndex].mTime << std::endl;
-	std::cerr << "DeltaTime: " << DeltaTime << std::endl;*/
+	assert(NextScalingIndex < Channel.NumScalingKeys);
+	float DeltaTime = (float)(pKeys[NextScalingIndex].mTime - pKeys[ScalingIndex].mTime);
+	float Factor = fabs(AnimationTime - (float)pKeys[ScalingIndex].mTime) / DeltaTime;
 	assert(Factor >= 0.0f && Factor <= 1.0f);
-	const aiVector3D& Start = pNodeAnim->mScalingKeys[ScalingIndex].mValue;
-	const aiVector3D& End = pNodeAnim->mScalingKeys[NextScalingIndex].mValue;
+	const aiVector3D& Start = pKeys[ScalingIndex].mValue;
+	const aiVector3D& End = pKeys[NextScalingIndex].mValue;
 	aiVector3D Delta = End - Start;
 	Out = Start + Factor * Delta;
 }
 
-unsigned int Mesh::findRotationIndex(float AnimationTime, const aiNodeAnim* pNodeAnim)
+unsigned int Mesh::findRotationIndex(float AnimationTime, const AnimationClip& Clip, const ChannelInfo& Channel)
 {
-	assert(pNodeAnim->mNumRotationKeys > 0);
+	assert(Channel.NumRotationKeys > 0);
+	const aiQuatKey* pKeys = &Clip.RotationKeys[Channel.FirstRotationKey];
+
+	for(unsigned int i = 0; i < Channel.NumRotationKeys - 1; i++)
 	{
-		for(unsigned int i = 0; i < pNodeAnim->mNumRotationKeys - 1; i++)
+		if(AnimationTime < (float)pKeys[i + 1].mTime)
 		{
-			if(AnimationTime < (float)pNodeAnim->mRotationKeys[i + 1].mTime)
-			{
-				return i;
-			}
+			return i;
 		}
 	}
 
@@ -576,16 +2258,34 @@ unsigned int Mesh::findRotationIndex(float AnimationTime, const aiNodeAnim* pNod
 	return 0;
 }
 
-unsigned int Mesh::findPositionIndex(float AnimationTime, const aiNodeAnim* pNodeAnim)
+unsigned int Mesh::findPositionIndex(float AnimationTime, const AnimationClip& Clip, const ChannelInfo& Channel)
 {
-	assert(pNodeAnim->mPositionKeys > 0);
+	assert(Channel.NumPositionKeys > 0);
+	const aiVectorKey* pKeys = &Clip.PositionKeys[Channel.FirstPositionKey];
+
+	for(unsigned int i = 0; i < Channel.NumPositionKeys - 1; i++)
 	{
-		for(unsigned int i = 0; i < pNodeAnim->mNumPositionKeys - 1; i++)
+		if(AnimationTime < (float)pKeys[i + 1].mTime)
 		{
-			if(AnimationTime < (float)pNodeAnim->mPositionKeys[i + 1].mTime)
-			{
-				return i;
-			}
+			return i;
+		}
+	}
+
+	assert(0);
+
+	return 0;
+}
+
+unsigned int Mesh::findScalingIndex(float AnimationTime, const AnimationClip& Clip, const ChannelInfo& Channel)
+{
+	assert(Channel.NumScalingKeys > 0);
+	const aiVectorKey* pKeys = &Clip.ScalingKeys[Channel.FirstScalingKey];
+
+	for(unsigned int i = 0; i < Channel.NumScalingKeys - 1; i++)
+	{
+		if(AnimationTime < (float)pKeys[i + 1].mTime)
+		{
+			return i;
 		}
 	}
 
@@ -594,60 +2294,465 @@ unsigned int Mesh::findPositionIndex(float AnimationTime, const aiNodeAnim* pNod
 	return 0;
 }
 
-unsigned int Mesh::findScalingIndex(float AnimationTime, const aiNodeAnim* pNodeAnim)
+bool SkinnedMesh::loadClip(const std::string& Filename)
+{
+	TraceScope scope("clip", Filename);
+
+	std::string CookedFilename = getCookedFilename(Filename);
+	if(isFileNewer(Filename, CookedFilename) || !loadCooked(CookedFilename, true))
+	{
+		if(!importClip(Filename))
+		{
+			return false;
+		}
+	}
+
+	bindClip(m_Clips.back());
+
+	// The clip is played on our own skeleton, so any channel that does not
+	// match one of our nodes means the file was exported from another rig
+	const AnimationClip& Clip = m_Clips.back();
+	for(unsigned int i = 0; i < Clip.Channels.size(); i++)
+	{
+		bool Found = false;
+		for(unsigned int j = 0; j < m_Nodes.size() && !Found; j++)
+		{
+			Found = strcmp(m_Nodes[j].Name, Clip.Channels[i].NodeName) == 0;
+		}
+		if(!Found)
+		{
+			printf("Clip '%s' animates '%s', which is not in the skeleton\n",
+				   Filename.c_str(), Clip.Channels[i].NodeName);
+		}
+	}
+
+	return true;
+}
+
+bool SkinnedMesh::importClip(const std::string& Filename)
+{
+	// No post processing, only the animation is used
+	Assimp::Importer Importer;
+	Trace::addFileRead(Filename);
+	const aiScene* pScene = Importer.ReadFile(Filename.c_str(), 0);
+
+	if(!pScene)
+	{
+		printf("Error parsing '%s': '%s'\n", Filename.c_str(),
+			   Importer.GetErrorString());
+		return false;
+	}
+
+	if(pScene->mNumAnimations == 0)
+	{
+		printf("'%s' has no animation\n", Filename.c_str());
+		return false;
+	}
+
+	m_Clips.push_back(AnimationClip());
+	importAnimation(pScene, m_Clips.back());
+
+	return true;
+}
+
+int Mesh::benchmarkPose(const std::string& Filename, unsigned int Iterations)
 {
-	assert(pNodeAnim->mScalingKeys > 0);
+	// The reference evaluator reads the source keys
+	setKeepSourceKeys(true);
+
+	Mesh mesh;
+	if(!mesh.prepareMesh(Filename))
+	{
+		return 1;
+	}
+	if(mesh.m_Clips.empty())
+	{
+		printf("'%s' has no animation\n", Filename.c_str());
+		return 1;
+	}
+
+	std::vector<Matrix4f> Reference;
+	std::vector<Matrix4f> Compiled;
+
+	printf("%s: %u nodes, %u bones, %u poses per run\n", Filename.c_str(),
+		   (unsigned int)mesh.m_Nodes.size(), mesh.m_NumBones, Iterations);
+	printf("%-6s %16s %16s %10s %12s\n", "clip", "reference (us)", "compiled (us)", "speedup", "max error");
+
+	for(unsigned int c = 0; c < mesh.m_Clips.size(); c++)
 	{
-		//std::cerr << "Node Name: " << pNodeAnim->mNodeName.data << std::endl;
-		//std::cerr << "Num Scaling Keys: " << pNodeAnim->mNumScalingKeys << std::endl;
-		//std::cerr << "Animation Time: " << AnimationTime << std::endl;
-		for(unsigned int i = 0; i < pNodeAnim->mNumScalingKeys - 1; i++)
+		const AnimationClip& Clip = mesh.m_Clips[c];
+		float Length = Clip.TicksPerSecond > 0.0f ? Clip.Duration / Clip.TicksPerSecond : 1.0f;
+
+		// Both paths have to agree at every key, so compare them at times
+		// spread over the whole clip before timing anything
+		float MaxError = 0.0f;
+		for(unsigned int i = 0; i < 256; i++)
 		{
-			//std::cerr << "Time: " << (float)pNodeAnim->mScalingKeys[i + i].mTime << std::endl;
-			if(AnimationTime < (float)pNodeAnim->mScalingKeys[i + 1].mTime)
+			float Time = Length * i / 256.0f;
+			mesh.boneTransformReference(Time, Reference, c);
+			mesh.boneTransform(Time, Compiled, c);
+			for(unsigned int b = 0; b < Compiled.size(); b++)
 			{
-				return i;
+				for(unsigned int j = 0; j < 16; j++)
+				{
+					float Error = fabs((&Reference[b].m[0][0])[j] - (&Compiled[b].m[0][0])[j]);
+					MaxError = Error > MaxError ? Error : MaxError;
+				}
 			}
 		}
+
+		sf::Clock timer;
+		for(unsigned int i = 0; i < Iterations; i++)
+		{
+			mesh.boneTransformReference(Length * i / Iterations, Reference, c);
+		}
+		float ReferenceTime = timer.restart().asSeconds();
+		for(unsigned int i = 0; i < Iterations; i++)
+		{
+			mesh.boneTransform(Length * i / Iterations, Compiled, c);
+		}
+		float CompiledTime = timer.getElapsedTime().asSeconds();
+
+		printf("%-6u %16.2f %16.2f %9.1fx %12g\n", c, ReferenceTime * 1000000.0f / Iterations,
+			   CompiledTime * 1000000.0f / Iterations,
+			   CompiledTime > 0.0f ? ReferenceTime / CompiledTime : 0.0f, MaxError);
 	}
 
-	assert(0);
+	// The layered poses PoseCache evaluates for crossfades, against plain
+	// boneTransform. The first clip at two times half a clip apart stands in
+	// for two clips, the file may only have the one.
+	const char* BlendNames[] = { "one layer", "crossfade", "crossfade+additive" };
+	float Length = mesh.getClipDuration(0) > 0.0f ? mesh.getClipDuration(0) : 1.0f;
+	LocalPose Blend, Layer, AdditiveReference;
+	std::vector<Matrix4f> Scratch;
+
+	// One layer through the blender has to give boneTransform's pose
+	float BlendError = 0.0f;
+	for(unsigned int i = 0; i < 256; i++)
+	{
+		mesh.sampleLocalPose(Length * i / 256.0f, 0, Layer);
+		mesh.composePose(Layer, Compiled, Scratch);
+		mesh.boneTransform(Length * i / 256.0f, Reference, 0, Scratch);
+		for(unsigned int b = 0; b < Compiled.size(); b++)
+		{
+			for(unsigned int j = 0; j < 16; j++)
+			{
+				float Error = fabs((&Reference[b].m[0][0])[j] - (&Compiled[b].m[0][0])[j]);
+				BlendError = Error > BlendError ? Error : BlendError;
+			}
+		}
+	}
+
+	sf::Clock timer;
+	for(unsigned int i = 0; i < Iterations; i++)
+	{
+		mesh.boneTransform(Length * i / Iterations, Compiled, 0, Scratch);
+	}
+	float SingleTime = timer.getElapsedTime().asSeconds();
+
+	printf("%-20s %16s %10s %12s\n", "blend", "time (us)", "cost", "max error");
+	for(unsigned int n = 0; n < 3; n++)
+	{
+		timer.restart();
+		for(unsigned int i = 0; i < Iterations; i++)
+		{
+			float Time = Length * i / Iterations;
+			mesh.sampleLocalPose(Time, 0, Layer);
+			Blend.resize(Layer.NumNodes);
+			clearPose(Blend);
+			accumulatePose(Blend, Layer, n > 0 ? 0.5f : 1.0f);
+			if(n > 0)
+			{
+				mesh.sampleLocalPose(Time + Length * 0.5f, 0, Layer);
+				accumulatePose(Blend, Layer, 0.5f);
+			}
+			normalizePose(Blend, 1.0f);
+			if(n > 1)
+			{
+				mesh.sampleLocalPose(Time, 0, Layer);
+				mesh.sampleLocalPose(0.0f, 0, AdditiveReference);
+				addPose(Blend, Layer, AdditiveReference, 0.5f);
+			}
+			mesh.composePose(Blend, Compiled, Scratch);
+		}
+		float BlendTime = timer.getElapsedTime().asSeconds();
+
+		printf("%-20s %16.2f %9.2fx", BlendNames[n], BlendTime * 1000000.0f / Iterations,
+			   SingleTime > 0.0f ? BlendTime / SingleTime : 0.0f);
+		n == 0 ? printf(" %12g\n", BlendError) : printf("\n");
+	}
 
 	return 0;
 }
 
-void TerrainMesh::initMesh(unsigned int MeshIndex, const aiMesh* paiMesh, std::vector<Vector3f>& Positions,
-						   std::vector<Vector3f>& Normals, std::vector<Vector2f>& TexCoords,
-						   std::vector<VertexBoneData>& Bones, std::vector<unsigned int>& Indices)
+void Mesh::reportClipError(unsigned int NumSamples)
 {
-	const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
+	// Still on the CPU between importMesh and uploadMesh
+	const unsigned char* pVertices = m_pVertexData ? m_pVertexData :
+									 (m_PackedVertices.empty() ? NULL : &m_PackedVertices[0]);
+	unsigned int NumVertices = m_pVertexData ? m_NumVertexData : m_PackedVertices.size() / m_VertexSize;
+	if(m_VertexFormat != SKINNED_VERTEX)
+	{
+		NumVertices = 0;
+	}
 
-	for(unsigned int i = 0; i < paiMesh->mNumVertices; i++)
+	// A mesh that was only imported has not been bound yet
+	bindSkeleton();
+
+	std::vector<Matrix4f> Reference;
+	std::vector<Matrix4f> Compressed;
+
+	for(unsigned int c = 0; c < m_Clips.size(); c++)
 	{
-		const aiVector3D* pPos = &(paiMesh->mVertices[i]);
-		const aiVector3D* pNormal = &(paiMesh->mNormals[i]);
-		const aiVector3D* pTexCoord = paiMesh->HasTextureCoords(0) ?
-			&(paiMesh->mTextureCoords[0][i]) : &Zero3D;
+		const AnimationClip& Clip = m_Clips[c];
+		unsigned int SourceKeys = Clip.PositionKeys.size() + Clip.RotationKeys.size() + Clip.ScalingKeys.size();
+		if(SourceKeys == 0)
+		{
+			printf("  clip %u: the source keys were not kept\n", c);
+			continue;
+		}
+		size_t SourceSize = (Clip.PositionKeys.size() + Clip.ScalingKeys.size()) * sizeof(aiVectorKey) +
+							Clip.RotationKeys.size() * sizeof(aiQuatKey);
+		size_t PackedSize = Clip.Tracks.size() * sizeof(PackedTrack) + Clip.PackedKeys.size() * sizeof(PackedKey);
+
+		float MaxError = 0.0f;
+		double SumError = 0.0;
+		unsigned int NumErrors = 0;
+		float Length = getClipDuration(c);
+		for(unsigned int i = 0; i < NumSamples; i++)
+		{
+			float Time = Length * i / NumSamples;
+			boneTransformReference(Time, Reference, c);
+			boneTransform(Time, Compressed, c);
+
+			for(unsigned int v = 0; v < NumVertices; v++)
+			{
+				const SkinnedVertex& Vertex = ((const SkinnedVertex*)pVertices)[v];
+				Vector3f Difference = skinPosition(Vertex, Reference);
+				Difference -= skinPosition(Vertex, Compressed);
+				float Error = sqrtf(Difference.x * Difference.x + Difference.y * Difference.y +
+									Difference.z * Difference.z);
+				MaxError = std::max(MaxError, Error);
+				SumError += Error;
+				NumErrors++;
+			}
+		}
 
-		Positions.push_back(Vector3f(pPos->x, pPos->y, pPos->z));
-		Normals.push_back(Vector3f(pNormal->x, pNormal->y, pNormal->z));
-		TexCoords.push_back(Vector2f(pTexCoord->x, pTexCoord->y));
+		printf("  clip %u: %u keys in %.1f KB -> %u keys in %.1f KB, vertex error max %g mean %g\n",
+			   c, SourceKeys, SourceSize / 1024.0f, (unsigned int)Clip.PackedKeys.size(), PackedSize / 1024.0f,
+			   MaxError, NumErrors > 0 ? SumError / NumErrors : 0.0);
 	}
+}
 
-	for(unsigned int i = 0; i < paiMesh->mNumFaces; i++)
+bool TerrainMesh::s_is_bvh_cache_enabled = true;
+
+TerrainMesh::TerrainMesh()
+	: m_triangle_mesh(NULL),
+	  m_terrain_mesh(NULL),
+	  m_triangle_hash(FNV_OFFSET_BASIS),
+	  m_bvh_buffer(NULL),
+	  m_bvh_time(0.0f),
+	  m_is_bvh_from_cache(false)
+{
+}
+
+TerrainMesh::~TerrainMesh()
+{
+	releaseCollision();
+}
+
+// The shape points at the triangles, so it goes first. It does not own a
+// BVH that came from the cache.
+void TerrainMesh::releaseCollision()
+{
+	delete m_terrain_mesh;
+	m_terrain_mesh = NULL;
+	if(m_bvh_buffer)
 	{
-		const aiFace& Face = paiMesh->mFaces[i];
-		assert(Face.mNumIndices == 3);
-		Indices.push_back(Face.mIndices[0]);
-		Indices.push_back(Face.mIndices[1]);
-		Indices.push_back(Face.mIndices[2]);
-		Vector3f vertex1 = Positions[Face.mIndices[0]];
-		Vector3f vertex2 = Positions[Face.mIndices[1]];
-		Vector3f vertex3 = Positions[Face.mIndices[2]];
-		m_triangle_mesh.addTriangle(btVector3(vertex1.x, vertex1.y, vertex1.z), 
+		btAlignedFree(m_bvh_buffer);
+		m_bvh_buffer = NULL;
+	}
+	delete m_triangle_mesh;
+	m_triangle_mesh = NULL;
+}
+
+void TerrainMesh::initMesh(unsigned int MeshIndex)
+{
+	// A reload builds its collision from scratch, not on top of the last load
+	if(MeshIndex == 0)
+	{
+		releaseCollision();
+		m_triangle_mesh = new btTriangleMesh();
+		m_triangle_hash = FNV_OFFSET_BASIS;
+	}
+
+	const MeshEntry& entry = m_Entries[MeshIndex];
+	for(unsigned int i = 0; i < entry.NumIndices; i += 3)
+	{
+		const Vector3f& vertex1 = getPosition(entry.BaseVertex + getIndex(entry.BaseIndex + i));
+		const Vector3f& vertex2 = getPosition(entry.BaseVertex + getIndex(entry.BaseIndex + i + 1));
+		const Vector3f& vertex3 = getPosition(entry.BaseVertex + getIndex(entry.BaseIndex + i + 2));
+		m_triangle_mesh->addTriangle(btVector3(vertex1.x, vertex1.y, vertex1.z), 
 									btVector3(vertex2.x, vertex2.y, vertex2.z), 
 									btVector3(vertex3.x, vertex3.y, vertex3.z), 
 									false);
+		m_triangle_hash = hashBytes(m_triangle_hash, &vertex1, sizeof(vertex1));
+		m_triangle_hash = hashBytes(m_triangle_hash, &vertex2, sizeof(vertex2));
+		m_triangle_hash = hashBytes(m_triangle_hash, &vertex3, sizeof(vertex3));
+	}
+
+	// Build the BVH once every submesh has been added to the triangle mesh
+	if(MeshIndex == m_Entries.size() - 1)
+	{
+		TraceScope scope("bvh", getBvhCacheFilename());
+		sf::Clock timer;
+
+		m_is_bvh_from_cache = s_is_bvh_cache_enabled && loadBvh();
+		if(!m_is_bvh_from_cache)
+		{
+			m_terrain_mesh = new btBvhTriangleMeshShape(m_triangle_mesh, true, true);
+			if(s_is_bvh_cache_enabled)
+			{
+				saveBvh();
+			}
+		}
+
+		m_bvh_time = timer.getElapsedTime().asSeconds();
+	}
+}
+
+std::string TerrainMesh::getBvhCacheFilename() const
+{
+	char Filename[64];
+	SNPRINTF(Filename, sizeof(Filename), "bvh_cache/%016llx.bvh", m_triangle_hash);
+	return Filename;
+}
+
+bool TerrainMesh::loadBvh()
+{
+	FILE* File = fopen(getBvhCacheFilename().c_str(), "rb");
+	if(!File)
+	{
+		return false;
+	}
+
+	Trace::addFileRead(getBvhCacheFilename());
+
+	BvhCacheHeader Header;
+	if(fread(&Header, sizeof(Header), 1, File) != 1 || memcmp(Header.Magic, "CBVH", 4) != 0 ||
+	   Header.Version != BVH_CACHE_VERSION || Header.PointerSize != sizeof(void*) ||
+	   Header.TriangleHash != m_triangle_hash)
+	{
+		fclose(File);
+		return false;
+	}
+
+	// The BVH is deserialized in place, so the buffer has to be writable,
+	// aligned and stay around for as long as the shape
+	void* pBuffer = btAlignedAlloc(Header.Size, 16);
+	bool Ret = fread(pBuffer, 1, Header.Size, File) == Header.Size;
+	fclose(File);
+
+	btOptimizedBvh* pBvh = Ret ? btOptimizedBvh::deSerializeInPlace(pBuffer, Header.Size, false) : NULL;
+	if(!pBvh)
+	{
+		btAlignedFree(pBuffer);
+		return false;
+	}
+
+	m_bvh_buffer = pBuffer;
+	m_terrain_mesh = new btBvhTriangleMeshShape(m_triangle_mesh, true, false);
+	m_terrain_mesh->setOptimizedBvh(pBvh);
+
+	return true;
+}
+
+void TerrainMesh::saveBvh()
+{
+	btOptimizedBvh* pBvh = m_terrain_mesh->getOptimizedBvh();
+	unsigned int Size = pBvh->calculateSerializeBufferSize();
+	void* pBuffer = btAlignedAlloc(Size, 16);
+	if(!pBvh->serializeInPlace(pBuffer, Size, false))
+	{
+		btAlignedFree(pBuffer);
+		return;
+	}
+
+#ifdef WIN32
+	_mkdir("bvh_cache");
+#else
+	mkdir("bvh_cache", 0755);
+#endif
+
+	BvhCacheHeader Header;
+	memset(&Header, 0, sizeof(Header));
+	memcpy(Header.Magic, "CBVH", 4);
+	Header.Version = BVH_CACHE_VERSION;
+	Header.PointerSize = sizeof(void*);
+	Header.Size = Size;
+	Header.TriangleHash = m_triangle_hash;
+
+	// Written under a temporary name so a half written file is never picked
+	// up by another loader
+	std::string Filename = getBvhCacheFilename();
+	std::string TempFilename = Filename + ".tmp";
+	FILE* File = fopen(TempFilename.c_str(), "wb");
+	if(File)
+	{
+		fwrite(&Header, sizeof(Header), 1, File);
+		fwrite(pBuffer, 1, Size, File);
+		bool Ret = !ferror(File);
+		fclose(File);
+		if(!Ret || rename(TempFilename.c_str(), Filename.c_str()) != 0)
+		{
+			remove(TempFilename.c_str());
+		}
+	}
+
+	btAlignedFree(pBuffer);
+}
+
+int TerrainMesh::benchmarkBvhCache(const std::vector<std::string>& Filenames)
+{
+	float BuildTotal = 0.0f;
+	float LoadTotal = 0.0f;
+
+	printf("%-28s %12s %12s\n", "mesh", "build (ms)", "cached (ms)");
+
+	for(unsigned int i = 0; i < Filenames.size(); i++)
+	{
+		// Cold build with the cache off, then once with the cache on so it
+		// is filled, then the timed load from the cache
+		float Times[2];
+		bool FromCache = false;
+		for(unsigned int Pass = 0; Pass < 3; Pass++)
+		{
+			setBvhCacheEnabled(Pass > 0);
+			TerrainMesh mesh;
+			if(!mesh.prepareMesh(Filenames[i]))
+			{
+				setBvhCacheEnabled(true);
+				return 1;
+			}
+			if(Pass != 1)
+			{
+				Times[Pass / 2] = mesh.getBvhTime();
+				FromCache = mesh.isBvhFromCache();
+			}
+		}
+		setBvhCacheEnabled(true);
+
+		printf("%-28s %12.2f %12.2f%s\n", Filenames[i].c_str(), Times[0] * 1000.0f, Times[1] * 1000.0f,
+			   FromCache ? "" : "  (cache miss)");
+		BuildTotal += Times[0];
+		LoadTotal += Times[1];
+	}
+
+	printf("%-28s %12.2f %12.2f\n", "total", BuildTotal * 1000.0f, LoadTotal * 1000.0f);
+	if(LoadTotal > 0.0f)
+	{
+		printf("speedup: %.1fx\n", BuildTotal / LoadTotal);
 	}
-	m_terrain_mesh = new btBvhTriangleMeshShape(&m_triangle_mesh, true, true);
+
+	return 0;
 }
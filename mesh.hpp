@@ -10,9 +10,17 @@
 
 #include "util.h"
 #include "math_3d.h"
+#include "clip_compressor.hpp"
+#include "pose_blender.hpp"
 #include "texture.h"
+#include "mapped_file.hpp"
 #include "btBulletDynamicsCommon.h"
 
+#define MESH_NAME_LENGTH 128
+#define MESH_PATH_LENGTH 256
+// Levels of detail of a skinned mesh, counting the full mesh
+#define MAX_MESH_LODS 3
+
 class Mesh
 {
 public:
@@ -40,32 +48,145 @@ public:
 
 		void addBoneData(unsigned BoneID, float Weight);
 	};
+	// A vertex as it comes out of the importer, packed into one of the
+	// formats below before it is cooked or uploaded
+	struct Vertex
+	{
+		Vector3f Position;
+		Vector2f TexCoord;
+		Vector3f Normal;
+		VertexBoneData Bones;
+	};
+	// The interleaved formats that are cooked and uploaded. Normals are
+	// snorm 2_10_10_10 and texture coordinates half floats. Only meshes with
+	// bones use the skinned format, which adds byte bone indices and unorm
+	// weights. Both start with the position.
+	struct StaticVertex
+	{
+		Vector3f Position;
+		unsigned int Normal;
+		unsigned short TexCoord[2];
+	};
+	struct SkinnedVertex
+	{
+		Vector3f Position;
+		unsigned int Normal;
+		unsigned short TexCoord[2];
+		unsigned char BoneIDs[4];
+		unsigned char BoneWeights[4];
+	};
+	// What skinning.vert writes for every vertex of a skinned mesh
+	struct SkinnedOutputVertex
+	{
+		Vector3f Position;
+		Vector3f Normal;
+		Vector2f TexCoord;
+	};
+	// What crowd.vert reads for every instance of a crowd
+	struct CrowdInstance
+	{
+		float ModelRows[3][4];	// the model matrix without its last row
+		float FirstFrame;		// of the clip in the baked bone texture
+		float NumFrames;
+		float FramesPerSecond;
+		float Phase;			// in seconds
+	};
+
+	// How skinning.vert blends the bones. Dual quaternions keep the volume
+	// around twisting joints and halve the palette, but drop any scale in the
+	// bone transforms.
+	enum SkinningMode { LINEAR_SKINNING, DUAL_QUATERNION_SKINNING };
 
 	Mesh();
-	~Mesh();
+	virtual ~Mesh();
 	bool loadMesh(const std::string& Filename);
+	// loadMesh in two halves. prepareMesh does all the CPU work (import or
+	// mapping the cooked file, image decode, collision building) and is safe
+	// to run on a worker thread; uploadMesh does the GL work on the GL thread
+	bool prepareMesh(const std::string& Filename);
+	bool uploadMesh();
 	void render();
-	void boneTransform(float TimeInSeconds, std::vector<Matrix4f>& Transforms);
+	// The skinning pre-pass. skin runs the bound transform feedback program
+	// over every vertex of the LOD and writes the results to Buffer starting
+	// at BaseVertex, renderSkinned then draws them the way render draws a
+	// static mesh. The LOD's palette holds the bones getLodBones lists.
+	void skin(GLuint Buffer, unsigned int BaseVertex, unsigned int Lod = 0);
+	void renderSkinned(GLuint Buffer, unsigned int BaseVertex, unsigned int Lod = 0);
+	// Draws NumInstances copies of the LOD in one call per entry, with the
+	// CrowdInstance attributes read from InstanceBuffer starting at
+	// FirstInstance. crowd.vert skins them from a baked bone texture, see
+	// Crowd.
+	void renderInstances(GLuint InstanceBuffer, unsigned int NumInstances, unsigned int Lod = 0,
+						 unsigned int FirstInstance = 0);
+	unsigned int getNumVertices() const { return m_NumVertices; }
+	// Skinned meshes get a chain of LODs when they are imported, each with
+	// about half the triangles of the one before and its leaf bones merged
+	// into their parents, and the chain is cooked with the mesh. LOD 0 is
+	// the mesh as it was imported, and the only one of every other mesh.
+	unsigned int getNumLods() const { return m_Lods.size(); }
+	// The coarsest LOD meant for a mesh whose bounding sphere is ScreenSize
+	// viewport heights across
+	unsigned int selectLod(float ScreenSize) const;
+	unsigned int getNumVertices(unsigned int Lod) const { return m_Lods[Lod].NumVertices; }
+	unsigned int getNumTriangles(unsigned int Lod) const;
+	// Palette slot i of the LOD holds the transform of bone getLodBones()[i]
+	const std::vector<unsigned int>& getLodBones(unsigned int Lod) const { return m_Lods[Lod].Bones; }
+	// Bounding sphere of the vertices in the bind pose
+	const Vector3f& getBoundsCenter() const { return m_BoundsCenter; }
+	float getBoundsRadius() const { return m_BoundsRadius; }
+	// Bounding sphere of every pose the clip can take, the bind pose bounds
+	// for meshes without bones
+	const Vector3f& getClipBoundsCenter(unsigned int ClipIndex) const;
+	float getClipBoundsRadius(unsigned int ClipIndex) const;
+	// Poses the skeleton with the given clip, clip 0 is the animation that
+	// came with the file passed to loadMesh
+	void boneTransform(float TimeInSeconds, std::vector<Matrix4f>& Transforms,
+					   unsigned int ClipIndex = 0);
+	// The same, but safe to call from several threads at once on one mesh as
+	// long as each passes its own Scratch
+	void boneTransform(float TimeInSeconds, std::vector<Matrix4f>& Transforms,
+					   unsigned int ClipIndex, std::vector<Matrix4f>& Scratch) const;
+	// boneTransform in two halves, for poses blended from several clips.
+	// sampleLocalPose fills Pose with the clip's local transforms, nodes the
+	// clip does not animate get their bind transform. composePose turns a
+	// pose made from these into bone matrices. Both are thread safe like
+	// the boneTransform above.
+	void sampleLocalPose(float TimeInSeconds, unsigned int ClipIndex, LocalPose& Pose) const;
+	void composePose(const LocalPose& Pose, std::vector<Matrix4f>& Transforms,
+					 std::vector<Matrix4f>& Scratch) const;
+	unsigned int getNumClips() const { return m_Clips.size(); }
+	unsigned int getNumBones() const { return m_NumBones; }
+	// Set before loading, since the clip bounds depend on it
+	void setSkinningMode(unsigned int Mode) { m_SkinningMode = Mode; }
+	unsigned int getSkinningMode() const { return m_SkinningMode; }
+	// Length of the clip in seconds
+	float getClipDuration(unsigned int ClipIndex) const;
 
-	void loadBones(unsigned int MeshIndex, const aiMesh* pMesh, std::vector<VertexBoneData>& Bones);
+	// Times boneTransform against the reference evaluator on every clip of
+	// the mesh and prints the largest difference between their poses
+	static int benchmarkPose(const std::string& Filename, unsigned int Iterations);
 
-protected:
+	// How far key reduction may stray from the source keys of clips
+	// imported from now on
+	static void setClipTolerance(const ClipTolerance& Tolerance) { s_clip_tolerance = Tolerance; }
+	static const ClipTolerance& getClipTolerance() { return s_clip_tolerance; }
+	// boneTransform only reads the compressed keys, so the source keys are
+	// dropped once a mesh is uploaded and not read from cooked files at all.
+	// Tools that compare against them turn this on.
+	static void setKeepSourceKeys(bool Keep) { s_keep_source_keys = Keep; }
+	// Skins the mesh with poses from the compressed and the source keys at
+	// NumSamples times per clip and prints how far apart the vertices end
+	// up, along with the sizes before and after compression
+	void reportClipError(unsigned int NumSamples);
 
-	bool initScene(const aiScene* pScene, const std::string& Filename);
-	virtual void initMesh(unsigned int MeshIndex, const aiMesh* paiMesh, std::vector<Vector3f>& Positions, 
-				 		  std::vector<Vector3f>& Normals, std::vector<Vector2f>& TexCoords,
-				  		  std::vector<VertexBoneData>& Bones, std::vector<unsigned int>& Indices);
-	bool initMaterials(const aiScene* pScene, const std::string& Filename);
-	void clear();
-	void interpolateRotation(aiQuaternion& Out, float AnimationTime, const aiNodeAnim* pNodeAnim);
-	void interpolatePosition(aiVector3D& Out, float AnimationTime, const aiNodeAnim* pNodeAnim);
-	void interpolateScaling(aiVector3D& Out, float AnimationTime, const aiNodeAnim* pNodeAnim);
-	unsigned int findRotationIndex(float AnimationTime, const aiNodeAnim* pNodeAnim);
-	unsigned int findPositionIndex(float AnimationTime, const aiNodeAnim* pNodeAnim);
-	unsigned int findScalingIndex(float AnimationTime, const aiNodeAnim* pNodeAnim);
-	void readNodeHierarchy(float AnimationTime, const aiNode* pNode, const Matrix4f& ParentTransform);
-	const aiNodeAnim* findNodeAnim(const aiAnimation* pAnimation, const std::string NodeName);
+	// Offline cooking. importMesh runs Assimp and keeps the resulting vertex
+	// and animation data on the CPU without touching OpenGL, saveCooked
+	// then writes it out in the format loadMesh picks up through mmap
+	bool importMesh(const std::string& Filename);
+	bool saveCooked(const std::string& CookedFilename);
+	static std::string getCookedFilename(const std::string& Filename);
 
+protected:
 	struct MeshEntry
 	{
 		MeshEntry()
@@ -81,30 +202,270 @@ protected:
 		unsigned int BaseVertex;
 		unsigned int BaseIndex;
 	};
+	// The entries of a LOD point past the full mesh's data in the vertex
+	// and index buffers, at the data buildLods appended for it
+	struct MeshLod
+	{
+		unsigned int FirstVertex;
+		unsigned int NumVertices;
+		std::vector<MeshEntry> Entries;
+		std::vector<unsigned int> Bones;	// the bone in each palette slot
+		float MinScreenSize;
+	};
+	// Engine owned copies of the aiScene node hierarchy and the first
+	// animation, so the importer does not have to stay alive and the same
+	// data can be stored in a cooked file. Keys are kept in one pool per
+	// key type and each channel points at its range.
+	struct NodeInfo
+	{
+		char Name[MESH_NAME_LENGTH];
+		Matrix4f Transformation;
+		unsigned int FirstChild;	// index into m_NodeChildren
+		unsigned int NumChildren;
+	};
+	struct ChannelInfo
+	{
+		char NodeName[MESH_NAME_LENGTH];
+		unsigned int FirstPositionKey;
+		unsigned int NumPositionKeys;
+		unsigned int FirstRotationKey;
+		unsigned int NumRotationKeys;
+		unsigned int FirstScalingKey;
+		unsigned int NumScalingKeys;
+	};
+	struct AnimationClip
+	{
+		AnimationClip()
+		{
+			Duration = 0.0f;
+			TicksPerSecond = 0.0f;
+			BoundsCenter = Vector3f(0.0f, 0.0f, 0.0f);
+			BoundsRadius = 0.0f;
+		}
+
+		float Duration;
+		float TicksPerSecond;
+		std::vector<ChannelInfo> Channels;
+		// The source keys, only kept for the reference evaluator
+		std::vector<aiVectorKey> PositionKeys;
+		std::vector<aiQuatKey> RotationKeys;
+		std::vector<aiVectorKey> ScalingKeys;
+		// What boneTransform samples: position, rotation and scaling track
+		// of each channel in turn, their keys in one stream in that order
+		std::vector<PackedTrack> Tracks;
+		std::vector<PackedKey> PackedKeys;
+		// The channel animating each node or -1, filled by bindClip
+		std::vector<int> NodeChannels;
+		// Filled by bindClip, see getClipBoundsCenter
+		Vector3f BoundsCenter;
+		float BoundsRadius;
+	};
+	// m_Nodes flattened for boneTransform. Parents always come before their
+	// children, so the skeleton is posed in a single pass over the array.
+	struct SkeletonNode
+	{
+		int Parent;
+		int Bone;
+	};
+
+	// Called once per MeshEntry after the vertex data is available, from
+	// either the importer or a cooked file. getPosition and getIndex read
+	// it back until uploadMesh, the indices are relative to the entry's
+	// first vertex.
+	virtual void initMesh(unsigned int MeshIndex);
+	const Vector3f& getPosition(unsigned int VertexIndex) const;
+	unsigned int getIndex(unsigned int Index) const;
+
+	bool initScene(const aiScene* pScene, const std::string& Filename);
+	void importVertices(unsigned int MeshIndex, const aiMesh* paiMesh);
+	void optimizeVertices(const std::string& Filename);
+	void packVertices(const std::string& Filename);
+	void loadBones(unsigned int MeshIndex, const aiMesh* pMesh);
+	void importMaterials(const aiScene* pScene, const std::string& Filename);
+	void importAnimation(const aiScene* pScene, AnimationClip& Clip);
+	void compressClip(AnimationClip& Clip);
+	void releaseSourceKeys();
+	unsigned int importNode(const aiNode* pNode);
+	// With AnimationOnly set, only the animation is read from the cooked file
+	// and appended to m_Clips, the rest of the mesh is left untouched
+	bool loadCooked(const std::string& CookedFilename, bool AnimationOnly = false);
+	void computeBounds();
+	// Fills m_Lods, simplifying the vertex data of skinned meshes
+	void buildLods();
+	// Which bone each bone is merged into after the given number of rounds
+	// of merging every leaf bone into its parent
+	void mergeLeafBones(unsigned int Rounds, std::vector<unsigned int>& Merged) const;
+	// The vertices of a merged bone move with the bone it is merged into,
+	// so that bone's sphere grows to take in the merged one's, at every LOD
+	void foldMergedBoneBounds();
+	bool initBuffers();
+	// Points the bound VAO at the vertex buffer
+	void setVertexAttributes();
+	void prepareMaterials();
+	bool initMaterials();
+	void clear();
+	void interpolateRotation(aiQuaternion& Out, float AnimationTime, const AnimationClip& Clip, const ChannelInfo& Channel);
+	void interpolatePosition(aiVector3D& Out, float AnimationTime, const AnimationClip& Clip, const ChannelInfo& Channel);
+	void interpolateScaling(aiVector3D& Out, float AnimationTime, const AnimationClip& Clip, const ChannelInfo& Channel);
+	unsigned int findRotationIndex(float AnimationTime, const AnimationClip& Clip, const ChannelInfo& Channel);
+	unsigned int findPositionIndex(float AnimationTime, const AnimationClip& Clip, const ChannelInfo& Channel);
+	unsigned int findScalingIndex(float AnimationTime, const AnimationClip& Clip, const ChannelInfo& Channel);
+	// Resolves node names to indices once the nodes, bones and clips are
+	// loaded, so posing never looks anything up by name
+	void bindSkeleton();
+	void bindClip(AnimationClip& Clip);
+	// Poses the clip over its whole length and bounds what the bone spheres
+	// sweep through
+	void computeClipBounds(AnimationClip& Clip);
+	// The clip time boneTransform samples the packed tracks at
+	float getPackedTime(const AnimationClip& Clip, float TimeInSeconds) const;
+	// Multiplies the node's local transform onto its parent's and, if the
+	// node is a bone, writes its skinning matrix to Transforms
+	void poseNode(unsigned int NodeIndex, const Matrix4f& Local, std::vector<Matrix4f>& Transforms,
+				  std::vector<Matrix4f>& Scratch) const;
+
+	// The original recursive evaluator that looks nodes up by name and scans
+	// keys linearly. Only used by benchmarkPose as the reference.
+	void boneTransformReference(float TimeInSeconds, std::vector<Matrix4f>& Transforms,
+								unsigned int ClipIndex);
+	void readNodeHierarchy(float AnimationTime, const AnimationClip& Clip, unsigned int NodeIndex,
+						   const Matrix4f& ParentTransform);
+	const ChannelInfo* findNodeAnim(const AnimationClip& Clip, const std::string NodeName);
+
+	enum { INDEX_BUFFER, VERTEX_BUFFER, NUM_BUFFERS };
+	enum VertexFormat { STATIC_VERTEX, SKINNED_VERTEX };
 
 	GLuint m_VAO;
-	GLuint m_Buffers[5];
+	GLuint m_Buffers[NUM_BUFFERS];
+	// Reads the output of skin, set up the first time renderSkinned runs
+	GLuint m_SkinnedVAO;
+	GLuint m_SkinnedBuffer;
+	// Reads the vertex buffer plus the instances of renderInstances
+	GLuint m_InstancedVAO;
+	GLuint m_InstanceBuffer;
+	unsigned int m_FirstInstance;
+	unsigned int m_NumVertices;
+	Vector3f m_BoundsCenter;
+	float m_BoundsRadius;
+	// Per bone, a sphere around the bind pose vertices it moves at any LOD.
+	// Skinning blends the bones' transforms of a vertex, so the posed vertex
+	// stays within the posed spheres of its bones.
+	struct BoneBounds
+	{
+		Vector3f Center;
+		float Radius;
+	};
+	std::vector<BoneBounds> m_BoneBounds;
+	// Per pair of bones that move the same vertices, a sphere around those
+	// vertices. Dual quaternion skinning does not keep a vertex within the
+	// posed spheres of its bones, and these bound how far it can stray.
+	struct BoneLink
+	{
+		unsigned int Bones[2];
+		Vector3f Center;
+		float Radius;
+	};
+	std::vector<BoneLink> m_BoneLinks;
+	std::vector<MeshLod> m_Lods;
+	// What buildLods adds to the vertex and index data, only filled between
+	// importMesh and uploadMesh
+	std::vector<unsigned char> m_LodVertices;
+	std::vector<unsigned char> m_LodIndices;
 
-	const aiScene* m_pScene;
-	Assimp::Importer m_Importer;
 	Matrix4f m_GlobalInverseTransform;
 	std::vector<MeshEntry> m_Entries;
 	std::vector<Texture*> m_Textures;
+	std::vector<std::string> m_TexturePaths;
 	std::map<std::string, unsigned int> m_BoneMapping;
 	unsigned int m_NumBones;
 	std::vector<BoneInfo> m_BoneInfo;
+	unsigned int m_SkinningMode;
+
+	unsigned int m_VertexFormat;
+	unsigned int m_VertexSize;
+	unsigned int m_IndexSize;	// 2 when every index fits in 16 bits, else 4
+
+	// Only used while importing, packVertices turns them into the packed
+	// streams below
+	std::vector<Vertex> m_Vertices;
+	std::vector<unsigned int> m_Indices;
+	// Only filled between importMesh and uploadMesh
+	std::vector<unsigned char> m_PackedVertices;
+	std::vector<unsigned char> m_PackedIndices;
+	// Set by prepareMesh to either the packed vectors above or the cooked
+	// file's mapping, and released again by uploadMesh
+	MappedFile m_CookedFile;
+	const unsigned char* m_pVertexData;
+	unsigned int m_NumVertexData;
+	const unsigned char* m_pIndexData;
+	unsigned int m_NumIndexData;
+	// The same for the LODs, which follow the full mesh in the buffers
+	const unsigned char* m_pLodVertexData;
+	unsigned int m_NumLodVertexData;
+	const unsigned char* m_pLodIndexData;
+	unsigned int m_NumLodIndexData;
+
+	std::vector<NodeInfo> m_Nodes;
+	std::vector<unsigned int> m_NodeChildren;
+	std::vector<AnimationClip> m_Clips;
+	std::vector<SkeletonNode> m_Skeleton;
+	std::vector<Matrix4f> m_GlobalTransforms;	// scratch for single threaded boneTransform
+	LocalPose m_BindPose;	// m_Nodes' transforms, decomposed by bindSkeleton
+
+	static ClipTolerance s_clip_tolerance;
+	static bool s_keep_source_keys;
+};
+
+// A character whose animations live in separate files that all share the
+// same geometry and skeleton. The geometry is loaded once by loadMesh and
+// every further file only contributes its animation as another clip, so
+// switching animations never switches buffers.
+class SkinnedMesh : public Mesh
+{
+public:
+	// Returns false if the file could not be read or has no animation
+	bool loadClip(const std::string& Filename);
+
+protected:
+	bool importClip(const std::string& Filename);
 };
 
+// A static mesh with a triangle collider. Building the collider's BVH is the
+// slow part of loading these, so built BVHs are cached on disk under
+// bvh_cache/, keyed by a hash of the triangles they were built from.
 class TerrainMesh : public Mesh
 {
 public:
-	void initMesh(unsigned int MeshIndex, const aiMesh* paiMesh, std::vector<Vector3f>& Positions, 
-		 		  std::vector<Vector3f>& Normals, std::vector<Vector2f>& TexCoords,
-		  		  std::vector<VertexBoneData>& Bones, std::vector<unsigned int>& Indices);
+	TerrainMesh();
+	~TerrainMesh();
 	btBvhTriangleMeshShape* getTerrainCollisionBody() { return m_terrain_mesh; }
 
+	// Seconds spent building or loading the BVH during the last load
+	float getBvhTime() const { return m_bvh_time; }
+	bool isBvhFromCache() const { return m_is_bvh_from_cache; }
+
+	// The cache is on by default, the benchmark turns it off to time cold builds
+	static void setBvhCacheEnabled(bool enabled) { s_is_bvh_cache_enabled = enabled; }
+	// Compares building the BVHs of the given meshes with loading them from
+	// the cache, which it fills on the way
+	static int benchmarkBvhCache(const std::vector<std::string>& Filenames);
+
+protected:
+	void initMesh(unsigned int MeshIndex);
+
 private:
-	btTriangleMesh m_triangle_mesh;
+	std::string getBvhCacheFilename() const;
+	bool loadBvh();
+	void saveBvh();
+	void releaseCollision();
+
+	btTriangleMesh* m_triangle_mesh;
 	btBvhTriangleMeshShape* m_terrain_mesh;
+	unsigned long long m_triangle_hash;
+	void* m_bvh_buffer;	// backs a BVH deserialized from the cache
+	float m_bvh_time;
+	bool m_is_bvh_from_cache;
+
+	static bool s_is_bvh_cache_enabled;
 };
 #endif
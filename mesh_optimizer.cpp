@@ -0,0 +1,536 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include "mesh_optimizer.hpp"
+
+// Size of the LRU cache optimizeVertexCache models, and of the FIFO cache
+// used to measure the result
+#define VERTEX_CACHE_SIZE 32
+#define MEASURED_CACHE_SIZE 16
+
+// The finest grid simplifyClusters tries, in cells along the longest side
+#define MAX_CLUSTER_GRID 1024
+
+namespace
+{
+	unsigned int hashVertex(const unsigned char* pVertex, unsigned int VertexSize)
+	{
+		unsigned int Hash = 2166136261u;
+		for(unsigned int i = 0; i < VertexSize; i++)
+		{
+			Hash ^= pVertex[i];
+			Hash *= 16777619u;
+		}
+		return Hash;
+	}
+
+	// Forsyth's vertex score. Vertices of the last triangle get a fixed low
+	// score so the next triangle does not simply reuse the same edge, and
+	// vertices with few triangles left get a boost so they are finished off
+	// instead of leaving stragglers.
+	float vertexScore(int CachePosition, unsigned int Valence)
+	{
+		if(Valence == 0)
+		{
+			return -1.0f;
+		}
+
+		float Score = 0.0f;
+		if(CachePosition >= 3)
+		{
+			float Scale = 1.0f / (VERTEX_CACHE_SIZE - 3);
+			Score = powf(1.0f - (CachePosition - 3) * Scale, 1.5f);
+		}
+		else if(CachePosition >= 0)
+		{
+			Score = 0.75f;
+		}
+
+		return Score + 2.0f / sqrtf((float)Valence);
+	}
+
+	// A FIFO cache that remembers when each vertex was last transformed
+	// instead of storing the entries
+	class FifoCache
+	{
+	public:
+		FifoCache(unsigned int NumVertices)
+			: m_timestamps(NumVertices, 0),
+			  m_time(MEASURED_CACHE_SIZE + 1)
+		{
+		}
+
+		// Returns true on a miss
+		bool access(unsigned int Vertex)
+		{
+			if(m_time - m_timestamps[Vertex] > MEASURED_CACHE_SIZE)
+			{
+				m_timestamps[Vertex] = m_time++;
+				return true;
+			}
+			return false;
+		}
+
+	private:
+		std::vector<unsigned int> m_timestamps;
+		unsigned int m_time;
+	};
+
+	struct Cluster
+	{
+		unsigned int FirstIndex;
+		unsigned int NumIndices;
+		float SortKey;
+	};
+
+	bool drawnBefore(const Cluster& a, const Cluster& b)
+	{
+		return a.SortKey > b.SortKey;
+	}
+
+	const float* getPosition(const float* pPositions, unsigned int Stride, unsigned int Vertex)
+	{
+		return (const float*)((const char*)pPositions + Vertex * Stride);
+	}
+
+	// Twice the area weighted normal of the triangle
+	void triangleNormal(const float* a, const float* b, const float* c, float* pNormal)
+	{
+		float u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		pNormal[0] = u[1] * v[2] - u[2] * v[1];
+		pNormal[1] = u[2] * v[0] - u[0] * v[2];
+		pNormal[2] = u[0] * v[1] - u[1] * v[0];
+	}
+
+	// Fills Representative with the vertex each one collapses onto, the one
+	// nearest the average of its cell. The grid has Grid cells along Extent,
+	// vertices on the far faces go in the last cell.
+	void clusterVertices(const float* pPositions, unsigned int Stride, unsigned int NumVertices,
+						 const float Min[3], float Extent, unsigned int Grid, std::vector<unsigned int>& Representative)
+	{
+		std::map<unsigned long long, unsigned int> Cells;
+		std::vector<unsigned int> Cell(NumVertices);
+		std::vector<float> Sums;
+		std::vector<unsigned int> Counts;
+		for(unsigned int i = 0; i < NumVertices; i++)
+		{
+			const float* p = getPosition(pPositions, Stride, i);
+			unsigned long long Key = 0;
+			for(unsigned int c = 0; c < 3; c++)
+			{
+				unsigned long long Coordinate = (unsigned long long)((p[c] - Min[c]) / Extent * Grid);
+				Key = Key << 21 | std::min(Coordinate, Grid - 1ull);
+			}
+
+			std::map<unsigned long long, unsigned int>::iterator it = Cells.find(Key);
+			if(it == Cells.end())
+			{
+				it = Cells.insert(std::make_pair(Key, (unsigned int)Counts.size())).first;
+				Counts.push_back(0);
+				Sums.resize(Sums.size() + 3, 0.0f);
+			}
+			Cell[i] = it->second;
+			Counts[it->second]++;
+			for(unsigned int c = 0; c < 3; c++)
+			{
+				Sums[it->second * 3 + c] += p[c];
+			}
+		}
+
+		std::vector<float> Distances(Counts.size(), -1.0f);
+		Representative.assign(Counts.size(), 0);
+		for(unsigned int i = 0; i < NumVertices; i++)
+		{
+			const float* p = getPosition(pPositions, Stride, i);
+			unsigned int c = Cell[i];
+			float Distance = 0.0f;
+			for(unsigned int j = 0; j < 3; j++)
+			{
+				float d = p[j] - Sums[c * 3 + j] / Counts[c];
+				Distance += d * d;
+			}
+			if(Distances[c] < 0.0f || Distance < Distances[c])
+			{
+				Distances[c] = Distance;
+				Representative[c] = i;
+			}
+		}
+
+		for(unsigned int i = 0; i < NumVertices; i++)
+		{
+			Cell[i] = Representative[Cell[i]];
+		}
+		Representative.swap(Cell);
+	}
+
+	void collapseTriangles(const std::vector<unsigned int>& Indices, const std::vector<unsigned int>& Representative,
+						   std::vector<unsigned int>& Output)
+	{
+		Output.clear();
+		for(unsigned int i = 0; i + 2 < Indices.size(); i += 3)
+		{
+			unsigned int a = Representative[Indices[i]];
+			unsigned int b = Representative[Indices[i + 1]];
+			unsigned int c = Representative[Indices[i + 2]];
+			if(a != b && b != c && c != a)
+			{
+				Output.push_back(a);
+				Output.push_back(b);
+				Output.push_back(c);
+			}
+		}
+	}
+}
+
+unsigned int weldVertices(std::vector<unsigned int>& Indices, const void* pVertices,
+						  unsigned int NumVertices, unsigned int VertexSize,
+						  std::vector<unsigned int>& Remap)
+{
+	const unsigned char* pBytes = (const unsigned char*)pVertices;
+
+	// Open addressing table of old vertex indices, at most half full
+	unsigned int TableSize = 1;
+	while(TableSize < NumVertices * 2)
+	{
+		TableSize *= 2;
+	}
+	std::vector<unsigned int> Table(TableSize, INVALID_VERTEX);
+
+	Remap.assign(NumVertices, INVALID_VERTEX);
+	unsigned int NumUnique = 0;
+	for(unsigned int i = 0; i < NumVertices; i++)
+	{
+		const unsigned char* pVertex = pBytes + i * VertexSize;
+		unsigned int Slot = hashVertex(pVertex, VertexSize) & (TableSize - 1);
+		while(Table[Slot] != INVALID_VERTEX &&
+			  memcmp(pBytes + Table[Slot] * VertexSize, pVertex, VertexSize) != 0)
+		{
+			Slot = (Slot + 1) & (TableSize - 1);
+		}
+
+		if(Table[Slot] == INVALID_VERTEX)
+		{
+			Table[Slot] = i;
+			Remap[i] = NumUnique++;
+		}
+		else
+		{
+			Remap[i] = Remap[Table[Slot]];
+		}
+	}
+
+	for(unsigned int i = 0; i < Indices.size(); i++)
+	{
+		Indices[i] = Remap[Indices[i]];
+	}
+
+	return NumUnique;
+}
+
+void optimizeVertexCache(std::vector<unsigned int>& Indices, unsigned int NumVertices)
+{
+	unsigned int NumTriangles = Indices.size() / 3;
+
+	// The triangles of every vertex. The ones not emitted yet are kept at the
+	// front of each vertex's range and Valence counts them.
+	std::vector<unsigned int> Valence(NumVertices, 0);
+	for(unsigned int i = 0; i < Indices.size(); i++)
+	{
+		Valence[Indices[i]]++;
+	}
+
+	std::vector<unsigned int> FirstTriangle(NumVertices + 1, 0);
+	for(unsigned int i = 0; i < NumVertices; i++)
+	{
+		FirstTriangle[i + 1] = FirstTriangle[i] + Valence[i];
+	}
+
+	std::vector<unsigned int> VertexTriangles(Indices.size());
+	std::vector<unsigned int> Fill(FirstTriangle.begin(), FirstTriangle.end() - 1);
+	for(unsigned int i = 0; i < Indices.size(); i++)
+	{
+		VertexTriangles[Fill[Indices[i]]++] = i / 3;
+	}
+
+	std::vector<int> CachePosition(NumVertices, -1);
+	std::vector<float> Score(NumVertices);
+	for(unsigned int i = 0; i < NumVertices; i++)
+	{
+		Score[i] = vertexScore(-1, Valence[i]);
+	}
+
+	std::vector<bool> IsEmitted(NumTriangles, false);
+	std::vector<unsigned int> Output;
+	Output.reserve(NumTriangles * 3);
+
+	unsigned int Cache[VERTEX_CACHE_SIZE + 3];
+	unsigned int CacheCount = 0;
+	unsigned int Cursor = 0;
+	int Best = -1;
+
+	while(Output.size() < NumTriangles * 3)
+	{
+		// Nothing in the cache has triangles left, so start over with the
+		// next triangle in the original order
+		if(Best < 0)
+		{
+			while(IsEmitted[Cursor])
+			{
+				Cursor++;
+			}
+			Best = Cursor;
+		}
+
+		const unsigned int* pTriangle = &Indices[Best * 3];
+		Output.insert(Output.end(), pTriangle, pTriangle + 3);
+		IsEmitted[Best] = true;
+
+		for(unsigned int k = 0; k < 3; k++)
+		{
+			unsigned int Vertex = pTriangle[k];
+			unsigned int* pList = &VertexTriangles[FirstTriangle[Vertex]];
+			for(unsigned int j = 0; j < Valence[Vertex]; j++)
+			{
+				if(pList[j] == (unsigned int)Best)
+				{
+					std::swap(pList[j], pList[Valence[Vertex] - 1]);
+					Valence[Vertex]--;
+					break;
+				}
+			}
+		}
+
+		// The triangle's vertices move to the front of the cache
+		unsigned int NewCache[VERTEX_CACHE_SIZE + 3];
+		unsigned int NewCount = 0;
+		for(unsigned int k = 0; k < 3; k++)
+		{
+			if(std::find(NewCache, NewCache + NewCount, pTriangle[k]) == NewCache + NewCount)
+			{
+				NewCache[NewCount++] = pTriangle[k];
+			}
+		}
+		for(unsigned int j = 0; j < CacheCount; j++)
+		{
+			if(std::find(pTriangle, pTriangle + 3, Cache[j]) == pTriangle + 3)
+			{
+				NewCache[NewCount++] = Cache[j];
+			}
+		}
+
+		for(unsigned int j = VERTEX_CACHE_SIZE; j < NewCount; j++)
+		{
+			CachePosition[NewCache[j]] = -1;
+			Score[NewCache[j]] = vertexScore(-1, Valence[NewCache[j]]);
+		}
+
+		CacheCount = std::min(NewCount, (unsigned int)VERTEX_CACHE_SIZE);
+		for(unsigned int j = 0; j < CacheCount; j++)
+		{
+			Cache[j] = NewCache[j];
+			CachePosition[Cache[j]] = j;
+			Score[Cache[j]] = vertexScore(j, Valence[Cache[j]]);
+		}
+
+		// Only triangles touching the cache changed score, the best of them
+		// goes next
+		Best = -1;
+		float BestScore = -1.0f;
+		for(unsigned int j = 0; j < CacheCount; j++)
+		{
+			unsigned int Vertex = Cache[j];
+			const unsigned int* pList = &VertexTriangles[FirstTriangle[Vertex]];
+			for(unsigned int t = 0; t < Valence[Vertex]; t++)
+			{
+				const unsigned int* pCandidate = &Indices[pList[t] * 3];
+				float TriangleScore = Score[pCandidate[0]] + Score[pCandidate[1]] + Score[pCandidate[2]];
+				if(TriangleScore > BestScore)
+				{
+					BestScore = TriangleScore;
+					Best = pList[t];
+				}
+			}
+		}
+	}
+
+	Indices.swap(Output);
+}
+
+void optimizeOverdraw(std::vector<unsigned int>& Indices, const float* pPositions,
+					  unsigned int Stride, unsigned int NumVertices)
+{
+	// Split where a triangle misses the cache with all three vertices, so
+	// moving whole clusters around keeps the cache order inside them
+	std::vector<Cluster> Clusters;
+	FifoCache Cache(NumVertices);
+	for(unsigned int i = 0; i < Indices.size(); i += 3)
+	{
+		unsigned int Misses = Cache.access(Indices[i]) + Cache.access(Indices[i + 1]) +
+							  Cache.access(Indices[i + 2]);
+		if(Clusters.empty() || Misses == 3)
+		{
+			Cluster NewCluster = { i, 0, 0.0f };
+			Clusters.push_back(NewCluster);
+		}
+		Clusters.back().NumIndices += 3;
+	}
+
+	if(Clusters.size() < 2)
+	{
+		return;
+	}
+
+	float MeshCenter[3] = { 0.0f, 0.0f, 0.0f };
+	float MeshArea = 0.0f;
+	std::vector<float> ClusterData(Clusters.size() * 7, 0.0f);	// center, normal, area
+
+	for(unsigned int c = 0; c < Clusters.size(); c++)
+	{
+		float* pData = &ClusterData[c * 7];
+		for(unsigned int i = Clusters[c].FirstIndex; i < Clusters[c].FirstIndex + Clusters[c].NumIndices; i += 3)
+		{
+			const float* a = getPosition(pPositions, Stride, Indices[i]);
+			const float* b = getPosition(pPositions, Stride, Indices[i + 1]);
+			const float* d = getPosition(pPositions, Stride, Indices[i + 2]);
+
+			float Normal[3];
+			triangleNormal(a, b, d, Normal);
+			float Area = sqrtf(Normal[0] * Normal[0] + Normal[1] * Normal[1] + Normal[2] * Normal[2]);
+
+			for(unsigned int k = 0; k < 3; k++)
+			{
+				float Center = (a[k] + b[k] + d[k]) / 3.0f;
+				pData[k] += Center * Area;
+				pData[3 + k] += Normal[k];
+				MeshCenter[k] += Center * Area;
+			}
+			pData[6] += Area;
+			MeshArea += Area;
+		}
+	}
+
+	for(unsigned int k = 0; k < 3 && MeshArea > 0.0f; k++)
+	{
+		MeshCenter[k] /= MeshArea;
+	}
+
+	// Clusters facing away from the center are on the outside of the mesh
+	// and are likely to occlude the rest, so they are drawn first
+	for(unsigned int c = 0; c < Clusters.size(); c++)
+	{
+		const float* pData = &ClusterData[c * 7];
+		float NormalLength = sqrtf(pData[3] * pData[3] + pData[4] * pData[4] + pData[5] * pData[5]);
+		if(pData[6] <= 0.0f || NormalLength <= 0.0f)
+		{
+			continue;
+		}
+
+		float Key = 0.0f;
+		for(unsigned int k = 0; k < 3; k++)
+		{
+			Key += (pData[k] / pData[6] - MeshCenter[k]) * pData[3 + k] / NormalLength;
+		}
+		Clusters[c].SortKey = Key;
+	}
+
+	std::stable_sort(Clusters.begin(), Clusters.end(), drawnBefore);
+
+	std::vector<unsigned int> Output;
+	Output.reserve(Indices.size());
+	for(unsigned int c = 0; c < Clusters.size(); c++)
+	{
+		Output.insert(Output.end(), Indices.begin() + Clusters[c].FirstIndex,
+					  Indices.begin() + Clusters[c].FirstIndex + Clusters[c].NumIndices);
+	}
+
+	Indices.swap(Output);
+}
+
+unsigned int optimizeVertexFetch(std::vector<unsigned int>& Indices, unsigned int NumVertices,
+								 std::vector<unsigned int>& Remap)
+{
+	Remap.assign(NumVertices, INVALID_VERTEX);
+	unsigned int NumUsed = 0;
+	for(unsigned int i = 0; i < Indices.size(); i++)
+	{
+		if(Remap[Indices[i]] == INVALID_VERTEX)
+		{
+			Remap[Indices[i]] = NumUsed++;
+		}
+		Indices[i] = Remap[Indices[i]];
+	}
+
+	return NumUsed;
+}
+
+void simplifyClusters(std::vector<unsigned int>& Indices, const float* pPositions, unsigned int Stride,
+					  unsigned int NumVertices, unsigned int TargetIndices)
+{
+	if(Indices.size() <= TargetIndices || NumVertices == 0)
+	{
+		return;
+	}
+
+	float Min[3], Max[3];
+	for(unsigned int c = 0; c < 3; c++)
+	{
+		Min[c] = Max[c] = pPositions[c];
+	}
+	for(unsigned int i = 1; i < NumVertices; i++)
+	{
+		const float* p = getPosition(pPositions, Stride, i);
+		for(unsigned int c = 0; c < 3; c++)
+		{
+			Min[c] = std::min(Min[c], p[c]);
+			Max[c] = std::max(Max[c], p[c]);
+		}
+	}
+	float Extent = std::max(Max[0] - Min[0], std::max(Max[1] - Min[1], Max[2] - Min[2]));
+	if(Extent <= 0.0f)
+	{
+		return;
+	}
+
+	// Finer grids keep more triangles, so search for the finest that fits.
+	// A single cell would collapse everything, so the coarsest grid tried
+	// has two cells along the longest side. When even that does not fit,
+	// the search ends on it and its triangles are kept instead.
+	std::vector<unsigned int> Representative;
+	std::vector<unsigned int> Candidate;
+	std::vector<unsigned int> Best;
+	bool Found = false;
+	unsigned int Low = 2;
+	unsigned int High = MAX_CLUSTER_GRID;
+	while(Low <= High)
+	{
+		unsigned int Grid = (Low + High) / 2;
+		clusterVertices(pPositions, Stride, NumVertices, Min, Extent, Grid, Representative);
+		collapseTriangles(Indices, Representative, Candidate);
+		if(Candidate.size() <= TargetIndices)
+		{
+			Best.swap(Candidate);
+			Found = true;
+			Low = Grid + 1;
+		}
+		else
+		{
+			High = Grid - 1;
+		}
+	}
+
+	Indices.swap(Found ? Best : Candidate);
+}
+
+unsigned int countCacheMisses(const std::vector<unsigned int>& Indices, unsigned int NumVertices)
+{
+	FifoCache Cache(NumVertices);
+	unsigned int Misses = 0;
+	for(unsigned int i = 0; i < Indices.size(); i++)
+	{
+		Misses += Cache.access(Indices[i]);
+	}
+
+	return Misses;
+}
@@ -0,0 +1,64 @@
+#ifndef MESH_OPTIMIZER_HPP
+#define MESH_OPTIMIZER_HPP
+
+#include <vector>
+
+/* Optimizations run on every imported mesh, one indexed triangle list at a
+time, in this order:
+
+	weldVertices          merge bitwise identical vertices
+	optimizeVertexCache   reorder triangles for the post transform cache
+	optimizeOverdraw      reorder clusters of triangles so outward facing
+	                      ones are drawn first
+	optimizeVertexFetch   renumber vertices in the order they are first used
+
+The LODs of skinned meshes are made with simplifyClusters first, then go
+through the last three passes.
+
+The two functions that renumber vertices rewrite the indices and fill Remap
+with the new index of every old vertex, remapVertices then moves the vertex
+data to match. */
+
+#define INVALID_VERTEX 0xFFFFFFFF
+
+// Returns the number of unique vertices, they are numbered in the order of
+// their first occurrence
+unsigned int weldVertices(std::vector<unsigned int>& Indices, const void* pVertices,
+						  unsigned int NumVertices, unsigned int VertexSize,
+						  std::vector<unsigned int>& Remap);
+void optimizeVertexCache(std::vector<unsigned int>& Indices, unsigned int NumVertices);
+// pPositions points at the x of the first vertex's position, Stride is the
+// distance in bytes between two positions
+void optimizeOverdraw(std::vector<unsigned int>& Indices, const float* pPositions,
+					  unsigned int Stride, unsigned int NumVertices);
+// Returns the number of vertices used, unused ones are remapped to
+// INVALID_VERTEX
+unsigned int optimizeVertexFetch(std::vector<unsigned int>& Indices, unsigned int NumVertices,
+								 std::vector<unsigned int>& Remap);
+
+// Vertex clustering: every vertex is moved onto one representative vertex
+// of the grid cell it falls in, and the triangles left with fewer than three
+// corners are dropped. The grid is the finest that leaves at most
+// TargetIndices indices, or the coarsest one tried if none does. Indices
+// keep pointing into the original vertices, the ones no longer used are
+// dropped by optimizeVertexFetch.
+void simplifyClusters(std::vector<unsigned int>& Indices, const float* pPositions, unsigned int Stride,
+					  unsigned int NumVertices, unsigned int TargetIndices);
+
+// Transformed vertices with a 16 entry FIFO cache, divide by the number of
+// triangles for the ACMR
+unsigned int countCacheMisses(const std::vector<unsigned int>& Indices, unsigned int NumVertices);
+
+template <typename T>
+void remapVertices(const T* pSrc, unsigned int NumVertices, const std::vector<unsigned int>& Remap, T* pDst)
+{
+	for(unsigned int i = 0; i < NumVertices; i++)
+	{
+		if(Remap[i] != INVALID_VERTEX)
+		{
+			pDst[Remap[i]] = pSrc[i];
+		}
+	}
+}
+
+#endif
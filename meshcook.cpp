@@ -0,0 +1,90 @@
+/* Offline mesh cooker. Runs each source asset through the same Assimp import
+as the game and writes the result next to it as a .cmesh file, which
+Mesh::loadMesh then maps directly instead of parsing the source again.
+
+Animation clips are compressed on the way, within the tolerances given
+before the meshes (see ClipTolerance), and the error this introduces on the
+skinned vertices is printed for each clip. Skinned meshes get their chain of
+LODs built and cooked too, and the size of each is printed.
+
+Usage: meshcook [--position-error e] [--rotation-error radians]
+                [--scale-error e] file.obj [file.dae ...] */
+
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <SFML/System.hpp>
+#include "mesh.hpp"
+
+int main(int argc, char** argv)
+{
+	ClipTolerance Tolerance = Mesh::getClipTolerance();
+	int First = 1;
+	for(; First + 1 < argc && strncmp(argv[First], "--", 2) == 0; First += 2)
+	{
+		float Value = atof(argv[First + 1]);
+		if(strcmp(argv[First], "--position-error") == 0)
+		{
+			Tolerance.Position = Value;
+		}
+		else if(strcmp(argv[First], "--rotation-error") == 0)
+		{
+			Tolerance.Rotation = Value;
+		}
+		else if(strcmp(argv[First], "--scale-error") == 0)
+		{
+			Tolerance.Scaling = Value;
+		}
+		else
+		{
+			std::cerr << "Unknown option " << argv[First] << std::endl;
+			return 1;
+		}
+	}
+
+	if(First >= argc)
+	{
+		std::cerr << "Usage: " << argv[0] << " [--position-error e] [--rotation-error radians] "
+				  << "[--scale-error e] mesh [mesh ...]" << std::endl;
+		return 1;
+	}
+
+	Mesh::setClipTolerance(Tolerance);
+
+	int Ret = 0;
+
+	for(int i = First; i < argc; i++)
+	{
+		std::string Filename(argv[i]);
+		std::string CookedFilename = Mesh::getCookedFilename(Filename);
+
+		sf::Clock timer;
+		Mesh mesh;
+		if(!mesh.importMesh(Filename))
+		{
+			Ret = 1;
+			continue;
+		}
+		float importTime = timer.getElapsedTime().asSeconds();
+
+		if(!mesh.saveCooked(CookedFilename))
+		{
+			Ret = 1;
+			continue;
+		}
+
+		printf("%-28s -> %-28s import %.1f ms\n", Filename.c_str(), CookedFilename.c_str(),
+			   importTime * 1000.0f);
+		for(unsigned int j = 0; j < mesh.getNumLods(); j++)
+		{
+			printf("%-28s LOD %u: %6u triangles, %6u vertices, %3u bones\n", Filename.c_str(), j,
+				   mesh.getNumTriangles(j), mesh.getNumVertices(j), (unsigned int)mesh.getLodBones(j).size());
+		}
+		if(mesh.getNumClips() > 0)
+		{
+			mesh.reportClipError(120);
+		}
+	}
+
+	return Ret;
+}
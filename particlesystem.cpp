@@ -4,22 +4,36 @@
 #include <SFML/OpenGL.hpp>
 #include <SFML/Graphics.hpp>
 #include "particlesystem.hpp"
+#include "trace.hpp"
 
 ParticleSystem::ParticleSystem(std::string texture_filename)
 	: m_particle_system_lifetime(5.0f),
 	  m_position(0.0f, 0.0f, 0.0f),
 	  m_num_particles(0),
-	  m_texture_filename(texture_filename)
+	  m_texture_filename(texture_filename),
+	  m_texture(NULL)
 {
 	srand((int)time(NULL));
 }
 
 ParticleSystem::~ParticleSystem()
 {
+	TextureCache::Release(m_texture);
+}
+
+// The explosion and starburst images are each used by two systems, so they
+// come from the shared cache instead of being loaded per system
+void ParticleSystem::initTexture()
+{
+	m_texture = TextureCache::Acquire(m_texture_filename, GL_NEAREST);
+	m_texture->Decode();
+	m_texture->Upload();
 }
 
 void ParticleSystem::init()
 {
+	TraceScope scope("init", "particles " + m_texture_filename);
+
 	for(int i = 0; i < MAX_PARTICLES; i++)
 	{
 		//m_particles[i].m_start_time = 0.0;
@@ -36,18 +50,9 @@ void ParticleSystem::init()
 	glGenBuffers(1, &m_VBO);
 	glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(m_particles), m_particles, GL_STATIC_DRAW);
+	Trace::addBytesUploaded(sizeof(m_particles));
 
-	if(!m_image.loadFromFile(m_texture_filename))
-	{
-		std::cerr << "Error loading texture " << m_texture_filename << std::endl;
-	}
-
-	glGenTextures(1, &m_particle_texture);
-	glBindTexture(GL_TEXTURE_2D, m_particle_texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_image.getSize().x, m_image.getSize().y, 0, GL_RGBA,
-				 GL_UNSIGNED_BYTE, m_image.getPixelsPtr());
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	initTexture();
 
 	glPointSize(15.0f);
 	glEnable(GL_POINT_SPRITE);
@@ -56,6 +61,8 @@ void ParticleSystem::init()
 
 void ParticleSystem::init2()
 {
+	TraceScope scope("init", "particles " + m_texture_filename);
+
 	for(int i = 0; i < MAX_PARTICLES; i++)
 	{
 		//m_particles[i].m_start_time = 0.0;
@@ -74,18 +81,9 @@ void ParticleSystem::init2()
 	glGenBuffers(1, &m_VBO);
 	glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(m_particles), m_particles, GL_STATIC_DRAW);
+	Trace::addBytesUploaded(sizeof(m_particles));
 
-	if(!m_image.loadFromFile(m_texture_filename))
-	{
-		std::cerr << "Error loading texture " << m_texture_filename << std::endl;
-	}
-
-	glGenTextures(1, &m_particle_texture);
-	glBindTexture(GL_TEXTURE_2D, m_particle_texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_image.getSize().x, m_image.getSize().y, 0, GL_RGBA,
-				 GL_UNSIGNED_BYTE, m_image.getPixelsPtr());
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	initTexture();
 
 	glPointSize(15.0f);
 	glEnable(GL_POINT_SPRITE);
@@ -102,8 +100,7 @@ void ParticleSystem::render(float particleSize)
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, m_particle_texture);
+	m_texture->Bind(GL_TEXTURE0);
 	glTexEnvi(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_TRUE);
 	glDepthMask(GL_FALSE);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
@@ -3,6 +3,7 @@
 
 #include <string>
 #include "glm/glm.hpp"
+#include "texture.h"
 
 #define MAX_PARTICLES 180
 
@@ -37,14 +38,15 @@ public:
 	void render(float particleSize);
 
 private:
+	void initTexture();
+
 	float m_particle_system_lifetime;
 	unsigned int m_num_particles;
 	Particle m_particles[MAX_PARTICLES];
 	glm::vec3 m_position;
-	sf::Image m_image;
 	std::string m_texture_filename;
 	GLuint m_VBO;
-	GLuint m_particle_texture;
+	Texture* m_texture;
 };
 
 #endif
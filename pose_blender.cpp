@@ -0,0 +1,343 @@
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "pose_blender.hpp"
+
+// Like the kernels in math_3d, every SSE kernel has a scalar twin that does
+// the same operations in the same order, built when SSE is not available
+
+void LocalPose::resize(unsigned int Count)
+{
+	NumNodes = Count;
+	Stride = std::max((Count + 3) / 4 * 4, 4u);
+	Values.assign(Stride * NUM_POSE_STREAMS, 0.0f);
+	std::fill(&Values[POSE_RW * Stride], &Values[POSE_RW * Stride] + Stride, 1.0f);
+	std::fill(&Values[POSE_SX * Stride], &Values[POSE_SX * Stride] + Stride * 3, 1.0f);
+	Animated.assign(Count, 0);
+}
+
+void LocalPose::setNode(unsigned int Node, const Vector3f& Translation, const Quaternion& Rotation,
+						const Vector3f& Scaling)
+{
+	float* p = &Values[Node];
+	p[POSE_TX * Stride] = Translation.x;
+	p[POSE_TY * Stride] = Translation.y;
+	p[POSE_TZ * Stride] = Translation.z;
+	p[POSE_RX * Stride] = Rotation.x;
+	p[POSE_RY * Stride] = Rotation.y;
+	p[POSE_RZ * Stride] = Rotation.z;
+	p[POSE_RW * Stride] = Rotation.w;
+	p[POSE_SX * Stride] = Scaling.x;
+	p[POSE_SY * Stride] = Scaling.y;
+	p[POSE_SZ * Stride] = Scaling.z;
+}
+
+void LocalPose::getNode(unsigned int Node, Vector3f& Translation, Quaternion& Rotation,
+						Vector3f& Scaling) const
+{
+	const float* p = &Values[Node];
+	Translation = Vector3f(p[POSE_TX * Stride], p[POSE_TY * Stride], p[POSE_TZ * Stride]);
+	Rotation = Quaternion(p[POSE_RX * Stride], p[POSE_RY * Stride], p[POSE_RZ * Stride], p[POSE_RW * Stride]);
+	Scaling = Vector3f(p[POSE_SX * Stride], p[POSE_SY * Stride], p[POSE_SZ * Stride]);
+}
+
+void clearPose(LocalPose& Pose)
+{
+	memset(&Pose.Values[0], 0, Pose.Values.size() * sizeof(float));
+	std::fill(Pose.Animated.begin(), Pose.Animated.end(), 0);
+}
+
+namespace
+{
+	// The streams that are blended linearly
+	const unsigned int LinearStreams[] = { POSE_TX, POSE_TY, POSE_TZ, POSE_SX, POSE_SY, POSE_SZ };
+
+#ifndef MATH_3D_SSE
+	void accumulatePoseScalar(LocalPose& Out, const LocalPose& In, float Weight)
+	{
+		for(unsigned int s = 0; s < 6; s++)
+		{
+			float* pOut = Out.getStream(LinearStreams[s]);
+			const float* pIn = In.getStream(LinearStreams[s]);
+			for(unsigned int i = 0; i < Out.Stride; i++)
+			{
+				pOut[i] = pOut[i] + pIn[i] * Weight;
+			}
+		}
+
+		float* ox = Out.getStream(POSE_RX); float* oy = Out.getStream(POSE_RY);
+		float* oz = Out.getStream(POSE_RZ); float* ow = Out.getStream(POSE_RW);
+		const float* ix = In.getStream(POSE_RX); const float* iy = In.getStream(POSE_RY);
+		const float* iz = In.getStream(POSE_RZ); const float* iw = In.getStream(POSE_RW);
+		for(unsigned int i = 0; i < Out.Stride; i++)
+		{
+			float Dot = ox[i] * ix[i] + oy[i] * iy[i] + oz[i] * iz[i] + ow[i] * iw[i];
+			float Signed = Dot < 0.0f ? -Weight : Weight;
+			ox[i] = ox[i] + ix[i] * Signed;
+			oy[i] = oy[i] + iy[i] * Signed;
+			oz[i] = oz[i] + iz[i] * Signed;
+			ow[i] = ow[i] + iw[i] * Signed;
+		}
+	}
+
+	void normalizePoseScalar(LocalPose& Pose, float TotalWeight)
+	{
+		float Scale = 1.0f / TotalWeight;
+		for(unsigned int s = 0; s < 6; s++)
+		{
+			float* p = Pose.getStream(LinearStreams[s]);
+			for(unsigned int i = 0; i < Pose.Stride; i++)
+			{
+				p[i] = p[i] * Scale;
+			}
+		}
+
+		float* x = Pose.getStream(POSE_RX); float* y = Pose.getStream(POSE_RY);
+		float* z = Pose.getStream(POSE_RZ); float* w = Pose.getStream(POSE_RW);
+		for(unsigned int i = 0; i < Pose.Stride; i++)
+		{
+			float Length = std::max(sqrtf(x[i] * x[i] + y[i] * y[i] + z[i] * z[i] + w[i] * w[i]), FLT_MIN);
+			x[i] = x[i] / Length;
+			y[i] = y[i] / Length;
+			z[i] = z[i] / Length;
+			w[i] = w[i] / Length;
+		}
+	}
+
+	void addPoseScalar(LocalPose& Out, const LocalPose& In, const LocalPose& Reference, float Weight)
+	{
+		for(unsigned int s = 0; s < 3; s++)
+		{
+			float* pOut = Out.getStream(POSE_TX + s);
+			const float* pIn = In.getStream(POSE_TX + s);
+			const float* pRef = Reference.getStream(POSE_TX + s);
+			for(unsigned int i = 0; i < Out.Stride; i++)
+			{
+				pOut[i] = pOut[i] + (pIn[i] - pRef[i]) * Weight;
+			}
+		}
+		for(unsigned int s = 0; s < 3; s++)
+		{
+			float* pOut = Out.getStream(POSE_SX + s);
+			const float* pIn = In.getStream(POSE_SX + s);
+			const float* pRef = Reference.getStream(POSE_SX + s);
+			for(unsigned int i = 0; i < Out.Stride; i++)
+			{
+				pOut[i] = pOut[i] * ((pIn[i] / pRef[i] - 1.0f) * Weight + 1.0f);
+			}
+		}
+
+		float* ox = Out.getStream(POSE_RX); float* oy = Out.getStream(POSE_RY);
+		float* oz = Out.getStream(POSE_RZ); float* ow = Out.getStream(POSE_RW);
+		const float* ix = In.getStream(POSE_RX); const float* iy = In.getStream(POSE_RY);
+		const float* iz = In.getStream(POSE_RZ); const float* iw = In.getStream(POSE_RW);
+		const float* rx = Reference.getStream(POSE_RX); const float* ry = Reference.getStream(POSE_RY);
+		const float* rz = Reference.getStream(POSE_RZ); const float* rw = Reference.getStream(POSE_RW);
+		for(unsigned int i = 0; i < Out.Stride; i++)
+		{
+			// The delta is the conjugate of the reference times In, taken the
+			// short way round from the identity
+			float dw = rw[i] * iw[i] + rx[i] * ix[i] + ry[i] * iy[i] + rz[i] * iz[i];
+			float dx = rw[i] * ix[i] - rx[i] * iw[i] - ry[i] * iz[i] + rz[i] * iy[i];
+			float dy = rw[i] * iy[i] - ry[i] * iw[i] - rz[i] * ix[i] + rx[i] * iz[i];
+			float dz = rw[i] * iz[i] - rz[i] * iw[i] - rx[i] * iy[i] + ry[i] * ix[i];
+			float Signed = dw < 0.0f ? -Weight : Weight;
+
+			// nlerp from the identity
+			float qx = dx * Signed;
+			float qy = dy * Signed;
+			float qz = dz * Signed;
+			float qw = (dw * Signed - Weight) + 1.0f;
+			float Length = std::max(sqrtf(qx * qx + qy * qy + qz * qz + qw * qw), FLT_MIN);
+			qx = qx / Length;
+			qy = qy / Length;
+			qz = qz / Length;
+			qw = qw / Length;
+
+			float x = ox[i], y = oy[i], z = oz[i], w = ow[i];
+			ow[i] = w * qw - x * qx - y * qy - z * qz;
+			ox[i] = x * qw + w * qx + y * qz - z * qy;
+			oy[i] = y * qw + w * qy + z * qx - x * qz;
+			oz[i] = z * qw + w * qz + x * qy - y * qx;
+		}
+	}
+
+#else
+	// Lanes of Value whose Test is negative, with Value's sign flipped
+	inline __m128 flipWhereNegative(__m128 Value, __m128 Test)
+	{
+		const __m128 SignBit = _mm_set1_ps(-0.0f);
+		return _mm_xor_ps(Value, _mm_and_ps(_mm_cmplt_ps(Test, _mm_setzero_ps()), SignBit));
+	}
+
+	inline __m128 dot4(__m128 ax, __m128 ay, __m128 az, __m128 aw, __m128 bx, __m128 by, __m128 bz, __m128 bw)
+	{
+		__m128 Dot = _mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by));
+		Dot = _mm_add_ps(Dot, _mm_mul_ps(az, bz));
+		return _mm_add_ps(Dot, _mm_mul_ps(aw, bw));
+	}
+
+	void accumulatePoseSSE(LocalPose& Out, const LocalPose& In, float Weight)
+	{
+		const __m128 w = _mm_set1_ps(Weight);
+		for(unsigned int s = 0; s < 6; s++)
+		{
+			float* pOut = Out.getStream(LinearStreams[s]);
+			const float* pIn = In.getStream(LinearStreams[s]);
+			for(unsigned int i = 0; i < Out.Stride; i += 4)
+			{
+				_mm_storeu_ps(pOut + i, _mm_add_ps(_mm_loadu_ps(pOut + i), _mm_mul_ps(_mm_loadu_ps(pIn + i), w)));
+			}
+		}
+
+		float* pOut[4] = { Out.getStream(POSE_RX), Out.getStream(POSE_RY), Out.getStream(POSE_RZ), Out.getStream(POSE_RW) };
+		const float* pIn[4] = { In.getStream(POSE_RX), In.getStream(POSE_RY), In.getStream(POSE_RZ), In.getStream(POSE_RW) };
+		for(unsigned int i = 0; i < Out.Stride; i += 4)
+		{
+			__m128 o[4], v[4];
+			for(unsigned int c = 0; c < 4; c++)
+			{
+				o[c] = _mm_loadu_ps(pOut[c] + i);
+				v[c] = _mm_loadu_ps(pIn[c] + i);
+			}
+			const __m128 Signed = flipWhereNegative(w, dot4(o[0], o[1], o[2], o[3], v[0], v[1], v[2], v[3]));
+			for(unsigned int c = 0; c < 4; c++)
+			{
+				_mm_storeu_ps(pOut[c] + i, _mm_add_ps(o[c], _mm_mul_ps(v[c], Signed)));
+			}
+		}
+	}
+
+	void normalizePoseSSE(LocalPose& Pose, float TotalWeight)
+	{
+		const __m128 Scale = _mm_set1_ps(1.0f / TotalWeight);
+		for(unsigned int s = 0; s < 6; s++)
+		{
+			float* p = Pose.getStream(LinearStreams[s]);
+			for(unsigned int i = 0; i < Pose.Stride; i += 4)
+			{
+				_mm_storeu_ps(p + i, _mm_mul_ps(_mm_loadu_ps(p + i), Scale));
+			}
+		}
+
+		const __m128 Min = _mm_set1_ps(FLT_MIN);
+		float* p[4] = { Pose.getStream(POSE_RX), Pose.getStream(POSE_RY), Pose.getStream(POSE_RZ), Pose.getStream(POSE_RW) };
+		for(unsigned int i = 0; i < Pose.Stride; i += 4)
+		{
+			__m128 q[4];
+			for(unsigned int c = 0; c < 4; c++)
+			{
+				q[c] = _mm_loadu_ps(p[c] + i);
+			}
+			const __m128 Length = _mm_max_ps(_mm_sqrt_ps(dot4(q[0], q[1], q[2], q[3], q[0], q[1], q[2], q[3])), Min);
+			for(unsigned int c = 0; c < 4; c++)
+			{
+				_mm_storeu_ps(p[c] + i, _mm_div_ps(q[c], Length));
+			}
+		}
+	}
+
+	void addPoseSSE(LocalPose& Out, const LocalPose& In, const LocalPose& Reference, float Weight)
+	{
+		const __m128 w = _mm_set1_ps(Weight);
+		const __m128 One = _mm_set1_ps(1.0f);
+		for(unsigned int s = 0; s < 3; s++)
+		{
+			float* pOut = Out.getStream(POSE_TX + s);
+			const float* pIn = In.getStream(POSE_TX + s);
+			const float* pRef = Reference.getStream(POSE_TX + s);
+			for(unsigned int i = 0; i < Out.Stride; i += 4)
+			{
+				const __m128 Delta = _mm_sub_ps(_mm_loadu_ps(pIn + i), _mm_loadu_ps(pRef + i));
+				_mm_storeu_ps(pOut + i, _mm_add_ps(_mm_loadu_ps(pOut + i), _mm_mul_ps(Delta, w)));
+			}
+		}
+		for(unsigned int s = 0; s < 3; s++)
+		{
+			float* pOut = Out.getStream(POSE_SX + s);
+			const float* pIn = In.getStream(POSE_SX + s);
+			const float* pRef = Reference.getStream(POSE_SX + s);
+			for(unsigned int i = 0; i < Out.Stride; i += 4)
+			{
+				const __m128 Ratio = _mm_div_ps(_mm_loadu_ps(pIn + i), _mm_loadu_ps(pRef + i));
+				const __m128 Factor = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(Ratio, One), w), One);
+				_mm_storeu_ps(pOut + i, _mm_mul_ps(_mm_loadu_ps(pOut + i), Factor));
+			}
+		}
+
+		const __m128 Min = _mm_set1_ps(FLT_MIN);
+		float* pOut[4] = { Out.getStream(POSE_RX), Out.getStream(POSE_RY), Out.getStream(POSE_RZ), Out.getStream(POSE_RW) };
+		const float* pIn[4] = { In.getStream(POSE_RX), In.getStream(POSE_RY), In.getStream(POSE_RZ), In.getStream(POSE_RW) };
+		const float* pRef[4] = { Reference.getStream(POSE_RX), Reference.getStream(POSE_RY),
+								 Reference.getStream(POSE_RZ), Reference.getStream(POSE_RW) };
+		for(unsigned int i = 0; i < Out.Stride; i += 4)
+		{
+			const __m128 ix = _mm_loadu_ps(pIn[0] + i), iy = _mm_loadu_ps(pIn[1] + i);
+			const __m128 iz = _mm_loadu_ps(pIn[2] + i), iw = _mm_loadu_ps(pIn[3] + i);
+			const __m128 rx = _mm_loadu_ps(pRef[0] + i), ry = _mm_loadu_ps(pRef[1] + i);
+			const __m128 rz = _mm_loadu_ps(pRef[2] + i), rw = _mm_loadu_ps(pRef[3] + i);
+
+			const __m128 dw = dot4(rw, rx, ry, rz, iw, ix, iy, iz);
+			const __m128 dx = _mm_add_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(rw, ix), _mm_mul_ps(rx, iw)), _mm_mul_ps(ry, iz)), _mm_mul_ps(rz, iy));
+			const __m128 dy = _mm_add_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(rw, iy), _mm_mul_ps(ry, iw)), _mm_mul_ps(rz, ix)), _mm_mul_ps(rx, iz));
+			const __m128 dz = _mm_add_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(rw, iz), _mm_mul_ps(rz, iw)), _mm_mul_ps(rx, iy)), _mm_mul_ps(ry, ix));
+			const __m128 Signed = flipWhereNegative(w, dw);
+
+			__m128 qx = _mm_mul_ps(dx, Signed);
+			__m128 qy = _mm_mul_ps(dy, Signed);
+			__m128 qz = _mm_mul_ps(dz, Signed);
+			__m128 qw = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(dw, Signed), w), One);
+			const __m128 Length = _mm_max_ps(_mm_sqrt_ps(dot4(qx, qy, qz, qw, qx, qy, qz, qw)), Min);
+			qx = _mm_div_ps(qx, Length);
+			qy = _mm_div_ps(qy, Length);
+			qz = _mm_div_ps(qz, Length);
+			qw = _mm_div_ps(qw, Length);
+
+			const __m128 x = _mm_loadu_ps(pOut[0] + i), y = _mm_loadu_ps(pOut[1] + i);
+			const __m128 z = _mm_loadu_ps(pOut[2] + i), ow = _mm_loadu_ps(pOut[3] + i);
+			_mm_storeu_ps(pOut[3] + i, _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(ow, qw), _mm_mul_ps(x, qx)), _mm_mul_ps(y, qy)), _mm_mul_ps(z, qz)));
+			_mm_storeu_ps(pOut[0] + i, _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, qw), _mm_mul_ps(ow, qx)), _mm_mul_ps(y, qz)), _mm_mul_ps(z, qy)));
+			_mm_storeu_ps(pOut[1] + i, _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(y, qw), _mm_mul_ps(ow, qy)), _mm_mul_ps(z, qx)), _mm_mul_ps(x, qz)));
+			_mm_storeu_ps(pOut[2] + i, _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(z, qw), _mm_mul_ps(ow, qz)), _mm_mul_ps(x, qy)), _mm_mul_ps(y, qx)));
+		}
+	}
+#endif
+
+	void orAnimated(LocalPose& Out, const LocalPose& In)
+	{
+		for(unsigned int i = 0; i < Out.NumNodes; i++)
+		{
+			Out.Animated[i] |= In.Animated[i];
+		}
+	}
+}
+
+void accumulatePose(LocalPose& Out, const LocalPose& In, float Weight)
+{
+#ifdef MATH_3D_SSE
+	accumulatePoseSSE(Out, In, Weight);
+#else
+	accumulatePoseScalar(Out, In, Weight);
+#endif
+	orAnimated(Out, In);
+}
+
+void normalizePose(LocalPose& Pose, float TotalWeight)
+{
+#ifdef MATH_3D_SSE
+	normalizePoseSSE(Pose, TotalWeight);
+#else
+	normalizePoseScalar(Pose, TotalWeight);
+#endif
+}
+
+void addPose(LocalPose& Out, const LocalPose& In, const LocalPose& Reference, float Weight)
+{
+#ifdef MATH_3D_SSE
+	addPoseSSE(Out, In, Reference, Weight);
+#else
+	addPoseScalar(Out, In, Reference, Weight);
+#endif
+	orAnimated(Out, In);
+}
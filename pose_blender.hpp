@@ -0,0 +1,58 @@
+#ifndef POSE_BLENDER_HPP
+#define POSE_BLENDER_HPP
+
+#include <vector>
+#include "math_3d.h"
+
+/* Local space poses, the translation, rotation and scaling of every node
+relative to its parent before the hierarchy is composed into bone matrices.
+Each component of all the nodes is one array, so the kernels below treat
+four nodes at a time with SSE whatever the skeleton looks like.
+
+A blend clears a pose, accumulates every layer into it with the layer's
+weight and normalizes it. Additive layers then go on top, each relative to a
+reference pose, usually the first frame of its clip. Rotations are blended
+with nlerp, the way two keys of a clip are. */
+
+enum PoseStream
+{
+	POSE_TX, POSE_TY, POSE_TZ,
+	POSE_RX, POSE_RY, POSE_RZ, POSE_RW,
+	POSE_SX, POSE_SY, POSE_SZ,
+	NUM_POSE_STREAMS
+};
+
+struct LocalPose
+{
+	LocalPose() : NumNodes(0), Stride(0) {}
+
+	// The padding nodes are identity transforms, so the kernels can run over
+	// them without producing NaNs
+	void resize(unsigned int Count);
+	float* getStream(unsigned int Stream) { return &Values[Stream * Stride]; }
+	const float* getStream(unsigned int Stream) const { return &Values[Stream * Stride]; }
+	void setNode(unsigned int Node, const Vector3f& Translation, const Quaternion& Rotation,
+				 const Vector3f& Scaling);
+	void getNode(unsigned int Node, Vector3f& Translation, Quaternion& Rotation,
+				 Vector3f& Scaling) const;
+
+	unsigned int NumNodes;
+	unsigned int Stride;	// NumNodes rounded up to a multiple of 4, never 0
+	std::vector<float> Values;
+	// Set for the nodes some layer has a channel for. The others are left to
+	// the mesh, which can use their bind matrix as it is.
+	std::vector<unsigned char> Animated;
+};
+
+// Zeroes every node, ready to accumulate into
+void clearPose(LocalPose& Pose);
+// Out += In * Weight, with each rotation of In flipped onto the same
+// hemisphere as what Out holds so far. Out must have In's size.
+void accumulatePose(LocalPose& Out, const LocalPose& In, float Weight);
+// Divides by the sum of the accumulated weights and renormalizes rotations
+void normalizePose(LocalPose& Pose, float TotalWeight);
+// Applies the difference between In and Reference to Out, scaled by Weight.
+// Translations add, rotations multiply on the right and scales multiply.
+void addPose(LocalPose& Out, const LocalPose& In, const LocalPose& Reference, float Weight);
+
+#endif
@@ -0,0 +1,578 @@
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "pose_cache.hpp"
+
+// Jobs per thread, more than one so a thread that drew expensive skeletons
+// does not hold up the rest
+#define JOBS_PER_THREAD 4
+
+PoseCache::PoseCache(float SampleRate, unsigned int KeyInterval)
+	: m_sample_rate(SampleRate),
+	  m_key_interval(std::max(KeyInterval, 1u)),
+	  m_num_used(0),
+	  m_num_evaluated(0),
+	  m_num_blended(0),
+	  m_num_layered(0),
+	  m_max_bones(0)
+{
+	beginFrame();
+}
+
+void PoseCache::beginFrame()
+{
+	m_num_used = 0;
+	for(unsigned int i = 0; i < NUM_LODS; i++)
+	{
+		m_num_requests[i] = 0;
+	}
+	m_num_evaluated = 0;
+	m_num_blended = 0;
+	m_num_layered = 0;
+}
+
+const PoseCache::Pose& PoseCache::requestPose(Mesh* pMesh, unsigned int ClipIndex, float TimeInSeconds,
+											  AnimationLod Lod, unsigned int MeshLod)
+{
+	assert(MeshLod < pMesh->getNumLods());
+	m_num_requests[Lod]++;
+
+	float Duration = pMesh->getClipDuration(ClipIndex);
+	int Sample = getSample(pMesh, ClipIndex, TimeInSeconds);
+	int Key = Sample - Sample % m_key_interval;
+
+	int Index;
+	if(Lod == LOD_FULL || Duration <= 0.0f)
+	{
+		Index = findOrAddKey(pMesh, ClipIndex, Sample);
+	}
+	else if(Lod == LOD_FROZEN || Sample == Key)
+	{
+		Index = findOrAddKey(pMesh, ClipIndex, Key);
+	}
+	else
+	{
+		// A full rate character may already have paid for this exact pose
+		Index = findEntry(pMesh, ClipIndex, Sample, true);
+		if(Index < 0)
+		{
+			// The last key pairs with the start of the clip, over whatever
+			// is left of the clip after it
+			int NextKey = Key + m_key_interval;
+			float End = std::min((float)NextKey, Duration * m_sample_rate);
+			if(NextKey >= Duration * m_sample_rate)
+			{
+				NextKey = 0;
+			}
+
+			unsigned int FirstKey = findOrAddKey(pMesh, ClipIndex, Key);
+			unsigned int SecondKey = findOrAddKey(pMesh, ClipIndex, NextKey);
+			Index = addEntry(pMesh, ClipIndex, Sample);
+
+			Entry& Blended = m_entries[Index];
+			Blended.FirstKey = FirstKey;
+			Blended.SecondKey = SecondKey;
+			Blended.Factor = End > Key ? (Sample - Key) / (End - Key) : 0.0f;
+		}
+	}
+
+	Entry& Requested = m_entries[Index];
+	Requested.DrawnLods |= 1 << MeshLod;
+	return Requested.Result;
+}
+
+const PoseCache::Pose& PoseCache::requestLayeredPose(Mesh* pMesh, const Layer* pLayers, unsigned int NumLayers,
+													 unsigned int MeshLod)
+{
+	assert(MeshLod < pMesh->getNumLods());
+	// Layers that contribute nothing are dropped, so a crossfade that has
+	// just started or finished shares the pose of the clip it is left with
+	m_layers.clear();
+	unsigned int NumBlended = 0;
+	unsigned int LastBlended = 0;
+	for(unsigned int i = 0; i < NumLayers; i++)
+	{
+		if(pLayers[i].Weight <= 0.0f)
+		{
+			continue;
+		}
+		LayerKey Key;
+		Key.ClipIndex = pLayers[i].ClipIndex;
+		Key.Sample = getSample(pMesh, pLayers[i].ClipIndex, pLayers[i].TimeInSeconds);
+		Key.Weight = pLayers[i].Weight;
+		Key.Additive = pLayers[i].Additive;
+		m_layers.push_back(Key);
+		if(!Key.Additive)
+		{
+			NumBlended++;
+			LastBlended = i;
+		}
+	}
+
+	// Without a plain layer of positive weight there is nothing for the
+	// additive ones to go on top of, so the first plain layer becomes the
+	// base at full weight. With no plain layer at all the first clip is
+	// played on its own.
+	if(NumBlended == 0)
+	{
+		unsigned int Base = 0;
+		while(Base < NumLayers && pLayers[Base].Additive)
+		{
+			Base++;
+		}
+		if(Base == NumLayers)
+		{
+			assert(NumLayers > 0);
+			return requestPose(pMesh, pLayers[0].ClipIndex, pLayers[0].TimeInSeconds, LOD_FULL, MeshLod);
+		}
+
+		LayerKey Key;
+		Key.ClipIndex = pLayers[Base].ClipIndex;
+		Key.Sample = getSample(pMesh, pLayers[Base].ClipIndex, pLayers[Base].TimeInSeconds);
+		Key.Weight = 1.0f;
+		Key.Additive = false;
+		m_layers.insert(m_layers.begin(), Key);
+		NumBlended = 1;
+		LastBlended = Base;
+	}
+
+	if(NumBlended == 1 && m_layers.size() == 1)
+	{
+		return requestPose(pMesh, pLayers[LastBlended].ClipIndex, pLayers[LastBlended].TimeInSeconds,
+						   LOD_FULL, MeshLod);
+	}
+
+	m_num_requests[LOD_FULL]++;
+	int Index = findLayeredEntry(pMesh, m_layers);
+	if(Index < 0)
+	{
+		Index = addEntry(pMesh, 0, 0);
+		m_entries[Index].Layers = m_layers;
+	}
+
+	Entry& Requested = m_entries[Index];
+	Requested.DrawnLods |= 1 << MeshLod;
+	return Requested.Result;
+}
+
+int PoseCache::getSample(Mesh* pMesh, unsigned int ClipIndex, float TimeInSeconds) const
+{
+	// Wrapping first makes characters whole loops apart share a pose too
+	float Duration = pMesh->getClipDuration(ClipIndex);
+	float Time = Duration > 0.0f ? fmod(TimeInSeconds, Duration) : TimeInSeconds;
+	if(Time < 0.0f)
+	{
+		Time += Duration;
+	}
+	return (int)floorf(Time * m_sample_rate);
+}
+
+int PoseCache::findEntry(Mesh* pMesh, unsigned int ClipIndex, int Sample, bool AllowBlended) const
+{
+	// Only a handful of distinct poses are alive in a frame, so a linear
+	// search beats anything that allocates
+	for(unsigned int i = 0; i < m_num_used; i++)
+	{
+		const Entry& Cached = m_entries[i];
+		if(Cached.pMesh == pMesh && Cached.ClipIndex == ClipIndex && Cached.Sample == Sample &&
+		   Cached.Layers.empty() && (AllowBlended || Cached.FirstKey < 0))
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+// Characters only share a layered pose when they are in step in every
+// layer, like a group that started the same crossfade together
+int PoseCache::findLayeredEntry(Mesh* pMesh, const std::vector<LayerKey>& Layers) const
+{
+	for(unsigned int i = 0; i < m_num_used; i++)
+	{
+		const Entry& Cached = m_entries[i];
+		if(Cached.pMesh != pMesh || Cached.Layers.size() != Layers.size())
+		{
+			continue;
+		}
+
+		bool Match = true;
+		for(unsigned int j = 0; j < Layers.size() && Match; j++)
+		{
+			const LayerKey& a = Cached.Layers[j];
+			const LayerKey& b = Layers[j];
+			Match = a.ClipIndex == b.ClipIndex && a.Sample == b.Sample && a.Weight == b.Weight &&
+					a.Additive == b.Additive;
+		}
+		if(Match)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+unsigned int PoseCache::addEntry(Mesh* pMesh, unsigned int ClipIndex, int Sample)
+{
+	if(m_num_used == m_entries.size())
+	{
+		m_entries.push_back(Entry());
+	}
+
+	Entry& NewEntry = m_entries[m_num_used];
+	NewEntry.pMesh = pMesh;
+	NewEntry.ClipIndex = ClipIndex;
+	NewEntry.Sample = Sample;
+	NewEntry.FirstKey = -1;
+	NewEntry.SecondKey = -1;
+	NewEntry.Factor = 0.0f;
+	NewEntry.Layers.clear();
+	NewEntry.DrawnLods = 0;
+
+	return m_num_used++;
+}
+
+unsigned int PoseCache::findOrAddKey(Mesh* pMesh, unsigned int ClipIndex, int Sample)
+{
+	int Index = findEntry(pMesh, ClipIndex, Sample, false);
+	return Index >= 0 ? Index : addEntry(pMesh, ClipIndex, Sample);
+}
+
+void PoseCache::evaluate(WorkerPool* pPool)
+{
+	// Layered entries only need the mesh, so they go in the first pass
+	// with the keys
+	m_order.clear();
+	m_num_layered = 0;
+	for(unsigned int i = 0; i < m_num_used; i++)
+	{
+		if(m_entries[i].FirstKey < 0)
+		{
+			m_order.push_back(i);
+			m_num_layered += m_entries[i].Layers.empty() ? 0 : 1;
+		}
+	}
+	unsigned int NumFirstPass = m_order.size();
+	m_num_evaluated = NumFirstPass - m_num_layered;
+	for(unsigned int i = 0; i < m_num_used; i++)
+	{
+		if(m_entries[i].FirstKey >= 0)
+		{
+			m_order.push_back(i);
+		}
+	}
+	m_num_blended = m_num_used - NumFirstPass;
+
+	runJobs(pPool, 0, NumFirstPass);
+	runJobs(pPool, NumFirstPass, m_num_used);
+}
+
+void PoseCache::runJobs(WorkerPool* pPool, unsigned int First, unsigned int Last)
+{
+	// The calling thread takes jobs too while it waits
+	unsigned int NumThreads = pPool ? pPool->getNumThreads() + 1 : 1;
+	unsigned int NumJobs = std::min(Last - First, NumThreads * JOBS_PER_THREAD);
+	if(NumJobs == 0)
+	{
+		return;
+	}
+
+	// Only grows, so the jobs and their scratch are allocated once
+	if(m_jobs.size() < NumJobs)
+	{
+		m_jobs.resize(NumJobs);
+	}
+
+	for(unsigned int i = 0; i < NumJobs; i++)
+	{
+		PoseJob& Job = m_jobs[i];
+		Job.m_cache = this;
+		Job.m_first = First + (Last - First) * i / NumJobs;
+		Job.m_last = First + (Last - First) * (i + 1) / NumJobs;
+	}
+
+	if(!pPool)
+	{
+		for(unsigned int i = 0; i < NumJobs; i++)
+		{
+			m_jobs[i].run();
+		}
+		return;
+	}
+
+	for(unsigned int i = 0; i < NumJobs; i++)
+	{
+		pPool->push(&m_jobs[i]);
+	}
+	pPool->waitAll();
+}
+
+unsigned int PoseCache::getPaletteSize(unsigned int SkinningMode) const
+{
+	return m_max_bones * (SkinningMode == Mesh::DUAL_QUATERNION_SKINNING ?
+						  sizeof(DualQuaternion) : sizeof(Matrix4f));
+}
+
+void PoseCache::upload(GLuint Buffer, unsigned int MaxBones, unsigned int Alignment)
+{
+	m_max_bones = MaxBones;
+
+	// Palettes are packed by the bones they actually hold. Ranges are bound
+	// as big as the block that reads them, so the buffer ends in a whole
+	// palette of matrices, the larger kind, to keep every range inside it.
+	unsigned int Size = 0;
+	unsigned int NumPalettes = 0;
+	for(unsigned int i = 0; i < m_num_used; i++)
+	{
+		Entry& Uploaded = m_entries[i];
+		unsigned int BoneSize = Uploaded.pMesh->getSkinningMode() == Mesh::DUAL_QUATERNION_SKINNING ?
+								sizeof(DualQuaternion) : sizeof(Matrix4f);
+		for(unsigned int Lod = 0; Lod < MAX_MESH_LODS; Lod++)
+		{
+			if(!(Uploaded.DrawnLods & (1 << Lod)))
+			{
+				continue;
+			}
+			Uploaded.Result.PaletteOffset[Lod] = Size;
+			NumPalettes++;
+			Size += std::min((unsigned int)Uploaded.pMesh->getLodBones(Lod).size(), MaxBones) * BoneSize;
+			Size = (Size + Alignment - 1) / Alignment * Alignment;
+		}
+	}
+	if(NumPalettes == 0)
+	{
+		return;
+	}
+	m_palettes.resize(Size + getPaletteSize(Mesh::LINEAR_SKINNING));
+
+	for(unsigned int i = 0; i < m_num_used; i++)
+	{
+		const Entry& Uploaded = m_entries[i];
+		for(unsigned int Lod = 0; Lod < MAX_MESH_LODS; Lod++)
+		{
+			if(!(Uploaded.DrawnLods & (1 << Lod)))
+			{
+				continue;
+			}
+			const std::vector<unsigned int>& Bones = Uploaded.pMesh->getLodBones(Lod);
+			unsigned char* pPalette = &m_palettes[Uploaded.Result.PaletteOffset[Lod]];
+			unsigned int NumBones = std::min((unsigned int)Bones.size(), MaxBones);
+
+			// Matrix4f is row major like the block, so no transpose is needed
+			if(Uploaded.pMesh->getSkinningMode() == Mesh::DUAL_QUATERNION_SKINNING)
+			{
+				const std::vector<DualQuaternion>& DualQuaternions = Uploaded.Result.DualQuaternions;
+				for(unsigned int j = 0; j < NumBones && Bones[j] < DualQuaternions.size(); j++)
+				{
+					memcpy(pPalette + j * sizeof(DualQuaternion), &DualQuaternions[Bones[j]], sizeof(DualQuaternion));
+				}
+			}
+			else
+			{
+				const std::vector<Matrix4f>& Transforms = Uploaded.Result.Transforms;
+				for(unsigned int j = 0; j < NumBones && Bones[j] < Transforms.size(); j++)
+				{
+					memcpy(pPalette + j * sizeof(Matrix4f), &Transforms[Bones[j]], sizeof(Matrix4f));
+				}
+			}
+		}
+	}
+
+	// Respecifying the whole store lets the driver hand us fresh memory
+	// instead of waiting on draws still reading last frame's palettes
+	glBindBuffer(GL_UNIFORM_BUFFER, Buffer);
+	glBufferData(GL_UNIFORM_BUFFER, m_palettes.size(), &m_palettes[0], GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void PoseCache::skin(GLuint Buffer, GLuint PaletteBuffer, GLuint LinearProgram,
+					 GLuint DualQuaternionProgram)
+{
+	unsigned int NumVertices = 0;
+	for(unsigned int i = 0; i < m_num_used; i++)
+	{
+		Entry& Skinned = m_entries[i];
+		for(unsigned int Lod = 0; Lod < MAX_MESH_LODS; Lod++)
+		{
+			if(Skinned.DrawnLods & (1 << Lod))
+			{
+				Skinned.Result.SkinnedBaseVertex[Lod] = NumVertices;
+				NumVertices += Skinned.pMesh->getNumVertices(Lod);
+			}
+		}
+	}
+
+	glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, Buffer);
+	glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, std::max(NumVertices, 1u) * sizeof(Mesh::SkinnedOutputVertex),
+				 NULL, GL_STREAM_COPY);
+	glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+
+	// Only the captured vertices are wanted, nothing is drawn
+	glEnable(GL_RASTERIZER_DISCARD);
+	for(unsigned int i = 0; i < m_num_used; i++)
+	{
+		const Entry& Skinned = m_entries[i];
+		if(Skinned.DrawnLods == 0)
+		{
+			continue;
+		}
+		unsigned int Mode = Skinned.pMesh->getSkinningMode();
+		glUseProgram(Mode == Mesh::DUAL_QUATERNION_SKINNING ? DualQuaternionProgram : LinearProgram);
+		for(unsigned int Lod = 0; Lod < MAX_MESH_LODS; Lod++)
+		{
+			if(!(Skinned.DrawnLods & (1 << Lod)))
+			{
+				continue;
+			}
+			glBindBufferRange(GL_UNIFORM_BUFFER, BONE_PALETTE_BINDING, PaletteBuffer,
+							  Skinned.Result.PaletteOffset[Lod], getPaletteSize(Mode));
+			Skinned.pMesh->skin(Buffer, Skinned.Result.SkinnedBaseVertex[Lod], Lod);
+		}
+	}
+	glDisable(GL_RASTERIZER_DISCARD);
+	glUseProgram(0);
+}
+
+void PoseCache::evaluateEntry(unsigned int Index, std::vector<Matrix4f>& Scratch)
+{
+	Entry& Evaluated = m_entries[Index];
+	Evaluated.pMesh->boneTransform(Evaluated.Sample / m_sample_rate, Evaluated.Result.Transforms,
+								   Evaluated.ClipIndex, Scratch);
+	convertPose(Evaluated);
+}
+
+// Plain layers are blended first, then the additive ones go on top in the
+// order they were given
+void PoseCache::evaluateLayers(unsigned int Index, PoseJob& Job)
+{
+	Entry& Layered = m_entries[Index];
+	Mesh* pMesh = Layered.pMesh;
+
+	float TotalWeight = 0.0f;
+	for(unsigned int i = 0; i < Layered.Layers.size(); i++)
+	{
+		const LayerKey& Key = Layered.Layers[i];
+		if(Key.Additive)
+		{
+			continue;
+		}
+		pMesh->sampleLocalPose(Key.Sample / m_sample_rate, Key.ClipIndex, Job.m_layer);
+		if(TotalWeight == 0.0f)
+		{
+			Job.m_blend.resize(Job.m_layer.NumNodes);
+			clearPose(Job.m_blend);
+		}
+		accumulatePose(Job.m_blend, Job.m_layer, Key.Weight);
+		TotalWeight += Key.Weight;
+	}
+	normalizePose(Job.m_blend, TotalWeight);
+
+	for(unsigned int i = 0; i < Layered.Layers.size(); i++)
+	{
+		const LayerKey& Key = Layered.Layers[i];
+		if(!Key.Additive)
+		{
+			continue;
+		}
+		pMesh->sampleLocalPose(Key.Sample / m_sample_rate, Key.ClipIndex, Job.m_layer);
+		pMesh->sampleLocalPose(0.0f, Key.ClipIndex, Job.m_reference);
+		addPose(Job.m_blend, Job.m_layer, Job.m_reference, Key.Weight);
+	}
+
+	pMesh->composePose(Job.m_blend, Layered.Result.Transforms, Job.m_scratch);
+	convertPose(Layered);
+}
+
+void PoseCache::convertPose(Entry& Evaluated)
+{
+	if(Evaluated.pMesh->getSkinningMode() == Mesh::DUAL_QUATERNION_SKINNING)
+	{
+		std::vector<DualQuaternion>& DualQuaternions = Evaluated.Result.DualQuaternions;
+		DualQuaternions.resize(Evaluated.Result.Transforms.size());
+		for(unsigned int i = 0; i < DualQuaternions.size(); i++)
+		{
+			DualQuaternions[i].InitFromMatrix(Evaluated.Result.Transforms[i]);
+		}
+	}
+}
+
+// Blends the skinning matrices directly, the keys are close enough that the
+// shear this introduces is not visible. Dual quaternions are blended and
+// renormalized.
+void PoseCache::blendEntry(unsigned int Index)
+{
+	Entry& Blended = m_entries[Index];
+	const Pose& First = m_entries[Blended.FirstKey].Result;
+	const Pose& Second = m_entries[Blended.SecondKey].Result;
+	float Factor = Blended.Factor;
+
+	std::vector<Matrix4f>& Transforms = Blended.Result.Transforms;
+	Transforms.resize(First.Transforms.size());
+	for(unsigned int i = 0; i < Transforms.size(); i++)
+	{
+		const float* a = &First.Transforms[i].m[0][0];
+		const float* b = &Second.Transforms[i].m[0][0];
+		float* pOut = &Transforms[i].m[0][0];
+		for(unsigned int j = 0; j < 16; j++)
+		{
+			pOut[j] = a[j] + (b[j] - a[j]) * Factor;
+		}
+	}
+
+	if(Blended.pMesh->getSkinningMode() == Mesh::DUAL_QUATERNION_SKINNING)
+	{
+		std::vector<DualQuaternion>& DualQuaternions = Blended.Result.DualQuaternions;
+		DualQuaternions.resize(First.DualQuaternions.size());
+		for(unsigned int i = 0; i < DualQuaternions.size(); i++)
+		{
+			const DualQuaternion& a = First.DualQuaternions[i];
+			const DualQuaternion& b = Second.DualQuaternions[i];
+			DualQuaternion& Out = DualQuaternions[i];
+
+			// q and -q are the same rotation, blend along the shorter arc
+			float Dot = a.Real[0] * b.Real[0] + a.Real[1] * b.Real[1] +
+						a.Real[2] * b.Real[2] + a.Real[3] * b.Real[3];
+			float WeightA = 1.0f - Factor;
+			float WeightB = Dot < 0.0f ? -Factor : Factor;
+			for(unsigned int j = 0; j < 4; j++)
+			{
+				Out.Real[j] = a.Real[j] * WeightA + b.Real[j] * WeightB;
+				Out.Dual[j] = a.Dual[j] * WeightA + b.Dual[j] * WeightB;
+			}
+
+			float Length = sqrtf(Out.Real[0] * Out.Real[0] + Out.Real[1] * Out.Real[1] +
+								 Out.Real[2] * Out.Real[2] + Out.Real[3] * Out.Real[3]);
+			if(Length > 0.0f)
+			{
+				for(unsigned int j = 0; j < 4; j++)
+				{
+					Out.Real[j] /= Length;
+					Out.Dual[j] /= Length;
+				}
+			}
+		}
+	}
+}
+
+void PoseCache::PoseJob::run()
+{
+	for(unsigned int i = m_first; i < m_last; i++)
+	{
+		unsigned int Index = m_cache->m_order[i];
+		const Entry& Next = m_cache->m_entries[Index];
+		if(!Next.Layers.empty())
+		{
+			m_cache->evaluateLayers(Index, *this);
+		}
+		else if(Next.FirstKey < 0)
+		{
+			m_cache->evaluateEntry(Index, m_scratch);
+		}
+		else
+		{
+			m_cache->blendEntry(Index);
+		}
+	}
+}
@@ -0,0 +1,203 @@
+#ifndef POSE_CACHE_HPP
+#define POSE_CACHE_HPP
+
+#include <deque>
+#include <vector>
+#include "mesh.hpp"
+#include "worker_pool.hpp"
+
+/* Poses evaluated during the current frame, keyed by mesh, clip and sample
+time. Characters that share a mesh and play the same clip in step, like a
+group of enemies started together, are posed once per frame however many of
+them there are. Times are quantized to the sample rate, so characters that
+are less than a sample apart also share a pose.
+
+A frame first requests the pose of every character, then evaluate poses
+the distinct ones all at once, spread over a worker pool, and uploads them
+into one uniform buffer. skin then skins every pose's mesh once into a
+vertex buffer that all render passes draw from.
+
+Each request also names an animation LOD. Distant characters are blended
+from key poses a few samples apart, and since every distant character with
+the same mesh and clip needs the same keys, only those keys are evaluated.
+Characters outside the view hold a key pose until they come back.
+
+Characters crossfading between clips or playing additive layers request a
+layered pose instead. Its clips are sampled into local space poses, blended
+by the pose blender and only then composed into bone matrices, so the
+expensive half of posing is paid once however many layers there are.
+
+Requests also name the LOD of the mesh the character is drawn with. The
+pose is shared between mesh LODs, but each LOD drawn gets its own palette,
+holding only the bones that LOD kept, and is skinned on its own. */
+
+// The uniform buffer binding point the BonePalette block of skinning.vert uses
+#define BONE_PALETTE_BINDING 0
+
+class PoseCache
+{
+public:
+	enum AnimationLod
+	{
+		LOD_FULL,		// evaluated at the sample rate
+		LOD_REDUCED,	// blended between key poses
+		LOD_FROZEN,		// a key pose, the caller stops advancing the time
+		NUM_LODS
+	};
+
+	struct Pose
+	{
+		Pose()
+		{
+			for(unsigned int i = 0; i < MAX_MESH_LODS; i++)
+			{
+				PaletteOffset[i] = 0;
+				SkinnedBaseVertex[i] = 0;
+			}
+		}
+
+		std::vector<Matrix4f> Transforms;
+		// Only filled for meshes with dual quaternion skinning
+		std::vector<DualQuaternion> DualQuaternions;
+		// Per mesh LOD, only set for the LODs that requested the pose
+		unsigned int PaletteOffset[MAX_MESH_LODS];	// in bytes, into the buffer upload filled
+		unsigned int SkinnedBaseVertex[MAX_MESH_LODS];	// into the buffer skin filled
+	};
+
+	struct Layer
+	{
+		unsigned int ClipIndex;
+		float TimeInSeconds;
+		float Weight;
+		// Additive layers apply their clip's difference from its first frame
+		// on top of the blend of the other layers
+		bool Additive;
+	};
+
+	// Key poses for LOD_REDUCED and LOD_FROZEN are KeyInterval samples apart
+	PoseCache(float SampleRate = 60.0f, unsigned int KeyInterval = 4);
+
+	// Forgets the previous frame's poses, the storage is reused
+	void beginFrame();
+
+	// Returns where the pose will be once evaluate has run. It stays valid
+	// until the next beginFrame.
+	// MeshLod is the LOD of pMesh the pose is drawn with.
+	const Pose& requestPose(Mesh* pMesh, unsigned int ClipIndex, float TimeInSeconds,
+							AnimationLod Lod = LOD_FULL, unsigned int MeshLod = 0);
+	// The same for a blend of NumLayers clips. The weights of the layers
+	// that are not additive are normalized. If none of them is positive the
+	// first one is used at full weight, and if every layer is additive the
+	// first clip is played on its own. Always evaluated at the sample rate.
+	const Pose& requestLayeredPose(Mesh* pMesh, const Layer* pLayers, unsigned int NumLayers,
+								   unsigned int MeshLod = 0);
+	// Evaluates every pose requested this frame, on the calling thread if
+	// pPool is NULL
+	void evaluate(WorkerPool* pPool);
+	// Writes the evaluated poses into Buffer, each palette starting on a
+	// multiple of Alignment (GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT). A palette
+	// is up to MaxBones row major matrices, or dual quaternions for meshes
+	// skinned that way, in the std140 layout. Only the bones of the mesh
+	// LOD are written, but a whole MaxBones palette can be bound at every
+	// offset.
+	void upload(GLuint Buffer, unsigned int MaxBones, unsigned int Alignment);
+	// Skins the mesh of every pose with the palettes from the last upload,
+	// writing Mesh::SkinnedOutputVertex's to Buffer. Each mesh is skinned
+	// with the program for its skinning mode.
+	void skin(GLuint Buffer, GLuint PaletteBuffer, GLuint LinearProgram,
+			  GLuint DualQuaternionProgram);
+
+	// Counters for the current frame. Evaluated poses include the keys
+	// blended poses are made from, even when nothing draws the key itself.
+	// Layered poses count as full rate requests.
+	unsigned int getNumRequests(AnimationLod Lod) const { return m_num_requests[Lod]; }
+	unsigned int getNumEvaluated() const { return m_num_evaluated; }
+	unsigned int getNumBlended() const { return m_num_blended; }
+	unsigned int getNumLayered() const { return m_num_layered; }
+
+private:
+	// A Layer with its time quantized like any other request
+	struct LayerKey
+	{
+		unsigned int ClipIndex;
+		int Sample;
+		float Weight;
+		bool Additive;
+	};
+
+	struct Entry
+	{
+		Mesh* pMesh;
+		unsigned int ClipIndex;
+		int Sample;
+		// Blended entries are made from the key entries at these indices,
+		// evaluated ones have -1
+		int FirstKey;
+		int SecondKey;
+		float Factor;
+		// Only filled for layered entries, which are evaluated and have no
+		// clip or sample of their own
+		std::vector<LayerKey> Layers;
+		// A bit per mesh LOD the pose is drawn with, 0 for keys only
+		// requested by blended entries
+		unsigned int DrawnLods;
+		Pose Result;
+	};
+
+	// Evaluates or blends a range of m_order. The jobs are kept from frame to
+	// frame along with their scratch space.
+	class PoseJob : public WorkerPool::Job
+	{
+	public:
+		PoseJob() : m_cache(NULL), m_first(0), m_last(0) {}
+		void run();
+
+		PoseCache* m_cache;
+		unsigned int m_first;
+		unsigned int m_last;
+		std::vector<Matrix4f> m_scratch;
+		// For layered entries: the blend, the layer being sampled and the
+		// reference pose of an additive layer
+		LocalPose m_blend;
+		LocalPose m_layer;
+		LocalPose m_reference;
+	};
+
+	// Returns the index of a matching entry or -1. Blended entries only
+	// match if AllowBlended is set.
+	int findEntry(Mesh* pMesh, unsigned int ClipIndex, int Sample, bool AllowBlended) const;
+	int findLayeredEntry(Mesh* pMesh, const std::vector<LayerKey>& Layers) const;
+	// The clip time wrapped into the clip and quantized to the sample rate
+	int getSample(Mesh* pMesh, unsigned int ClipIndex, float TimeInSeconds) const;
+	// Adds an evaluated entry that nothing draws yet
+	unsigned int addEntry(Mesh* pMesh, unsigned int ClipIndex, int Sample);
+	unsigned int findOrAddKey(Mesh* pMesh, unsigned int ClipIndex, int Sample);
+	// Runs the jobs over m_order[First, Last)
+	void runJobs(WorkerPool* pPool, unsigned int First, unsigned int Last);
+	void evaluateEntry(unsigned int Index, std::vector<Matrix4f>& Scratch);
+	void evaluateLayers(unsigned int Index, PoseJob& Job);
+	// Fills the dual quaternions of meshes skinned that way from the matrices
+	void convertPose(Entry& Evaluated);
+	void blendEntry(unsigned int Index);
+	// Bytes in the palette of a mesh with the given skinning mode
+	unsigned int getPaletteSize(unsigned int SkinningMode) const;
+
+	float m_sample_rate;
+	int m_key_interval;
+	// A deque so handing out references survives adding entries
+	std::deque<Entry> m_entries;
+	unsigned int m_num_used;
+	// Entry indices, evaluated entries first so the keys are ready before
+	// anything is blended from them
+	std::vector<unsigned int> m_order;
+	unsigned int m_num_requests[NUM_LODS];
+	unsigned int m_num_evaluated;
+	unsigned int m_num_blended;
+	unsigned int m_num_layered;
+	std::vector<LayerKey> m_layers;	// scratch for requestLayeredPose
+	std::vector<PoseJob> m_jobs;
+	std::vector<unsigned char> m_palettes;	// staging for upload
+	unsigned int m_max_bones;
+};
+
+#endif
@@ -1,5 +1,8 @@
+#include <algorithm>
 #include "renderable.hpp"
 
+const PoseCache::Pose DynamicRenderable::s_no_pose;
+
 StaticRenderable::StaticRenderable(Mesh* mesh, glm::vec3 translation, glm::vec3 rotation, 
 								   glm::vec3 scale, bool isVisible)
 {
@@ -14,16 +17,29 @@ StaticRenderable::~StaticRenderable()
 {
 }
 
-DynamicRenderable::DynamicRenderable(std::vector<Mesh*>& meshes, glm::vec3 translation, 
+DynamicRenderable::DynamicRenderable(Mesh* mesh, glm::vec3 translation, 
 									 glm::vec3 rotation, glm::vec3 scale, bool isVisible,
 									 btPairCachingGhostObject* controller)
 	: m_direction(FORWARD),
 	  m_rotation(0.0f, 0.0f, 0.0f),
+	  m_pose(&s_no_pose),
 	  m_animation_index(0),
+	  m_animation_offset(0.0f),
+	  m_animation_time(0.0f),
+	  m_next_animation_index(0),
+	  m_next_fade_time(0.0f),
+	  m_previous_animation_index(0),
+	  m_fade_start(0.0f),
+	  m_fade_time(0.0f),
+	  m_additive_index(-1),
+	  m_additive_weight(0.0f),
+	  m_mesh_lod(0),
+	  m_in_view(true),
+	  m_casts_shadow(true),
 	  m_ghost_object(controller),
 	  m_isVisible(isVisible)
 {
-	m_animation_meshes = meshes;
+	m_mesh = mesh;
 	m_translation_matrix = glm::translate(glm::mat4(1.0f), translation);
 	glm::quat rotation_quat = glm::quat(rotation);
 	m_rotation_matrix = glm::mat4_cast(rotation_quat);
@@ -92,3 +108,116 @@ void DynamicRenderable::move()
 	m_rotation_matrix = glm::mat4_cast(rotation_quat);
 	m_translation_matrix = glm::translate(glm::mat4(1.0f), m_translation);
 }
+
+namespace
+{
+	PoseCache::Layer makeLayer(unsigned int clip, float time, float weight, bool additive)
+	{
+		PoseCache::Layer layer;
+		layer.ClipIndex = clip;
+		layer.TimeInSeconds = time;
+		layer.Weight = weight;
+		layer.Additive = additive;
+		return layer;
+	}
+
+	// Grows the sphere at center to also hold the one at other_center
+	void mergeSphere(glm::vec3& center, float& radius, const glm::vec3& other_center, float other_radius)
+	{
+		float distance = glm::length(other_center - center);
+		if(distance + other_radius <= radius)
+		{
+			return;
+		}
+		if(distance + radius <= other_radius)
+		{
+			center = other_center;
+			radius = other_radius;
+			return;
+		}
+		float merged_radius = (distance + radius + other_radius) * 0.5f;
+		center += (other_center - center) * ((merged_radius - radius) / distance);
+		radius = merged_radius;
+	}
+}
+
+void DynamicRenderable::getAnimationBounds(glm::vec3& center, float& radius)
+{
+	int clips[4] = { (int)m_animation_index, (int)m_next_animation_index, -1, -1 };
+	if(m_fade_time > 0.0f)
+	{
+		clips[2] = m_previous_animation_index;
+	}
+	// An additive layer is assumed to stay within its own clip's bounds
+	if(m_additive_index >= 0 && m_additive_weight > 0.0f)
+	{
+		clips[3] = m_additive_index;
+	}
+
+	const Vector3f& first_center = m_mesh->getClipBoundsCenter(clips[0]);
+	glm::vec3 local_center(first_center.x, first_center.y, first_center.z);
+	float local_radius = m_mesh->getClipBoundsRadius(clips[0]);
+	for(unsigned int i = 1; i < 4; i++)
+	{
+		if(clips[i] >= 0 && clips[i] != clips[0])
+		{
+			const Vector3f& clip_center = m_mesh->getClipBoundsCenter(clips[i]);
+			mergeSphere(local_center, local_radius, glm::vec3(clip_center.x, clip_center.y, clip_center.z),
+						m_mesh->getClipBoundsRadius(clips[i]));
+		}
+	}
+
+	glm::mat4 model_matrix = m_translation_matrix * m_rotation_matrix * m_scale_matrix;
+	center = glm::vec3(model_matrix * glm::vec4(local_center, 1.0f));
+	radius = local_radius * std::max(m_scale.x, std::max(m_scale.y, m_scale.z));
+}
+
+void DynamicRenderable::UpdateTransforms(float Time, PoseCache& cache, PoseCache::AnimationLod lod,
+										 unsigned int mesh_lod)
+{
+	m_mesh_lod = mesh_lod;
+	if(lod != PoseCache::LOD_FROZEN)
+	{
+		m_animation_time = Time + m_animation_offset;
+	}
+
+	float fade = m_fade_time > 0.0f ? (m_animation_time - m_fade_start) / m_fade_time : 1.0f;
+	if(m_next_animation_index != m_animation_index)
+	{
+		// A crossfade that interrupts another one starts from whichever of
+		// its clips weighs more
+		if(fade >= 0.5f)
+		{
+			m_previous_animation_index = m_animation_index;
+		}
+		m_animation_index = m_next_animation_index;
+		m_fade_start = m_animation_time;
+		m_fade_time = m_next_fade_time;
+		fade = m_fade_time > 0.0f ? 0.0f : 1.0f;
+	}
+	if(fade >= 1.0f || lod != PoseCache::LOD_FULL)
+	{
+		m_fade_time = 0.0f;
+		fade = 1.0f;
+	}
+
+	bool additive = m_additive_index >= 0 && m_additive_weight > 0.0f && lod == PoseCache::LOD_FULL;
+	if(fade >= 1.0f && !additive)
+	{
+		m_pose = &cache.requestPose(m_mesh, m_animation_index, m_animation_time, lod, mesh_lod);
+		return;
+	}
+
+	PoseCache::Layer layers[3];
+	unsigned int num_layers = 0;
+	if(fade < 1.0f)
+	{
+		layers[num_layers++] = makeLayer(m_previous_animation_index, m_animation_time, 1.0f - fade, false);
+	}
+	layers[num_layers++] = makeLayer(m_animation_index, m_animation_time, fade, false);
+	if(additive)
+	{
+		layers[num_layers++] = makeLayer(m_additive_index, m_animation_time, m_additive_weight, true);
+	}
+	m_pose = &cache.requestLayeredPose(m_mesh, layers, num_layers, mesh_lod);
+}
@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include "mesh.hpp"
+#include "pose_cache.hpp"
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/quaternion.hpp"
@@ -17,6 +18,7 @@ public:
 	Renderable() {}
 	virtual ~Renderable() {}
 	virtual void render() { m_mesh->render(); }
+	Mesh* getMesh() { return m_mesh; }
 	const glm::mat4& getTranslation() { return m_translation_matrix; }
 	const glm::mat4& getRotation() { return m_rotation_matrix; }
 	const glm::mat4& getScale() { return m_scale_matrix; }
@@ -50,7 +52,7 @@ public:
 		LEFT,
 		RIGHT
 	};
-	DynamicRenderable(std::vector<Mesh*>& meshes, glm::vec3 translation, glm::vec3 rotation,
+	DynamicRenderable(Mesh* mesh, glm::vec3 translation, glm::vec3 rotation,
 					  glm::vec3 scale, bool isVisible, btPairCachingGhostObject* controller);
 	virtual ~DynamicRenderable();
 	void rotateForward();
@@ -68,22 +70,58 @@ public:
 	const glm::vec3& getTransform();
 	void setTransform(float x, float y, float z);
 	void move();
-	void UpdateTransforms(float Time)
+	// Requests the pose from the frame's cache, so characters in step share
+	// it. getTransforms is only valid once the cache has evaluated it.
+	// A frozen character keeps the time it froze at. Crossfades and the
+	// additive layer are only played at LOD_FULL. mesh_lod picks the LOD of
+	// the mesh renderSkinned draws until the next call.
+	void UpdateTransforms(float Time, PoseCache& cache,
+						  PoseCache::AnimationLod lod = PoseCache::LOD_FULL,
+						  unsigned int mesh_lod = 0);
+	const std::vector<Matrix4f>& getTransforms()
 	{
-		m_animation_meshes[m_animation_index]->boneTransform(Time, m_transforms);
+		return m_pose->Transforms;
 	}
-	const std::vector<Matrix4f>& getTransforms()
+	// Draws the character from the frame's skinned vertex buffer
+	void renderSkinned(GLuint buffer)
+	{
+		m_mesh->renderSkinned(buffer, m_pose->SkinnedBaseVertex[m_mesh_lod], m_mesh_lod);
+	}
+	// Every animation is a clip of the same mesh, so this only changes
+	// which clip UpdateTransforms samples. The new clip fades in over
+	// fade_time seconds. Only the last call before UpdateTransforms counts,
+	// and asking for the clip already playing changes nothing.
+	void setAnimation(int index, float fade_time = 0.0f)
 	{
-		return m_transforms;
+		m_next_animation_index = index;
+		m_next_fade_time = fade_time;
 	}
-	void render()
+	// Plays a clip on top of the others, adding how far it strays from its
+	// first frame. A negative index removes it.
+	void setAdditiveAnimation(int index, float weight)
 	{
-		m_animation_meshes[m_animation_index]->render();
+		m_additive_index = index;
+		m_additive_weight = weight;
 	}
-	void setAnimation(int index)
+	// Seconds added to the time the clip is sampled at, to put characters
+	// out of step with each other
+	void setAnimationOffset(float offset)
 	{
-		m_animation_index = index;
+		m_animation_offset = offset;
 	}
+	// World space sphere around every pose the character can take with the
+	// clips it is playing or about to play
+	void getAnimationBounds(glm::vec3& center, float& radius);
+	// Set by the game each frame before UpdateTransforms. A character that
+	// neither is in view nor casts a shadow into it is not posed at all,
+	// and must not be drawn.
+	void setCulling(bool in_view, bool casts_shadow)
+	{
+		m_in_view = in_view;
+		m_casts_shadow = casts_shadow;
+	}
+	bool isInView() { return m_in_view; }
+	bool castsShadow() { return m_casts_shadow; }
 	const btPairCachingGhostObject* getController()
 	{
 		return m_ghost_object;
@@ -95,12 +133,28 @@ protected:
 	glm::quat m_initial_rotation;
 	glm::vec3 m_rotation;
 	glm::vec3 m_scale;
-	std::vector<Matrix4f> m_transforms;
-	std::vector<Mesh*> m_animation_meshes;
+	const PoseCache::Pose* m_pose;	// owned by the PoseCache
 	unsigned int m_animation_index;
+	float m_animation_offset;
+	float m_animation_time;	// the clip time of the last UpdateTransforms
+	unsigned int m_next_animation_index;	// set by setAnimation
+	float m_next_fade_time;
+	// The clip m_animation_index is fading in over, until m_animation_time
+	// reaches m_fade_start + m_fade_time
+	unsigned int m_previous_animation_index;
+	float m_fade_start;
+	float m_fade_time;
+	int m_additive_index;
+	float m_additive_weight;
+	unsigned int m_mesh_lod;	// the LOD of m_mesh m_pose was requested for
+	bool m_in_view;
+	bool m_casts_shadow;
 
 	Direction m_direction;
 	btPairCachingGhostObject* m_ghost_object;
+
+	// What m_pose points at before the first UpdateTransforms
+	static const PoseCache::Pose s_no_pose;
 };
 
 #endif
@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include "scene.hpp"
+#include "mapped_file.hpp"
+#include "trace.hpp"
+
+// Bump this whenever the binary layout changes
+#define COOKED_SCENE_VERSION 3
+
+namespace
+{
+	struct CookedSceneHeader
+	{
+		char Magic[4];
+		unsigned int Version;
+		unsigned int NumMeshes;
+		unsigned int NumClipFilenames;
+		unsigned int NumInstances;
+	};
+
+	void copyName(char* Dest, const std::string& Src, size_t Size)
+	{
+		strncpy(Dest, Src.c_str(), Size - 1);
+		Dest[Size - 1] = '\0';
+	}
+}
+
+std::string Scene::getCookedFilename(const std::string& Filename)
+{
+	std::string::size_type DotIndex = Filename.find_last_of(".");
+	if(DotIndex == std::string::npos)
+	{
+		return Filename + ".scene";
+	}
+
+	return Filename.substr(0, DotIndex) + ".scene";
+}
+
+void Scene::clear()
+{
+	m_Meshes.clear();
+	m_ClipFilenames.clear();
+	m_Instances.clear();
+}
+
+bool Scene::load(const std::string& Filename)
+{
+	TraceScope scope("scene", Filename);
+
+	std::string CookedFilename = getCookedFilename(Filename);
+	if(!isFileNewer(Filename, CookedFilename) && loadBinary(CookedFilename))
+	{
+		return true;
+	}
+
+	return loadText(Filename);
+}
+
+bool Scene::loadText(const std::string& Filename)
+{
+	clear();
+
+	std::ifstream File(Filename.c_str());
+	if(!File)
+	{
+		printf("Error opening scene '%s'\n", Filename.c_str());
+		return false;
+	}
+	Trace::addFileRead(Filename);
+
+	std::string Line;
+	unsigned int LineNumber = 0;
+	while(std::getline(File, Line))
+	{
+		LineNumber++;
+
+		std::string::size_type Comment = Line.find('#');
+		if(Comment != std::string::npos)
+		{
+			Line.erase(Comment);
+		}
+
+		std::istringstream Tokens(Line);
+		std::string Keyword;
+		if(!(Tokens >> Keyword))
+		{
+			continue;
+		}
+
+		if(Keyword == "mesh" || Keyword == "skinned" || Keyword == "skinned_dq")
+		{
+			std::string Name, MeshFilename, Clip;
+			if(!(Tokens >> Name >> MeshFilename))
+			{
+				printf("%s:%u: expected a mesh name and file\n", Filename.c_str(), LineNumber);
+				return false;
+			}
+
+			MeshInfo Mesh;
+			copyName(Mesh.Name, Name, sizeof(Mesh.Name));
+			copyName(Mesh.Filename, MeshFilename, sizeof(Mesh.Filename));
+			Mesh.Type = Keyword == "mesh" ? STATIC_MESH : SKINNED_MESH;
+			Mesh.Skinning = Keyword == "skinned_dq" ? Mesh::DUAL_QUATERNION_SKINNING : Mesh::LINEAR_SKINNING;
+			Mesh.FirstClip = m_ClipFilenames.size();
+			while(Mesh.Type == SKINNED_MESH && Tokens >> Clip)
+			{
+				m_ClipFilenames.push_back(ClipFilename());
+				copyName(m_ClipFilenames.back().Filename, Clip, sizeof(m_ClipFilenames.back().Filename));
+			}
+			Mesh.NumClips = m_ClipFilenames.size() - Mesh.FirstClip;
+			m_Meshes.push_back(Mesh);
+		}
+		else if(Keyword == "static" || Keyword == "dynamic")
+		{
+			std::string MeshName, Collider;
+			Instance Object;
+			memset(&Object, 0, sizeof(Object));
+			Tokens >> MeshName >> Collider
+				   >> Object.Translation[0] >> Object.Translation[1] >> Object.Translation[2]
+				   >> Object.Rotation[0] >> Object.Rotation[1] >> Object.Rotation[2]
+				   >> Object.Scale[0] >> Object.Scale[1] >> Object.Scale[2];
+			Object.Type = Keyword == "static" ? STATIC_INSTANCE : DYNAMIC_INSTANCE;
+			if(Object.Type == DYNAMIC_INSTANCE)
+			{
+				Tokens >> Object.ColliderRadius >> Object.ColliderHeight;
+			}
+
+			if(!Tokens)
+			{
+				printf("%s:%u: malformed %s entry\n", Filename.c_str(), LineNumber, Keyword.c_str());
+				return false;
+			}
+
+			int MeshIndex = findMesh(MeshName);
+			if(MeshIndex < 0)
+			{
+				printf("%s:%u: unknown mesh '%s'\n", Filename.c_str(), LineNumber, MeshName.c_str());
+				return false;
+			}
+			Object.MeshIndex = MeshIndex;
+
+			if(Collider == "none" && Object.Type == STATIC_INSTANCE)
+			{
+				Object.Collider = NO_COLLIDER;
+			}
+			else if(Collider == "mesh" && Object.Type == STATIC_INSTANCE &&
+					m_Meshes[MeshIndex].Type == STATIC_MESH)
+			{
+				Object.Collider = MESH_COLLIDER;
+			}
+			else if(Collider == "capsule" && Object.Type == DYNAMIC_INSTANCE)
+			{
+				Object.Collider = CAPSULE_COLLIDER;
+			}
+			else
+			{
+				printf("%s:%u: collider '%s' is not supported here\n", Filename.c_str(), LineNumber,
+					   Collider.c_str());
+				return false;
+			}
+
+			m_Instances.push_back(Object);
+		}
+		else if(Keyword == "crowd")
+		{
+			std::string MeshName;
+			Instance Object;
+			memset(&Object, 0, sizeof(Object));
+			Tokens >> MeshName >> Object.CrowdClip >> Object.CrowdCount >> Object.CrowdRadius
+				   >> Object.Translation[0] >> Object.Translation[1] >> Object.Translation[2]
+				   >> Object.Rotation[0] >> Object.Rotation[1] >> Object.Rotation[2]
+				   >> Object.Scale[0] >> Object.Scale[1] >> Object.Scale[2];
+			Object.Type = CROWD_INSTANCE;
+			Object.Collider = NO_COLLIDER;
+
+			if(!Tokens)
+			{
+				printf("%s:%u: malformed crowd entry\n", Filename.c_str(), LineNumber);
+				return false;
+			}
+
+			int MeshIndex = findMesh(MeshName);
+			if(MeshIndex < 0 || m_Meshes[MeshIndex].Type != SKINNED_MESH)
+			{
+				printf("%s:%u: '%s' is not a skinned mesh\n", Filename.c_str(), LineNumber, MeshName.c_str());
+				return false;
+			}
+			Object.MeshIndex = MeshIndex;
+
+			// Clip 0 comes with the mesh's own file
+			if(Object.CrowdClip > m_Meshes[MeshIndex].NumClips)
+			{
+				printf("%s:%u: '%s' has no clip %u\n", Filename.c_str(), LineNumber, MeshName.c_str(),
+					   Object.CrowdClip);
+				return false;
+			}
+
+			m_Instances.push_back(Object);
+		}
+		else
+		{
+			printf("%s:%u: unknown entry '%s'\n", Filename.c_str(), LineNumber, Keyword.c_str());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Scene::loadBinary(const std::string& Filename)
+{
+	clear();
+
+	MappedFile File;
+	if(!File.open(Filename))
+	{
+		return false;
+	}
+
+	Trace::addBytesRead(File.size());
+
+	const CookedSceneHeader* pHeader = (const CookedSceneHeader*)File.data();
+	if(File.size() < sizeof(CookedSceneHeader) || memcmp(pHeader->Magic, "SCNE", 4) != 0 ||
+	   pHeader->Version != COOKED_SCENE_VERSION)
+	{
+		printf("Ignoring '%s', it was cooked with a different version\n", Filename.c_str());
+		return false;
+	}
+
+	// 64 bit so that counts from a damaged file cannot wrap the sum around
+	unsigned long long Size = sizeof(CookedSceneHeader) +
+							  (unsigned long long)pHeader->NumMeshes * sizeof(MeshInfo) +
+							  (unsigned long long)pHeader->NumClipFilenames * sizeof(ClipFilename) +
+							  (unsigned long long)pHeader->NumInstances * sizeof(Instance);
+	if(File.size() < Size)
+	{
+		printf("Cooked scene '%s' is truncated\n", Filename.c_str());
+		return false;
+	}
+
+	const MeshInfo* pMeshes = (const MeshInfo*)(pHeader + 1);
+	const ClipFilename* pClips = (const ClipFilename*)(pMeshes + pHeader->NumMeshes);
+	const Instance* pInstances = (const Instance*)(pClips + pHeader->NumClipFilenames);
+	m_Meshes.assign(pMeshes, pMeshes + pHeader->NumMeshes);
+	m_ClipFilenames.assign(pClips, pClips + pHeader->NumClipFilenames);
+	m_Instances.assign(pInstances, pInstances + pHeader->NumInstances);
+
+	if(!validate(Filename))
+	{
+		clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool Scene::validate(const std::string& Filename) const
+{
+	for(unsigned int i = 0; i < m_Meshes.size(); i++)
+	{
+		const MeshInfo& Mesh = m_Meshes[i];
+		if(Mesh.FirstClip > m_ClipFilenames.size() || Mesh.NumClips > m_ClipFilenames.size() - Mesh.FirstClip)
+		{
+			printf("%s: mesh %u has clips past the end of the clip list\n", Filename.c_str(), i);
+			return false;
+		}
+	}
+
+	for(unsigned int i = 0; i < m_Instances.size(); i++)
+	{
+		const Instance& Object = m_Instances[i];
+		if(Object.MeshIndex >= m_Meshes.size())
+		{
+			printf("%s: instance %u has unknown mesh %u\n", Filename.c_str(), i, Object.MeshIndex);
+			return false;
+		}
+
+		// Clip 0 comes with the mesh's own file
+		const MeshInfo& Mesh = m_Meshes[Object.MeshIndex];
+		if(Object.Type == CROWD_INSTANCE && (Mesh.Type != SKINNED_MESH || Object.CrowdClip > Mesh.NumClips))
+		{
+			printf("%s: crowd %u has no clip %u\n", Filename.c_str(), i, Object.CrowdClip);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Scene::saveBinary(const std::string& Filename)
+{
+	FILE* File = fopen(Filename.c_str(), "wb");
+	if(!File)
+	{
+		printf("Error opening '%s' for writing\n", Filename.c_str());
+		return false;
+	}
+
+	CookedSceneHeader Header;
+	memcpy(Header.Magic, "SCNE", 4);
+	Header.Version = COOKED_SCENE_VERSION;
+	Header.NumMeshes = m_Meshes.size();
+	Header.NumClipFilenames = m_ClipFilenames.size();
+	Header.NumInstances = m_Instances.size();
+
+	fwrite(&Header, sizeof(Header), 1, File);
+	if(!m_Meshes.empty())
+	{
+		fwrite(&m_Meshes[0], sizeof(MeshInfo), m_Meshes.size(), File);
+	}
+	if(!m_ClipFilenames.empty())
+	{
+		fwrite(&m_ClipFilenames[0], sizeof(ClipFilename), m_ClipFilenames.size(), File);
+	}
+	if(!m_Instances.empty())
+	{
+		fwrite(&m_Instances[0], sizeof(Instance), m_Instances.size(), File);
+	}
+
+	bool Ret = !ferror(File);
+	fclose(File);
+
+	return Ret;
+}
+
+int Scene::findMesh(const std::string& Name) const
+{
+	for(unsigned int i = 0; i < m_Meshes.size(); i++)
+	{
+		if(Name == m_Meshes[i].Name)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+unsigned int Scene::countInstances(unsigned int Type) const
+{
+	unsigned int Count = 0;
+	for(unsigned int i = 0; i < m_Instances.size(); i++)
+	{
+		if(m_Instances[i].Type == Type)
+		{
+			Count++;
+		}
+	}
+
+	return Count;
+}
@@ -0,0 +1,88 @@
+#ifndef SCENE_HPP
+#define SCENE_HPP
+
+#include <string>
+#include <vector>
+#include "mesh.hpp"
+
+/* Description of everything placed in the world: which meshes to load and
+where each instance of them goes. Scenes are authored as text and cooked by
+scenecook into a binary file that is read with a single mapping. The text
+form is one entry per line, # starts a comment:
+
+	mesh    <name> <file>                  a mesh with a triangle collider
+	skinned <name> <file> [clip file ...]  an animated mesh, clip 0 is <file>
+	skinned_dq <name> <file> [clip ...]    the same, with dual quaternion skinning
+	static  <mesh> <collider> tx ty tz rx ry rz sx sy sz
+	dynamic <mesh> capsule tx ty tz rx ry rz sx sy sz radius height
+	crowd   <mesh> <clip> <count> <radius> tx ty tz rx ry rz sx sy sz
+
+Rotations are Euler angles in radians. A static collider is either "mesh",
+the triangle mesh of the instance's own mesh, or "none". A crowd scatters
+<count> copies of a skinned mesh on the ground within <radius> of the
+translation, each facing its own way and playing the clip from its own
+point. They have no collider and are drawn without any per instance work on
+the CPU. Meshes have to be declared before they are placed. */
+
+#define SCENE_NAME_LENGTH 64
+
+class Scene
+{
+public:
+	enum MeshType { STATIC_MESH, SKINNED_MESH };
+	enum InstanceType { STATIC_INSTANCE, DYNAMIC_INSTANCE, CROWD_INSTANCE };
+	enum ColliderType { NO_COLLIDER, MESH_COLLIDER, CAPSULE_COLLIDER };
+
+	struct MeshInfo
+	{
+		char Name[SCENE_NAME_LENGTH];
+		char Filename[MESH_PATH_LENGTH];
+		unsigned int Type;
+		unsigned int FirstClip;		// index into m_ClipFilenames
+		unsigned int NumClips;
+		unsigned int Skinning;		// a Mesh::SkinningMode
+	};
+	struct ClipFilename
+	{
+		char Filename[MESH_PATH_LENGTH];
+	};
+	struct Instance
+	{
+		unsigned int MeshIndex;
+		unsigned int Type;
+		unsigned int Collider;
+		float Translation[3];
+		float Rotation[3];
+		float Scale[3];
+		float ColliderRadius;
+		float ColliderHeight;
+		// Crowds only
+		unsigned int CrowdClip;
+		unsigned int CrowdCount;
+		float CrowdRadius;
+	};
+
+	// Loads the cooked version of the scene if it is up to date, otherwise
+	// parses the text
+	bool load(const std::string& Filename);
+	bool loadText(const std::string& Filename);
+	bool loadBinary(const std::string& Filename);
+	bool saveBinary(const std::string& Filename);
+	static std::string getCookedFilename(const std::string& Filename);
+
+	// Returns the index of the named mesh, or -1
+	int findMesh(const std::string& Name) const;
+	unsigned int countInstances(unsigned int Type) const;
+
+	std::vector<MeshInfo> m_Meshes;
+	std::vector<ClipFilename> m_ClipFilenames;
+	std::vector<Instance> m_Instances;
+
+private:
+	void clear();
+	// Checks the references between the tables, the text loader does the
+	// same checks while it parses
+	bool validate(const std::string& Filename) const;
+};
+
+#endif
@@ -0,0 +1,37 @@
+/* Offline scene cooker. Parses each text scene and writes it next to the
+source as a binary .scene file, which the game reads with one mapping
+instead of parsing the text.
+
+Usage: scenecook scene.txt [scene.txt ...] */
+
+#include <iostream>
+#include "scene.hpp"
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " scene [scene ...]" << std::endl;
+		return 1;
+	}
+
+	int Ret = 0;
+
+	for(int i = 1; i < argc; i++)
+	{
+		std::string Filename(argv[i]);
+		std::string CookedFilename = Scene::getCookedFilename(Filename);
+
+		Scene scene;
+		if(!scene.loadText(Filename) || !scene.saveBinary(CookedFilename))
+		{
+			Ret = 1;
+			continue;
+		}
+
+		printf("%-28s -> %-28s %u meshes, %u instances\n", Filename.c_str(), CookedFilename.c_str(),
+			   (unsigned int)scene.m_Meshes.size(), (unsigned int)scene.m_Instances.size());
+	}
+
+	return Ret;
+}
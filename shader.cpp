@@ -12,8 +12,24 @@ using namespace std;
 #include <GL/glew.h>
 
 #include "shader.hpp"
+#include "trace.hpp"
+
+static void insertDefines(std::string& Code, const std::string& Defines)
+{
+	size_t Version = Code.find("#version");
+	size_t LineEnd = Version == std::string::npos ? std::string::npos : Code.find('\n', Version);
+	if(LineEnd == std::string::npos)
+	{
+		Code = Defines + Code;
+		return;
+	}
+	Code.insert(LineEnd + 1, Defines);
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path,
+				   const std::string& Defines){
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+	TraceScope scope("shader", std::string(vertex_file_path) + " " + fragment_file_path);
 
 	// Create the shaders
 	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
@@ -44,6 +60,14 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 
 
 
+	Trace::addBytesRead(VertexShaderCode.size() + FragmentShaderCode.size());
+
+	if(!Defines.empty())
+	{
+		insertDefines(VertexShaderCode, Defines);
+		insertDefines(FragmentShaderCode, Defines);
+	}
+
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
 
@@ -106,3 +130,66 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 }
 
 
+
+GLuint LoadTransformFeedbackShader(const char* vertex_file_path, const char* const* Varyings,
+								   int NumVaryings, const std::string& Defines)
+{
+	TraceScope scope("shader", vertex_file_path);
+
+	std::string VertexShaderCode;
+	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
+	if(!VertexShaderStream.is_open())
+	{
+		printf("Impossible to open %s\n", vertex_file_path);
+		return 0;
+	}
+	std::string Line;
+	while(getline(VertexShaderStream, Line))
+	{
+		VertexShaderCode += "\n" + Line;
+	}
+	Trace::addBytesRead(VertexShaderCode.size());
+
+	if(!Defines.empty())
+	{
+		insertDefines(VertexShaderCode, Defines);
+	}
+
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
+
+	printf("Compiling shader : %s\n", vertex_file_path);
+	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	char const* VertexSourcePointer = VertexShaderCode.c_str();
+	glShaderSource(VertexShaderID, 1, &VertexSourcePointer, NULL);
+	glCompileShader(VertexShaderID);
+
+	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
+	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if(InfoLogLength > 0)
+	{
+		std::vector<char> VertexShaderErrorMessage(InfoLogLength + 1);
+		glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
+		printf("%s\n", &VertexShaderErrorMessage[0]);
+	}
+
+	// The varyings have to be chosen before linking
+	printf("Linking program\n");
+	GLuint ProgramID = glCreateProgram();
+	glAttachShader(ProgramID, VertexShaderID);
+	glTransformFeedbackVaryings(ProgramID, NumVaryings, (const GLchar**)Varyings, GL_INTERLEAVED_ATTRIBS);
+	glLinkProgram(ProgramID);
+
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if(InfoLogLength > 0)
+	{
+		std::vector<char> ProgramErrorMessage(InfoLogLength + 1);
+		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+		printf("%s\n", &ProgramErrorMessage[0]);
+	}
+
+	glDeleteShader(VertexShaderID);
+
+	return ProgramID;
+}
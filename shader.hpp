@@ -1,6 +1,15 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
+#include <string>
+
+// Defines is inserted into both shaders right after their #version line, for
+// things like array sizes that are only known at runtime
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path,
+				   const std::string& Defines = "");
+// A vertex shader on its own whose outputs named in Varyings are captured
+// interleaved by transform feedback, in that order
+GLuint LoadTransformFeedbackShader(const char* vertex_file_path, const char* const* Varyings,
+								   int NumVaryings, const std::string& Defines = "");
 
 #endif
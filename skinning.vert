@@ -0,0 +1,73 @@
+#version 400
+
+// The skinning pre-pass. Run over every vertex of a skinned mesh once per
+// frame and pose with the rasterizer off, the outputs are captured by
+// transform feedback and drawn afterwards like a static mesh.
+
+layout (location = 0) in vec3 VertexPosition;
+layout (location = 1) in vec2 VertexUVCoords;
+layout (location = 2) in vec3 VertexNormal;
+layout (location = 3) in ivec4 BoneIDs;
+layout (location = 4) in vec4 BoneWeights;
+
+out vec3 SkinnedPosition;
+out vec3 SkinnedNormal;
+out vec2 SkinnedUVCoords;
+
+// MAX_BONES is defined by the game to fit the loaded skeletons, as is
+// DUAL_QUATERNION_SKINNING for the program used by meshes skinned that way.
+#ifdef DUAL_QUATERNION_SKINNING
+
+// Two vec4s per bone, the rotation and then the dual part
+layout (std140) uniform BonePalette
+{
+	vec4 boneDualQuats[2 * MAX_BONES];
+};
+
+void main()
+{
+	vec4 real0 = boneDualQuats[2 * BoneIDs[0]];
+	vec4 real = vec4(0.0);
+	vec4 dual = vec4(0.0);
+	for(int i = 0; i < 4; i++)
+	{
+		vec4 boneReal = boneDualQuats[2 * BoneIDs[i]];
+		vec4 boneDual = boneDualQuats[2 * BoneIDs[i] + 1];
+		// q and -q are the same rotation, blend them all on the same side
+		float weight = dot(real0, boneReal) < 0.0 ? -BoneWeights[i] : BoneWeights[i];
+		real += boneReal * weight;
+		dual += boneDual * weight;
+	}
+	float len = length(real);
+	real /= len;
+	dual /= len;
+
+	vec3 p = VertexPosition;
+	vec3 n = VertexNormal;
+	vec3 translation = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+	SkinnedPosition = p + 2.0 * cross(real.xyz, cross(real.xyz, p) + real.w * p) + translation;
+	SkinnedNormal = n + 2.0 * cross(real.xyz, cross(real.xyz, n) + real.w * n);
+	SkinnedUVCoords = VertexUVCoords;
+}
+
+#else
+
+// The matrices are stored row major, the way the game keeps them
+layout (std140, row_major) uniform BonePalette
+{
+	mat4 boneMatrices[MAX_BONES];
+};
+
+void main()
+{
+	mat4 boneMatrix = boneMatrices[BoneIDs[0]] * BoneWeights[0];
+	boneMatrix += boneMatrices[BoneIDs[1]] * BoneWeights[1];
+	boneMatrix += boneMatrices[BoneIDs[2]] * BoneWeights[2];
+	boneMatrix += boneMatrices[BoneIDs[3]] * BoneWeights[3];
+
+	SkinnedPosition = vec3(boneMatrix * vec4(VertexPosition, 1.0));
+	SkinnedNormal = mat3(boneMatrix) * VertexNormal;
+	SkinnedUVCoords = VertexUVCoords;
+}
+
+#endif
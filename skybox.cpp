@@ -3,6 +3,7 @@
 #include <SFML/OpenGL.hpp>
 #include <SFML/Graphics.hpp>
 #include "skybox.hpp"
+#include "trace.hpp"
 
 const GLfloat skybox_vertices[] = 
 {
@@ -29,6 +30,14 @@ const GLuint skybox_indices[] =
 Skybox::Skybox(std::string top, std::string bottom, std::string front,
 			   std::string back, std::string left, std::string right)
 {
+	TraceScope scope("texture", "skybox");
+	Trace::addFileRead(top);
+	Trace::addFileRead(bottom);
+	Trace::addFileRead(front);
+	Trace::addFileRead(back);
+	Trace::addFileRead(left);
+	Trace::addFileRead(right);
+
 	if(!m_top.loadFromFile(top))
 	{
 		std::cerr << "Could not load skybox texture " << top << std::endl;
@@ -62,6 +71,8 @@ Skybox::~Skybox()
 
 void Skybox::init()
 {
+	TraceScope scope("upload", "skybox");
+
 	glActiveTexture(GL_TEXTURE1);
 	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
@@ -85,6 +96,12 @@ void Skybox::init()
 				 0, GL_RGBA, GL_UNSIGNED_BYTE, m_front.getPixelsPtr());
 	glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, GL_RGB, m_back.getSize().x, m_back.getSize().y,
 				 0, GL_RGBA, GL_UNSIGNED_BYTE, m_back.getPixelsPtr());
+	Trace::addBytesUploaded(4 * (m_right.getSize().x * m_right.getSize().y +
+								 m_left.getSize().x * m_left.getSize().y +
+								 m_top.getSize().x * m_top.getSize().y +
+								 m_bottom.getSize().x * m_bottom.getSize().y +
+								 m_front.getSize().x * m_front.getSize().y +
+								 m_back.getSize().x * m_back.getSize().y));
 
 	glGenBuffers(1, &m_VBO);
 	glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
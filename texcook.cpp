@@ -0,0 +1,332 @@
+/* Offline texture cooker. Decodes each image, builds the full mip chain with
+a box filter and block compresses every level, BC1 for opaque images and BC3
+for images with any transparency. The result is written next to the source
+as a .ktx file, which Texture uploads directly without decoding anything.
+
+Usage: texcook image.png [image.jpg ...] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include <GL/glew.h>
+#include <SFML/Graphics.hpp>
+#include "ktx.hpp"
+
+namespace
+{
+	struct Level
+	{
+		unsigned int Width;
+		unsigned int Height;
+		std::vector<unsigned char> Pixels;	// RGBA8, top row first like sf::Image
+	};
+
+	void buildMipChain(const sf::Image& Image, std::vector<Level>& Levels)
+	{
+		Levels.resize(1);
+		Levels[0].Width = Image.getSize().x;
+		Levels[0].Height = Image.getSize().y;
+		Levels[0].Pixels.assign(Image.getPixelsPtr(),
+								Image.getPixelsPtr() + Levels[0].Width * Levels[0].Height * 4);
+
+		while(Levels.back().Width > 1 || Levels.back().Height > 1)
+		{
+			Levels.push_back(Level());
+			const Level& Src = Levels[Levels.size() - 2];
+			Level& Dst = Levels.back();
+			Dst.Width = Src.Width > 1 ? Src.Width / 2 : 1;
+			Dst.Height = Src.Height > 1 ? Src.Height / 2 : 1;
+			Dst.Pixels.resize(Dst.Width * Dst.Height * 4);
+
+			for(unsigned int y = 0; y < Dst.Height; y++)
+			{
+				unsigned int y0 = y * 2;
+				unsigned int y1 = y0 + 1 < Src.Height ? y0 + 1 : y0;
+				for(unsigned int x = 0; x < Dst.Width; x++)
+				{
+					unsigned int x0 = x * 2;
+					unsigned int x1 = x0 + 1 < Src.Width ? x0 + 1 : x0;
+					for(unsigned int c = 0; c < 4; c++)
+					{
+						unsigned int Sum = Src.Pixels[(y0 * Src.Width + x0) * 4 + c] +
+										   Src.Pixels[(y0 * Src.Width + x1) * 4 + c] +
+										   Src.Pixels[(y1 * Src.Width + x0) * 4 + c] +
+										   Src.Pixels[(y1 * Src.Width + x1) * 4 + c];
+						Dst.Pixels[(y * Dst.Width + x) * 4 + c] = (Sum + 2) / 4;
+					}
+				}
+			}
+		}
+	}
+
+	bool hasAlpha(const Level& Base)
+	{
+		for(unsigned int i = 3; i < Base.Pixels.size(); i += 4)
+		{
+			if(Base.Pixels[i] != 255)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	unsigned short pack565(const unsigned char* pColor)
+	{
+		return ((pColor[0] >> 3) << 11) | ((pColor[1] >> 2) << 5) | (pColor[2] >> 3);
+	}
+
+	void unpack565(unsigned short Packed, int* pColor)
+	{
+		int r = (Packed >> 11) & 31;
+		int g = (Packed >> 5) & 63;
+		int b = Packed & 31;
+		pColor[0] = (r << 3) | (r >> 2);
+		pColor[1] = (g << 2) | (g >> 4);
+		pColor[2] = (b << 3) | (b >> 2);
+	}
+
+	void writeLittleEndian(std::vector<unsigned char>& Out, unsigned long long Value, unsigned int Bytes)
+	{
+		for(unsigned int i = 0; i < Bytes; i++)
+		{
+			Out.push_back((Value >> (i * 8)) & 0xFF);
+		}
+	}
+
+	// BC1 color block from the bounding box of the block's colors, always in
+	// four color mode since BC3 does not support the other one
+	void encodeColorBlock(const unsigned char Block[16][4], std::vector<unsigned char>& Out)
+	{
+		unsigned char Min[3] = { 255, 255, 255 };
+		unsigned char Max[3] = { 0, 0, 0 };
+		for(unsigned int i = 0; i < 16; i++)
+		{
+			for(unsigned int c = 0; c < 3; c++)
+			{
+				Min[c] = Block[i][c] < Min[c] ? Block[i][c] : Min[c];
+				Max[c] = Block[i][c] > Max[c] ? Block[i][c] : Max[c];
+			}
+		}
+
+		// Pull the endpoints in a little, the box corners are rarely the
+		// best fit and this noticeably reduces the error
+		for(unsigned int c = 0; c < 3; c++)
+		{
+			unsigned char Inset = (Max[c] - Min[c]) / 16;
+			Min[c] = Min[c] + Inset;
+			Max[c] = Max[c] - Inset;
+		}
+
+		unsigned short Color0 = pack565(Max);
+		unsigned short Color1 = pack565(Min);
+		if(Color0 < Color1)
+		{
+			unsigned short Swap = Color0;
+			Color0 = Color1;
+			Color1 = Swap;
+		}
+
+		unsigned int Indices = 0;
+		if(Color0 != Color1)
+		{
+			int Palette[4][3];
+			unpack565(Color0, Palette[0]);
+			unpack565(Color1, Palette[1]);
+			for(unsigned int c = 0; c < 3; c++)
+			{
+				Palette[2][c] = (2 * Palette[0][c] + Palette[1][c]) / 3;
+				Palette[3][c] = (Palette[0][c] + 2 * Palette[1][c]) / 3;
+			}
+
+			for(unsigned int i = 0; i < 16; i++)
+			{
+				unsigned int Best = 0;
+				int BestError = 0x7FFFFFFF;
+				for(unsigned int p = 0; p < 4; p++)
+				{
+					int Error = 0;
+					for(unsigned int c = 0; c < 3; c++)
+					{
+						int Delta = Block[i][c] - Palette[p][c];
+						Error += Delta * Delta;
+					}
+					if(Error < BestError)
+					{
+						BestError = Error;
+						Best = p;
+					}
+				}
+				Indices |= Best << (i * 2);
+			}
+		}
+
+		writeLittleEndian(Out, Color0, 2);
+		writeLittleEndian(Out, Color1, 2);
+		writeLittleEndian(Out, Indices, 4);
+	}
+
+	// BC3 alpha block in eight value mode
+	void encodeAlphaBlock(const unsigned char Block[16][4], std::vector<unsigned char>& Out)
+	{
+		unsigned char Alpha0 = 0;
+		unsigned char Alpha1 = 255;
+		for(unsigned int i = 0; i < 16; i++)
+		{
+			Alpha0 = Block[i][3] > Alpha0 ? Block[i][3] : Alpha0;
+			Alpha1 = Block[i][3] < Alpha1 ? Block[i][3] : Alpha1;
+		}
+
+		unsigned long long Indices = 0;
+		if(Alpha0 != Alpha1)
+		{
+			int Palette[8];
+			Palette[0] = Alpha0;
+			Palette[1] = Alpha1;
+			for(unsigned int p = 1; p < 7; p++)
+			{
+				Palette[p + 1] = ((7 - p) * Alpha0 + p * Alpha1) / 7;
+			}
+
+			for(unsigned int i = 0; i < 16; i++)
+			{
+				unsigned long long Best = 0;
+				int BestError = 256;
+				for(unsigned int p = 0; p < 8; p++)
+				{
+					int Error = abs(Block[i][3] - Palette[p]);
+					if(Error < BestError)
+					{
+						BestError = Error;
+						Best = p;
+					}
+				}
+				Indices |= Best << (i * 3);
+			}
+		}
+
+		Out.push_back(Alpha0);
+		Out.push_back(Alpha1);
+		writeLittleEndian(Out, Indices, 6);
+	}
+
+	void compressLevel(const Level& Src, bool IsBC3, std::vector<unsigned char>& Out)
+	{
+		// Blocks past the edge of levels smaller than 4x4 repeat the last
+		// row and column
+		for(unsigned int by = 0; by < Src.Height; by += 4)
+		{
+			for(unsigned int bx = 0; bx < Src.Width; bx += 4)
+			{
+				unsigned char Block[16][4];
+				for(unsigned int y = 0; y < 4; y++)
+				{
+					unsigned int py = by + y < Src.Height ? by + y : Src.Height - 1;
+					for(unsigned int x = 0; x < 4; x++)
+					{
+						unsigned int px = bx + x < Src.Width ? bx + x : Src.Width - 1;
+						memcpy(Block[y * 4 + x], &Src.Pixels[(py * Src.Width + px) * 4], 4);
+					}
+				}
+
+				if(IsBC3)
+				{
+					encodeAlphaBlock(Block, Out);
+				}
+				encodeColorBlock(Block, Out);
+			}
+		}
+	}
+
+	bool writeKtx(const std::string& Filename, const std::vector<Level>& Levels, bool IsBC3,
+				  unsigned int& TotalBytes)
+	{
+		FILE* File = fopen(Filename.c_str(), "wb");
+		if(!File)
+		{
+			printf("Error opening '%s' for writing\n", Filename.c_str());
+			return false;
+		}
+
+		KtxHeader Header;
+		memset(&Header, 0, sizeof(Header));
+		memcpy(Header.Identifier, KtxIdentifier, sizeof(Header.Identifier));
+		Header.Endianness = KTX_ENDIANNESS;
+		Header.GlTypeSize = 1;
+		Header.GlInternalFormat = IsBC3 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		Header.GlBaseInternalFormat = IsBC3 ? GL_RGBA : GL_RGB;
+		Header.PixelWidth = Levels[0].Width;
+		Header.PixelHeight = Levels[0].Height;
+		Header.NumberOfFaces = 1;
+		Header.NumberOfMipmapLevels = Levels.size();
+		fwrite(&Header, sizeof(Header), 1, File);
+
+		TotalBytes = 0;
+		std::vector<unsigned char> Blocks;
+		for(unsigned int i = 0; i < Levels.size(); i++)
+		{
+			Blocks.clear();
+			compressLevel(Levels[i], IsBC3, Blocks);
+
+			// Block sizes are multiples of 8, so no mip padding is needed
+			unsigned int ImageSize = Blocks.size();
+			fwrite(&ImageSize, sizeof(ImageSize), 1, File);
+			fwrite(&Blocks[0], 1, Blocks.size(), File);
+			TotalBytes += ImageSize;
+		}
+
+		bool Ret = !ferror(File);
+		fclose(File);
+
+		return Ret;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " image [image ...]" << std::endl;
+		return 1;
+	}
+
+	int Ret = 0;
+
+	for(int i = 1; i < argc; i++)
+	{
+		std::string Filename(argv[i]);
+		std::string CookedFilename = getCookedTextureFilename(Filename);
+
+		sf::Image Image;
+		if(!Image.loadFromFile(Filename))
+		{
+			Ret = 1;
+			continue;
+		}
+
+		std::vector<Level> Levels;
+		buildMipChain(Image, Levels);
+		bool IsBC3 = hasAlpha(Levels[0]);
+
+		unsigned int CookedBytes = 0;
+		if(!writeKtx(CookedFilename, Levels, IsBC3, CookedBytes))
+		{
+			Ret = 1;
+			continue;
+		}
+
+		unsigned int RawBytes = 0;
+		for(unsigned int j = 0; j < Levels.size(); j++)
+		{
+			RawBytes += Levels[j].Pixels.size();
+		}
+
+		printf("%-28s -> %-28s %s %ux%u, %u levels, %u KB (%u KB as RGBA8)\n",
+			   Filename.c_str(), CookedFilename.c_str(), IsBC3 ? "BC3" : "BC1",
+			   Levels[0].Width, Levels[0].Height, (unsigned int)Levels.size(),
+			   CookedBytes / 1024, RawBytes / 1024);
+	}
+
+	return Ret;
+}
@@ -16,29 +16,193 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <algorithm>
 #include <iostream>
 #include "texture.h"
+#include "ktx.hpp"
+#include "trace.hpp"
 
-Texture::Texture(GLenum TextureTarget, const std::string& FileName)
+Texture::Texture(GLenum TextureTarget, const std::string& FileName, GLint Filter)
 {
     m_textureTarget = TextureTarget;
     m_fileName      = FileName;
+    m_filter        = Filter;
+    m_textureObj    = 0;
+    m_isDecoded     = false;
+    m_width         = 0;
+    m_height        = 0;
+    m_sizeInBytes   = 0;
+    m_isCompressed  = false;
+    m_internalFormat = 0;
+    m_numLevels     = 0;
+}
+
+Texture::~Texture()
+{
+    if(m_textureObj != 0)
+    {
+        glDeleteTextures(1, &m_textureObj);
+    }
 }
 
 bool Texture::Load()
 {
+    return Decode() && Upload();
+}
+
+bool Texture::Decode()
+{
+    sf::Lock lock(m_mutex);
+
+    if(m_isDecoded || m_textureObj != 0)
+    {
+        return true;
+    }
+
+    TraceScope scope("texture", m_fileName);
+
+    std::string CookedFileName = getCookedTextureFilename(m_fileName);
+    if(!isFileNewer(m_fileName, CookedFileName) && DecodeCooked(CookedFileName))
+    {
+        Trace::addBytesRead(m_cookedFile.size());
+        m_isDecoded = true;
+        return true;
+    }
+
 	//std::cerr << m_fileName << std::endl; 
+    Trace::addFileRead(m_fileName);
     if(!m_pImage.loadFromFile(m_fileName))
     {
     	std::cerr << "Error loading texture" << m_fileName << std::endl;
 		return false;
     }
 
+    m_width = m_pImage.getSize().x;
+    m_height = m_pImage.getSize().y;
+    // The generated mips add a third on top of the base level
+    m_sizeInBytes = m_width * m_height * 4 * 4 / 3;
+    m_isCompressed = false;
+    m_isDecoded = true;
+
+    return true;
+}
+
+bool Texture::DecodeCooked(const std::string& CookedFileName)
+{
+    if(!m_cookedFile.open(CookedFileName))
+    {
+        return false;
+    }
+
+    const KtxHeader* pHeader = (const KtxHeader*)m_cookedFile.data();
+    if(m_cookedFile.size() < sizeof(KtxHeader) ||
+       memcmp(pHeader->Identifier, KtxIdentifier, sizeof(KtxIdentifier)) != 0 ||
+       pHeader->Endianness != KTX_ENDIANNESS ||
+       pHeader->NumberOfFaces != 1 ||
+       pHeader->NumberOfMipmapLevels == 0 ||
+       (pHeader->GlInternalFormat != GL_COMPRESSED_RGB_S3TC_DXT1_EXT &&
+        pHeader->GlInternalFormat != GL_COMPRESSED_RGBA_S3TC_DXT5_EXT))
+    {
+        std::cerr << "Ignoring cooked texture " << CookedFileName << ", unsupported format" << std::endl;
+        m_cookedFile.close();
+        return false;
+    }
+
+    // Walk the levels once so Upload can trust the sizes. A file cut off
+    // between two levels is as truncated as one cut off inside a level.
+    size_t Offset = sizeof(KtxHeader) + pHeader->BytesOfKeyValueData;
+    unsigned int BlockSize = pHeader->GlInternalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? 8 : 16;
+    unsigned int Width = pHeader->PixelWidth;
+    unsigned int Height = pHeader->PixelHeight;
+    bool IsValid = true;
+    m_sizeInBytes = 0;
+    for(unsigned int i = 0; i < pHeader->NumberOfMipmapLevels && IsValid; i++)
+    {
+        if(Offset + sizeof(unsigned int) > m_cookedFile.size())
+        {
+            IsValid = false;
+            break;
+        }
+        unsigned int ImageSize = *(const unsigned int*)(m_cookedFile.data() + Offset);
+        unsigned int ExpectedSize = std::max(1u, (Width + 3) / 4) * std::max(1u, (Height + 3) / 4) * BlockSize;
+        IsValid = ImageSize == ExpectedSize;
+        Offset += sizeof(unsigned int) + ((ImageSize + 3) & ~3);
+        m_sizeInBytes += ImageSize;
+        Width = Width > 1 ? Width / 2 : 1;
+        Height = Height > 1 ? Height / 2 : 1;
+    }
+
+    if(!IsValid || Offset > m_cookedFile.size())
+    {
+        std::cerr << "Cooked texture " << CookedFileName << " is truncated or corrupt" << std::endl;
+        m_cookedFile.close();
+        return false;
+    }
+
+    m_width = pHeader->PixelWidth;
+    m_height = pHeader->PixelHeight;
+    m_internalFormat = pHeader->GlInternalFormat;
+    m_numLevels = pHeader->NumberOfMipmapLevels;
+    m_isCompressed = true;
+
+    return true;
+}
+
+bool Texture::Upload()
+{
+    sf::Lock lock(m_mutex);
+
+    if(m_textureObj != 0)
+    {
+        return true;
+    }
+
+    if(!m_isDecoded)
+    {
+        return false;
+    }
+
+    TraceScope scope("upload", m_fileName);
+    // Generated mips are not uploaded, only the base level is
+    Trace::addBytesUploaded(m_isCompressed ? m_sizeInBytes : m_width * m_height * 4);
+
     glGenTextures(1, &m_textureObj);
     glBindTexture(m_textureTarget, m_textureObj);
-    glTexImage2D(m_textureTarget, 0, GL_RGBA, m_pImage.getSize().x, m_pImage.getSize().y, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_pImage.getPixelsPtr());
-    glTexParameterf(m_textureTarget, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameterf(m_textureTarget, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    if(m_isCompressed)
+    {
+        size_t Offset = sizeof(KtxHeader) + ((const KtxHeader*)m_cookedFile.data())->BytesOfKeyValueData;
+        unsigned int Width = m_width;
+        unsigned int Height = m_height;
+        for(unsigned int i = 0; i < m_numLevels; i++)
+        {
+            unsigned int ImageSize = *(const unsigned int*)(m_cookedFile.data() + Offset);
+            Offset += sizeof(unsigned int);
+            glCompressedTexImage2D(m_textureTarget, i, m_internalFormat, Width, Height, 0,
+                                   ImageSize, m_cookedFile.data() + Offset);
+            Offset += (ImageSize + 3) & ~3;
+            Width = Width > 1 ? Width / 2 : 1;
+            Height = Height > 1 ? Height / 2 : 1;
+        }
+        glTexParameteri(m_textureTarget, GL_TEXTURE_MAX_LEVEL, m_numLevels - 1);
+    }
+    else
+    {
+        glTexImage2D(m_textureTarget, 0, GL_RGBA, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_pImage.getPixelsPtr());
+        glGenerateMipmap(m_textureTarget);
+    }
+
+    glTexParameterf(m_textureTarget, GL_TEXTURE_MIN_FILTER,
+                    m_filter == GL_NEAREST ? GL_NEAREST_MIPMAP_NEAREST : GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameterf(m_textureTarget, GL_TEXTURE_MAG_FILTER, m_filter);
+
+    // The pixels live on the GPU now, so drop the CPU copy
+    m_pImage = sf::Image();
+    m_cookedFile.close();
+    m_isDecoded = false;
 
     return true;
 }
@@ -48,3 +212,107 @@ void Texture::Bind(GLenum TextureUnit)
     glActiveTexture(TextureUnit);
     glBindTexture(m_textureTarget, m_textureObj);
 }
+
+sf::Mutex TextureCache::s_mutex;
+std::map<std::string, TextureCache::CacheEntry>* TextureCache::s_pEntries = NULL;
+unsigned int TextureCache::s_releasedSavedBytes = 0;
+
+// Resolves ./, ../ and symlinks so the same image reached through different
+// relative paths shares one entry. Falls back to the path as given if the
+// file does not exist, Decode will report that.
+std::string TextureCache::Canonicalize(const std::string& FileName)
+{
+#ifdef WIN32
+    char Path[_MAX_PATH];
+    if(_fullpath(Path, FileName.c_str(), _MAX_PATH) != NULL)
+    {
+        return Path;
+    }
+#else
+    char Path[PATH_MAX];
+    if(realpath(FileName.c_str(), Path) != NULL)
+    {
+        return Path;
+    }
+#endif
+    return FileName;
+}
+
+Texture* TextureCache::Acquire(const std::string& FileName, GLint Filter)
+{
+    std::string Key = Canonicalize(FileName);
+    sf::Lock lock(s_mutex);
+
+    // Allocated on first use and never freed, so meshes that are destroyed
+    // during static destruction can still release their textures
+    if(s_pEntries == NULL)
+    {
+        s_pEntries = new std::map<std::string, CacheEntry>();
+    }
+
+    std::map<std::string, CacheEntry>::iterator it = s_pEntries->find(Key);
+    if(it == s_pEntries->end())
+    {
+        CacheEntry Entry;
+        Entry.pTexture = new Texture(GL_TEXTURE_2D, Key, Filter);
+        Entry.RefCount = 0;
+        Entry.NumAcquires = 0;
+        it = s_pEntries->insert(std::make_pair(Key, Entry)).first;
+    }
+
+    it->second.RefCount++;
+    it->second.NumAcquires++;
+
+    return it->second.pTexture;
+}
+
+void TextureCache::Release(Texture* pTexture)
+{
+    if(pTexture == NULL)
+    {
+        return;
+    }
+
+    sf::Lock lock(s_mutex);
+
+    std::map<std::string, CacheEntry>::iterator it = s_pEntries->find(pTexture->GetFileName());
+    if(it == s_pEntries->end() || it->second.pTexture != pTexture)
+    {
+        std::cerr << "Releasing a texture that is not in the cache" << std::endl;
+        return;
+    }
+
+    if(--it->second.RefCount == 0)
+    {
+        s_releasedSavedBytes += (it->second.NumAcquires - 1) * pTexture->GetSizeInBytes();
+        delete pTexture;
+        s_pEntries->erase(it);
+    }
+}
+
+void TextureCache::PrintStats()
+{
+    sf::Lock lock(s_mutex);
+
+    unsigned int NumTextures = 0;
+    unsigned int NumAcquires = 0;
+    unsigned int UsedBytes = 0;
+    unsigned int SavedBytes = s_releasedSavedBytes;
+
+    if(s_pEntries != NULL)
+    {
+        std::map<std::string, CacheEntry>::iterator it;
+        for(it = s_pEntries->begin(); it != s_pEntries->end(); ++it)
+        {
+            NumTextures++;
+            NumAcquires += it->second.NumAcquires;
+            UsedBytes += it->second.pTexture->GetSizeInBytes();
+            SavedBytes += (it->second.NumAcquires - 1) * it->second.pTexture->GetSizeInBytes();
+        }
+    }
+
+    // Every saved copy would have cost its size once decoded on the CPU and
+    // once again on the GPU
+    printf("Texture cache: %u textures for %u references, %.2f MB in use, %.2f MB saved per copy (CPU and GPU)\n",
+           NumTextures, NumAcquires, UsedBytes / (1024.0 * 1024.0), SavedBytes / (1024.0 * 1024.0));
+}
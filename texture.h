@@ -19,30 +19,87 @@
 #ifndef TEXTURE_H
 #define	TEXTURE_H
 
+#include <map>
 #include <string>
 
 #include <GL/glew.h>
 #include <SFML/Graphics.hpp>
+#include "mapped_file.hpp"
 //#include <ImageMagick/Magick++.h>
 
 class Texture
 {
 public:
-    Texture(GLenum TextureTarget, const std::string& FileName);
+    Texture(GLenum TextureTarget, const std::string& FileName, GLint Filter = GL_LINEAR);
+    ~Texture();
 
     bool Load();
 
+    // Load split in two so the image decode can run off the GL thread,
+    // Decode prefers a .ktx file cooked by texcook, which is only mapped
+    // and uploaded as is, and otherwise decodes the source image and has
+    // the driver generate the mips.
+    // Upload must be called on the thread that owns the GL context. Both
+    // are no-ops once they have succeeded, since a cached texture is shared
+    // by everyone who acquired it.
+    bool Decode();
+    bool Upload();
+
     void Bind(GLenum TextureUnit);
 
+    const std::string& GetFileName() const { return m_fileName; }
+    unsigned int GetSizeInBytes() const { return m_sizeInBytes; }
+
 private:
+    bool DecodeCooked(const std::string& CookedFileName);
+
     std::string m_fileName;
     GLenum m_textureTarget;
+    GLint m_filter;
     GLuint m_textureObj;
+    bool m_isDecoded;
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_sizeInBytes;
+    // Only set for cooked textures, whose levels stay mapped until Upload
+    bool m_isCompressed;
+    GLenum m_internalFormat;
+    unsigned int m_numLevels;
+    MappedFile m_cookedFile;
+    sf::Mutex m_mutex;
     sf::Image m_pImage;
     //Magick::Image* m_pImage;
     //Magick::Blob m_blob;
 };
 
+// Process wide cache of 2D textures keyed by canonical path, so an image
+// used by several meshes or particle systems is decoded and uploaded once.
+// Textures are reference counted and deleted when the last user releases
+// them. The filtering is decided by whoever acquires a path first.
+class TextureCache
+{
+public:
+    // Safe to call from the loader threads
+    static Texture* Acquire(const std::string& FileName, GLint Filter = GL_LINEAR);
+    static void Release(Texture* pTexture);
+
+    // Prints how many textures are shared and how much memory that saved
+    static void PrintStats();
+
+private:
+    struct CacheEntry
+    {
+        Texture* pTexture;
+        unsigned int RefCount;
+        unsigned int NumAcquires;
+    };
+
+    static std::string Canonicalize(const std::string& FileName);
+
+    static sf::Mutex s_mutex;
+    static std::map<std::string, CacheEntry>* s_pEntries;
+    static unsigned int s_releasedSavedBytes;
+};
 
 #endif	/* TEXTURE_H */
 
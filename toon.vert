@@ -3,8 +3,6 @@
 layout (location = 0) in vec3 VertexPosition;
 layout (location = 1) in vec2 VertexUVCoords;
 layout (location = 2) in vec3 VertexNormal;
-layout (location = 3) in ivec4 BoneIDs;
-layout (location = 4) in vec4 BoneWeights;
 
 out vec3 LightIntensity;
 out vec2 UV;
@@ -22,27 +20,12 @@ uniform mat4 ModelViewMatrix;
 uniform mat3 NormalMatrix;
 uniform mat4 ProjectionMatrix;
 uniform mat4 MVP;
-uniform mat4 boneMatrices[64];
-uniform bool isDynamic;
 uniform mat4 depthBiasMVP;
 
 void main()
 {
-	bool d = true;
-	mat4 boneMatrix;
-	if(isDynamic)
-	{
-		boneMatrix = boneMatrices[BoneIDs[0]] * BoneWeights[0];
-		boneMatrix += boneMatrices[BoneIDs[1]] * BoneWeights[1];	
-		boneMatrix += boneMatrices[BoneIDs[2]] * BoneWeights[2];	
-		boneMatrix += boneMatrices[BoneIDs[3]] * BoneWeights[3];	
-	}
-	else
-	{
-		boneMatrix = mat4(1.0f);
-	}
-
-	vec3 tnorm = normalize( NormalMatrix * mat3(boneMatrix) * VertexNormal);
+	// Characters come here already skinned by skinning.vert
+	vec3 tnorm = normalize( NormalMatrix * VertexNormal);
 	vec4 eyeCoords = ModelViewMatrix * vec4(VertexPosition, 1.0);
 	vec3 s = normalize(vec3(LightPosition - eyeCoords));
 	vec3 v = normalize(-eyeCoords.xyz);
@@ -65,7 +48,6 @@ void main()
 	}*/
 
 	UV = VertexUVCoords; //* 5;
-	vec4 boneSpacePosition = boneMatrix * vec4(VertexPosition, 1.0);
-	ShadowCoord = depthBiasMVP * boneSpacePosition;
-	gl_Position = MVP * boneSpacePosition;
+	ShadowCoord = depthBiasMVP * vec4(VertexPosition, 1.0);
+	gl_Position = MVP * vec4(VertexPosition, 1.0);
 }
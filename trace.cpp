@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+#include "trace.hpp"
+
+#ifdef WIN32
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
+namespace
+{
+	struct TraceEvent
+	{
+		const char* Category;
+		std::string Name;
+		unsigned int Thread;
+		sf::Int64 Start;
+		sf::Int64 Duration;
+		size_t BytesRead;
+		size_t BytesUploaded;
+	};
+
+	bool longerThan(const TraceEvent& a, const TraceEvent& b)
+	{
+		return a.Duration > b.Duration;
+	}
+
+	// Allocated on first use and never freed, scopes are opened from
+	// constructors of globals and closed until the very end
+	sf::Mutex s_mutex;
+	std::vector<TraceEvent>* s_pEvents = NULL;
+	unsigned int s_numThreads = 0;
+
+	TRACE_THREAD_LOCAL TraceScope* s_pCurrentScope = NULL;
+	TRACE_THREAD_LOCAL unsigned int s_thread = 0;
+
+	sf::Int64 now()
+	{
+		static sf::Clock Clock;
+		return Clock.getElapsedTime().asMicroseconds();
+	}
+
+	// Reads a "Name:   1234 kB" line of /proc/self/status
+	size_t readProcStatus(const char* Name)
+	{
+		FILE* File = fopen("/proc/self/status", "r");
+		if(!File)
+		{
+			return 0;
+		}
+
+		size_t NameLength = strlen(Name);
+		size_t Bytes = 0;
+		char Line[256];
+		while(fgets(Line, sizeof(Line), File))
+		{
+			if(strncmp(Line, Name, NameLength) == 0 && Line[NameLength] == ':')
+			{
+				Bytes = strtoul(Line + NameLength + 1, NULL, 10) * 1024;
+				break;
+			}
+		}
+		fclose(File);
+
+		return Bytes;
+	}
+
+	void writeEscaped(FILE* File, const std::string& String)
+	{
+		for(unsigned int i = 0; i < String.size(); i++)
+		{
+			char c = String[i];
+			if(c == '"' || c == '\\')
+			{
+				fputc('\\', File);
+			}
+			fputc((unsigned char)c < 0x20 ? ' ' : c, File);
+		}
+	}
+}
+
+TraceScope::TraceScope(const char* Category, const std::string& Name)
+	: m_category(Category),
+	  m_name(Name),
+	  m_start(now()),
+	  m_bytes_read(0),
+	  m_bytes_uploaded(0),
+	  m_parent(s_pCurrentScope)
+{
+	s_pCurrentScope = this;
+}
+
+TraceScope::~TraceScope()
+{
+	TraceEvent Event;
+	Event.Category = m_category;
+	Event.Name = m_name;
+	Event.Start = m_start;
+	Event.Duration = now() - m_start;
+	Event.BytesRead = m_bytes_read;
+	Event.BytesUploaded = m_bytes_uploaded;
+
+	s_pCurrentScope = m_parent;
+	if(m_parent)
+	{
+		m_parent->m_bytes_read += m_bytes_read;
+		m_parent->m_bytes_uploaded += m_bytes_uploaded;
+	}
+
+	sf::Lock lock(s_mutex);
+	if(s_thread == 0)
+	{
+		s_thread = ++s_numThreads;
+	}
+	Event.Thread = s_thread;
+	if(s_pEvents == NULL)
+	{
+		s_pEvents = new std::vector<TraceEvent>();
+	}
+	s_pEvents->push_back(Event);
+}
+
+void Trace::addBytesRead(size_t Bytes)
+{
+	if(s_pCurrentScope)
+	{
+		s_pCurrentScope->m_bytes_read += Bytes;
+	}
+}
+
+void Trace::addFileRead(const std::string& Filename)
+{
+	struct stat Stat;
+	if(stat(Filename.c_str(), &Stat) == 0)
+	{
+		addBytesRead(Stat.st_size);
+	}
+}
+
+void Trace::addBytesUploaded(size_t Bytes)
+{
+	if(s_pCurrentScope)
+	{
+		s_pCurrentScope->m_bytes_uploaded += Bytes;
+	}
+}
+
+size_t Trace::getResidentBytes()
+{
+	return readProcStatus("VmRSS");
+}
+
+size_t Trace::getPeakResidentBytes()
+{
+	return readProcStatus("VmHWM");
+}
+
+bool Trace::writeChromeTrace(const std::string& Filename)
+{
+	FILE* File = fopen(Filename.c_str(), "w");
+	if(!File)
+	{
+		printf("Error opening '%s' for writing\n", Filename.c_str());
+		return false;
+	}
+
+	sf::Lock lock(s_mutex);
+
+	fprintf(File, "{\"traceEvents\":[\n");
+	for(unsigned int i = 0; s_pEvents && i < s_pEvents->size(); i++)
+	{
+		const TraceEvent& Event = (*s_pEvents)[i];
+		fprintf(File, "%s{\"name\":\"", i > 0 ? ",\n" : "");
+		writeEscaped(File, Event.Name);
+		fprintf(File, "\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld,"
+				"\"args\":{\"bytes_read\":%lu,\"bytes_uploaded\":%lu}}",
+				Event.Category, Event.Thread, (long long)Event.Start, (long long)Event.Duration,
+				(unsigned long)Event.BytesRead, (unsigned long)Event.BytesUploaded);
+	}
+	fprintf(File, "\n]}\n");
+
+	bool Ret = !ferror(File);
+	fclose(File);
+
+	return Ret;
+}
+
+void Trace::printSummary()
+{
+	sf::Lock lock(s_mutex);
+
+	if(s_pEvents == NULL)
+	{
+		return;
+	}
+
+	// Sorted on a copy, the trace keeps the events in completion order
+	std::vector<TraceEvent> Events(*s_pEvents);
+	std::sort(Events.begin(), Events.end(), longerThan);
+
+	printf("%10s %10s %10s %10s  %-8s %s\n", "ms", "read KB", "upload KB", "read MB/s",
+		   "category", "name");
+	for(unsigned int i = 0; i < Events.size(); i++)
+	{
+		const TraceEvent& Event = Events[i];
+		double Seconds = Event.Duration / 1000000.0;
+		printf("%10.2f %10.1f %10.1f %10.1f  %-8s %s\n", Event.Duration / 1000.0,
+			   Event.BytesRead / 1024.0, Event.BytesUploaded / 1024.0,
+			   Seconds > 0.0 ? Event.BytesRead / (1024.0 * 1024.0) / Seconds : 0.0,
+			   Event.Category, Event.Name.c_str());
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <string>
+#include <SFML/System.hpp>
+
+/* Scoped timing for startup work. Put a TraceScope at the top of anything
+that loads, compiles or uploads and report the bytes it reads and uploads
+through Trace, they are credited to the innermost open scope on the calling
+thread and to every scope around it. Scopes can be opened on any thread.
+
+	TraceScope scope("texture", Filename);
+	Trace::addFileRead(Filename);
+
+At exit the recorded scopes are written out as a Chrome trace (load it in
+chrome://tracing) and as a summary sorted by duration. */
+
+class TraceScope
+{
+public:
+	TraceScope(const char* Category, const std::string& Name);
+	~TraceScope();
+
+private:
+	TraceScope(const TraceScope&);
+	TraceScope& operator=(const TraceScope&);
+
+	friend class Trace;
+
+	const char* m_category;
+	std::string m_name;
+	sf::Int64 m_start;
+	size_t m_bytes_read;
+	size_t m_bytes_uploaded;
+	TraceScope* m_parent;
+};
+
+class Trace
+{
+public:
+	static void addBytesRead(size_t Bytes);
+	// Adds the size of the file, for reads done by libraries we cannot count
+	static void addFileRead(const std::string& Filename);
+	static void addBytesUploaded(size_t Bytes);
+
+	// Resident set size of the process now and at its highest, in bytes.
+	// Both are 0 where /proc/self/status is not available.
+	static size_t getResidentBytes();
+	static size_t getPeakResidentBytes();
+
+	static bool writeChromeTrace(const std::string& Filename);
+	static void printSummary();
+};
+
+#endif
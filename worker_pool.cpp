@@ -0,0 +1,229 @@
+#ifndef WIN32
+#include <errno.h>
+#include <unistd.h>
+#else
+#include <windows.h>
+#endif
+#include "worker_pool.hpp"
+
+WorkerPool::WorkerPool(unsigned int NumThreads)
+	: m_num_running(0),
+	  m_is_stopping(false),
+	  m_is_waiting(false)
+{
+	if(NumThreads == 0)
+	{
+		NumThreads = 1;
+	}
+
+#ifndef WIN32
+	sem_init(&m_wake, 0, 0);
+	sem_init(&m_idle, 0, 0);
+#else
+	m_wake = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+	m_idle = CreateSemaphore(NULL, 0, 1, NULL);
+#endif
+
+	for(unsigned int i = 0; i < NumThreads; i++)
+	{
+		sf::Thread* thread = new sf::Thread(&WorkerPool::workerMain, this);
+		m_threads.push_back(thread);
+		thread->launch();
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		sf::Lock lock(m_mutex);
+		m_is_stopping = true;
+	}
+
+	for(unsigned int i = 0; i < m_threads.size(); i++)
+	{
+		signalWorker();
+	}
+	for(unsigned int i = 0; i < m_threads.size(); i++)
+	{
+		m_threads[i]->wait();
+		delete m_threads[i];
+	}
+
+#ifndef WIN32
+	sem_destroy(&m_wake);
+	sem_destroy(&m_idle);
+#else
+	CloseHandle(m_wake);
+	CloseHandle(m_idle);
+#endif
+}
+
+void WorkerPool::signalWorker()
+{
+#ifndef WIN32
+	sem_post(&m_wake);
+#else
+	ReleaseSemaphore(m_wake, 1, NULL);
+#endif
+}
+
+void WorkerPool::waitForSignal()
+{
+#ifndef WIN32
+	while(sem_wait(&m_wake) != 0 && errno == EINTR)
+	{
+	}
+#else
+	WaitForSingleObject(m_wake, INFINITE);
+#endif
+}
+
+void WorkerPool::signalIdle()
+{
+#ifndef WIN32
+	sem_post(&m_idle);
+#else
+	ReleaseSemaphore(m_idle, 1, NULL);
+#endif
+}
+
+void WorkerPool::waitForIdle()
+{
+#ifndef WIN32
+	while(sem_wait(&m_idle) != 0 && errno == EINTR)
+	{
+	}
+#else
+	WaitForSingleObject(m_idle, INFINITE);
+#endif
+}
+
+unsigned int WorkerPool::getCoreCount()
+{
+#ifndef WIN32
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? count : 1;
+#else
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+#endif
+}
+
+void WorkerPool::push(Job* pJob)
+{
+	{
+		sf::Lock lock(m_mutex);
+		m_pending.push_back(pJob);
+	}
+	signalWorker();
+}
+
+WorkerPool::Job* WorkerPool::waitFinished()
+{
+	// SFML has no condition variables, so the caller polls for finished
+	// jobs. Only the load jobs are waited for this way, and they each take
+	// milliseconds at the very least, so the sleep is not noticeable. The
+	// per frame jobs go through waitAll instead.
+	while(true)
+	{
+		{
+			sf::Lock lock(m_mutex);
+			if(!m_finished.empty())
+			{
+				Job* pJob = m_finished.front();
+				m_finished.pop_front();
+				return pJob;
+			}
+			if(m_pending.empty() && m_num_running == 0)
+			{
+				return NULL;
+			}
+		}
+		sf::sleep(sf::milliseconds(1));
+	}
+}
+
+void WorkerPool::waitAll()
+{
+	while(true)
+	{
+		Job* pJob = NULL;
+		{
+			sf::Lock lock(m_mutex);
+			m_finished.clear();
+			if(!m_pending.empty())
+			{
+				pJob = m_pending.front();
+				m_pending.pop_front();
+				m_num_running++;
+			}
+			else if(m_num_running == 0)
+			{
+				return;
+			}
+			else
+			{
+				m_is_waiting = true;
+			}
+		}
+
+		if(!pJob)
+		{
+			// Only the last few jobs are left running on the workers. The
+			// worker that finishes the last one signals, and the loop checks
+			// again in case more were pushed meanwhile.
+			waitForIdle();
+			continue;
+		}
+
+		pJob->run();
+
+		{
+			sf::Lock lock(m_mutex);
+			m_num_running--;
+		}
+	}
+}
+
+void WorkerPool::workerMain()
+{
+	while(true)
+	{
+		Job* pJob = NULL;
+		{
+			sf::Lock lock(m_mutex);
+			if(m_is_stopping)
+			{
+				return;
+			}
+			if(!m_pending.empty())
+			{
+				pJob = m_pending.front();
+				m_pending.pop_front();
+				m_num_running++;
+			}
+		}
+
+		// The job this signal was for may have been taken by waitAll on the
+		// calling thread, then there is nothing to do until the next one
+		if(!pJob)
+		{
+			waitForSignal();
+			continue;
+		}
+
+		pJob->run();
+
+		{
+			sf::Lock lock(m_mutex);
+			m_num_running--;
+			m_finished.push_back(pJob);
+			if(m_is_waiting && m_num_running == 0 && m_pending.empty())
+			{
+				m_is_waiting = false;
+				signalIdle();
+			}
+		}
+	}
+}
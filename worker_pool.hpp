@@ -0,0 +1,68 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <deque>
+#include <vector>
+#include <SFML/System.hpp>
+#ifndef WIN32
+#include <semaphore.h>
+#endif
+
+// A fixed set of worker threads pulling jobs off a shared queue. Finished
+// jobs are handed back through waitFinished so the caller can do whatever
+// has to happen on its own thread (like GL uploads) as each one completes.
+// The pool never owns the jobs pushed to it. Idle workers block on a
+// semaphore that every push signals, so per frame jobs start straight away
+// instead of waiting for a polling worker to wake up.
+class WorkerPool
+{
+public:
+	class Job
+	{
+	public:
+		virtual ~Job() {}
+		virtual void run() = 0;
+	};
+
+	WorkerPool(unsigned int NumThreads);
+	~WorkerPool();
+	void push(Job* pJob);
+	// Blocks until a job finishes and returns it, or returns NULL straight
+	// away if nothing is queued or running
+	Job* waitFinished();
+	// Blocks until every queued job has run, running them on the calling
+	// thread too rather than sleeping. Once the queue is empty it blocks on
+	// a semaphore the last worker to finish signals. Meant for jobs pushed
+	// every frame, so finished jobs are dropped instead of being handed back.
+	void waitAll();
+	unsigned int getNumThreads() const { return m_threads.size(); }
+
+	static unsigned int getCoreCount();
+
+private:
+	void workerMain();
+	// One signal per pushed job, plus one per worker when stopping
+	void signalWorker();
+	void waitForSignal();
+	// Signalled once when the last running job finishes while waitAll is
+	// blocked on it
+	void signalIdle();
+	void waitForIdle();
+
+	std::vector<sf::Thread*> m_threads;
+	sf::Mutex m_mutex;
+	std::deque<Job*> m_pending;
+	std::deque<Job*> m_finished;
+	unsigned int m_num_running;
+	bool m_is_stopping;
+	bool m_is_waiting;	// waitAll is blocked on m_idle
+#ifndef WIN32
+	sem_t m_wake;
+	sem_t m_idle;
+#else
+	void* m_wake;	// a HANDLE, kept opaque so windows.h stays out of here
+	void* m_idle;
+#endif
+};
+
+#endif